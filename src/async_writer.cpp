@@ -0,0 +1,249 @@
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <unistd.h>
+#include "async_writer.h"
+
+// O_DIRECT wants offsets, sizes and memory aligned to the logical block size; 4 KiB covers
+// every disk we care about
+static constexpr size_t direct_alignment = 4096;
+
+// fallocate this much ahead of the write position so the filesystem can lay out large extents
+static constexpr uint64_t preallocate_step = 256 << 20;
+
+async_writer::async_writer(const std::string& path, size_t block_size_, size_t block_count)
+        : block_size((block_size_ + direct_alignment - 1) / direct_alignment * direct_alignment) {
+
+    fd = open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC | O_DIRECT, 0644);
+    direct = fd >= 0;
+    if (fd < 0 && errno == EINVAL) {
+        fd = open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    }
+    if (fd < 0) {
+        perror(("Cannot open " + path).c_str());
+        return;
+    }
+
+    blocks.resize(std::max<size_t>(block_count, 2));
+    for (size_t i = 0; i < blocks.size(); i++) {
+        void *memory = nullptr;
+        if (posix_memalign(&memory, direct_alignment, block_size) != 0) {
+            perror("posix_memalign");
+            exit(1);
+        }
+        blocks[i] = {static_cast<uint8_t *>(memory), 0, 0, 0, false};
+        if (i != current) {
+            free_blocks.push_back(i);
+        }
+    }
+
+    write_thread = std::thread(&async_writer::write_fun, this);
+}
+
+async_writer::~async_writer() {
+    close();
+    for (auto& b: blocks) {
+        free(b.data);
+    }
+}
+
+void async_writer::append(const void *data, size_t size) {
+    if (fd < 0 || failed()) {
+        return;
+    }
+
+    auto src = static_cast<const uint8_t *>(data);
+    while (size > 0) {
+        auto& b = blocks[current];
+        const size_t n = std::min(size, block_size - b.used);
+        memcpy(b.data + b.used, src, n);
+        b.used += n;
+        appended += n;
+        src += n;
+        size -= n;
+
+        if (b.used == block_size) {
+            submit_current();
+        }
+    }
+}
+
+// Where the current block's writing starts: after what flush() queued, down to the alignment.
+size_t async_writer::unflushed_start() const {
+    return direct ? flushed / direct_alignment * direct_alignment : flushed;
+}
+
+void async_writer::submit_current() {
+    blocks[current].start = unflushed_start();
+    flushed = 0;
+
+    std::unique_lock<std::mutex> lock(queue_mutex);
+    queued.push_back(current);
+    queue_changed.notify_all();
+
+    if (free_blocks.empty()) {
+        // the disk is behind; this is where callers feel the backpressure
+        wait_count++;
+        queue_changed.wait(lock, [this]() { return !free_blocks.empty(); });
+    }
+    current = free_blocks.back();
+    free_blocks.pop_back();
+
+    blocks[current].used = 0;
+    blocks[current].start = 0;
+    blocks[current].offset = appended;
+    blocks[current].sync = false;
+}
+
+void async_writer::flush(bool sync) {
+    if (fd < 0 || blocks[current].used == flushed) {
+        return;
+    }
+
+    size_t copy;
+    {
+        std::unique_lock<std::mutex> lock(queue_mutex);
+        if (free_blocks.empty()) {
+            wait_count++;
+            queue_changed.wait(lock, [this]() { return !free_blocks.empty(); });
+        }
+        copy = free_blocks.back();
+        free_blocks.pop_back();
+    }
+
+    // the current block keeps filling, a copy of what is new in it goes out to its offset
+    const auto& b = blocks[current];
+    const size_t start = unflushed_start();
+    memcpy(blocks[copy].data, b.data + start, b.used - start);
+    blocks[copy].used = b.used - start;
+    blocks[copy].start = 0;
+    blocks[copy].offset = b.offset + start;
+    blocks[copy].sync = sync;
+    flushed = b.used;
+
+    std::lock_guard<std::mutex> lock(queue_mutex);
+    queued.push_back(copy);
+    queue_changed.notify_all();
+}
+
+void async_writer::close() {
+    if (fd < 0) {
+        return;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(queue_mutex);
+        if (blocks[current].used > flushed) {
+            blocks[current].start = unflushed_start();
+            queued.push_back(current);
+        }
+        stopping = true;
+        queue_changed.notify_all();
+    }
+    write_thread.join();
+
+    // the last block went out padded to the alignment; after a failure the rest never went out
+    if (ftruncate(fd, write_failed ? bytes_written : appended) != 0) {
+        perror("ftruncate");
+    }
+    ::close(fd);
+    fd = -1;
+}
+
+size_t async_writer::waits() const {
+    std::lock_guard<std::mutex> lock(queue_mutex);
+    return wait_count;
+}
+
+uint64_t async_writer::written() const {
+    std::lock_guard<std::mutex> lock(queue_mutex);
+    return bytes_written;
+}
+
+bool async_writer::failed() const {
+    std::lock_guard<std::mutex> lock(queue_mutex);
+    return write_failed;
+}
+
+void async_writer::write_fun() {
+    bool failed = false;
+    while (true) {
+        size_t index;
+        {
+            std::unique_lock<std::mutex> lock(queue_mutex);
+            queue_changed.wait(lock, [this]() { return !queued.empty() || stopping; });
+            if (queued.empty()) {
+                return;
+            }
+            index = queued.front();
+            queued.erase(queued.begin());
+            failed = write_failed;
+        }
+
+        // after a failure blocks are only handed back, a file with holes is worse than a short one
+        auto& b = blocks[index];
+        if (!failed && !write_block(b)) {
+            failed = true;
+        }
+        if (!failed && b.sync && fdatasync(fd) != 0) {
+            perror("Recording fdatasync failed");
+            failed = true;
+        }
+
+        std::lock_guard<std::mutex> lock(queue_mutex);
+        write_failed = failed;
+        if (!failed && b.offset + b.used > bytes_written) {
+            // the aligned start of a block may go out twice, count every byte once
+            bytes_written = b.offset + b.used;
+        }
+        b.sync = false;
+        free_blocks.push_back(index);
+        queue_changed.notify_all();
+    }
+}
+
+// false when the block couldn't be written
+bool async_writer::write_block(block& b) {
+    size_t size = b.used;
+    if (direct && size % direct_alignment) {
+        // flush() and close() leave blocks partial; the next write there covers the padding,
+        // close() truncates it away
+        const size_t padded = (size + direct_alignment - 1) / direct_alignment * direct_alignment;
+        memset(b.data + size, 0, padded - size);
+        size = padded;
+    }
+
+    preallocate(b.offset + size);
+
+    size_t done = b.start;
+    while (done < size) {
+        const ssize_t r = pwrite(fd, b.data + done, size - done, b.offset + done);
+        if (r < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            perror("Recording write failed");
+            return false;
+        }
+        done += r;
+    }
+    return true;
+}
+
+void async_writer::preallocate(uint64_t end) {
+    if (end <= allocated || !can_preallocate) {
+        return;
+    }
+
+    // KEEP_SIZE: the file only grows as data lands; not every filesystem supports this at all,
+    // and where it fails otherwise the write finds out whether there is space
+    const uint64_t length = std::max(preallocate_step, end - allocated);
+    if (fallocate(fd, FALLOC_FL_KEEP_SIZE, allocated, length) == 0) {
+        allocated += length;
+    } else if (errno == EOPNOTSUPP) {
+        can_preallocate = false;
+    }
+}
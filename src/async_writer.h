@@ -0,0 +1,84 @@
+#pragma once
+
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Appends to a file through a few large aligned blocks that a thread of its own writes out with
+// O_DIRECT, so streaming hundreds of MB/s to disk neither stalls the caller on every write nor
+// pushes everything else out of the page cache. Space is preallocated ahead with fallocate.
+// Where O_DIRECT isn't supported (tmpfs, some network filesystems) it falls back to buffered
+// writes.
+class async_writer {
+public:
+    explicit async_writer(const std::string& path, size_t block_size = 8 << 20, size_t block_count = 4);
+    ~async_writer();
+
+    bool is_open() const { return fd >= 0; }
+
+    // copies into the current block; waits while every block is still queued for the disk
+    void append(const void *data, size_t size);
+
+    // Queues everything appended so far for the disk without waiting for the current block to
+    // fill up; with sync the writer thread also fdatasyncs it. Only what no earlier flush queued
+    // goes out, with O_DIRECT from the start of the 4 KiB it begins in and padded to the end of
+    // the one it ends in. Call it where append is.
+    void flush(bool sync);
+
+    // writes what is left and truncates the file to the bytes appended
+    void close();
+
+    // bytes appended so far, the file offset of the next append
+    uint64_t position() const { return appended; }
+
+    // times append() had to wait for the disk
+    size_t waits() const;
+
+    // bytes that reached the disk
+    uint64_t written() const;
+
+    // true once a write failed; nothing is written after that and the file ends where the
+    // failure was
+    bool failed() const;
+
+private:
+    struct block {
+        uint8_t *data;
+        size_t used;
+        size_t start;    // bytes before it went out with a flush() already
+        uint64_t offset;
+        bool sync; // fdatasync once written, for flush()
+    };
+
+    void submit_current();
+    size_t unflushed_start() const;
+    void write_fun();
+    bool write_block(block& b);
+    void preallocate(uint64_t end);
+
+    int fd = -1;
+    bool direct = false;
+    size_t block_size;
+    uint64_t appended = 0;
+    uint64_t allocated = 0;
+    bool can_preallocate = true;
+
+    std::vector<block> blocks;
+    size_t current = 0;
+    size_t flushed = 0; // bytes of the current block flush() queued
+
+    mutable std::mutex queue_mutex;
+    std::condition_variable queue_changed;
+    std::vector<size_t> queued;     // blocks waiting for the writer thread, oldest first
+    std::vector<size_t> free_blocks;
+    size_t wait_count = 0;
+    uint64_t bytes_written = 0;
+    bool write_failed = false;
+    bool stopping = false;
+
+    std::thread write_thread;
+};
@@ -3,16 +3,24 @@
 #include <cmath>
 #include <cstring>
 #include "circular_buffer.h"
+#include "cache_dir.h"
 
 static buffered_stream<float> audio_buffer{1024 * 30, 1024 * 20};
 
-static int record_callback(void *outputBuffer, void *inputBuffer, unsigned int bufferFrames,
-                           double streamTime, RtAudioStreamStatus status, void *userData) {
+int audio_source::record_callback(void *outputBuffer, void *inputBuffer, unsigned int bufferFrames,
+                                  double streamTime, RtAudioStreamStatus status, void *userData) {
     if (status)
         std::cout << "Stream overflow detected!" << std::endl;
 
     auto *in = static_cast<float *>(inputBuffer);
 
+    auto self = static_cast<audio_source *>(userData);
+    if (self->sink) {
+        // the block started this long ago
+        const auto duration = std::chrono::microseconds(bufferFrames * 1000000ull / sample_rate);
+        self->sink(in, bufferFrames, channels, sample_rate, std::chrono::steady_clock::now() - duration);
+    }
+
     for (int i = 0; i < bufferFrames; i++) {
         audio_buffer.put(*in++);
         audio_buffer.put(*in++);
@@ -38,13 +46,28 @@ static int render_callback(void *outputBuffer, void *, unsigned int bufferFrames
     return 0;
 }
 
+// Probing every device is slow, so the id found last time gets checked first.
 int get_input_device(RtAudio *audio, const std::string& device_name) {
     auto devices = audio->getDeviceCount();
 
+    const std::string cache_name = "audio-" + cache_file_name(device_name);
+    const std::string cached = read_cache_file(cache_name);
+    if (!cached.empty()) {
+        const int id = atoi(cached.c_str());
+        try {
+            if (id >= 0 && (unsigned) id < devices && audio->getDeviceInfo(id).name == device_name) {
+                return id;
+            }
+        } catch (RtAudioError& e) {
+            // gone or renumbered, scan below
+        }
+    }
+
     for (int i = 0; i < devices; i++) {
         try {
             RtAudio::DeviceInfo info = audio->getDeviceInfo(i);
             if (info.name == device_name) {
+                write_cache_file(cache_name, std::to_string(i));
                 return i;
             }
 
@@ -108,7 +131,7 @@ void audio_source::enumerate_output_devices() {
     }
 }
 
-audio_source::audio_source(const std::string& audio_device) {
+audio_source::audio_source(const std::string& audio_device, input_sink sink_) : sink(std::move(sink_)) {
     try {
         audio_in = new RtAudio(RtAudio::LINUX_ALSA);
         audio_out = new RtAudio(RtAudio::LINUX_PULSE);
@@ -129,7 +152,7 @@ audio_source::audio_source(const std::string& audio_device) {
         unsigned int sampleRate = 48000;
         unsigned int bufferFrames = 48;
 
-        audio_in->openStream(nullptr, &iParams, RTAUDIO_FLOAT32, sampleRate, &bufferFrames, &record_callback, nullptr);
+        audio_in->openStream(nullptr, &iParams, RTAUDIO_FLOAT32, sampleRate, &bufferFrames, &record_callback, this);
         audio_in->startStream();
     } catch (RtAudioError& e) {
         std::cerr << "Failed to open audio input stream. Cause: " << e.what();
@@ -1,16 +1,31 @@
 #pragma once
 
+#include <chrono>
+#include <functional>
 #include <rtaudio/RtAudio.h>
 
 class audio_source {
 public:
-    audio_source(const std::string& audio_device);
+    // Sees every block of captured samples on the audio thread, interleaved float. It has to
+    // return quickly, the next block is due in about a millisecond.
+    using input_sink = std::function<void(const float *samples, size_t frames, uint32_t channels, uint32_t sample_rate,
+                                          std::chrono::steady_clock::time_point timestamp)>;
+
+    // the format of captured and played samples
+    static constexpr uint32_t channels = 2;
+    static constexpr uint32_t sample_rate = 48000;
+
+    explicit audio_source(const std::string& audio_device, input_sink sink = nullptr);
     ~audio_source();
 
     static void enumerate_input_devices();
     static void enumerate_output_devices();
 
 private:
+    static int record_callback(void *outputBuffer, void *inputBuffer, unsigned int bufferFrames,
+                               double streamTime, RtAudioStreamStatus status, void *userData);
+
+    input_sink sink;
     RtAudio *audio_in;
     RtAudio *audio_out;
 };
\ No newline at end of file
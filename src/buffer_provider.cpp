@@ -0,0 +1,184 @@
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <fcntl.h>
+#include <libv4l2.h>
+#include <linux/udmabuf.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#include "buffer_provider.h"
+
+static size_t round_up(size_t size, size_t alignment) {
+    return (size + alignment - 1) / alignment * alignment;
+}
+
+// The driver's own buffers, mapped through libv4l so it can convert into them.
+class mmap_provider : public buffer_provider {
+public:
+    v4l2_memory memory() const override { return V4L2_MEMORY_MMAP; }
+    const char *name() const override { return "mmap"; }
+
+    bool allocate(int device, size_t, video_buffer_info *buffers, size_t count) override {
+        for (size_t i = 0; i < count; ++i) {
+            v4l2_buffer buffer;
+            memset(&buffer, 0, sizeof(buffer));
+            buffer.index = i;
+            buffer.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+            buffer.memory = V4L2_MEMORY_MMAP;
+            if (v4l2_ioctl(device, VIDIOC_QUERYBUF, &buffer) != 0) {
+                perror("VIDIOC_QUERYBUF");
+                return false;
+            }
+
+            buffers[i].offset = buffer.m.offset;
+            buffers[i].length = buffer.length;
+            buffers[i].start = v4l2_mmap(nullptr, buffer.length, PROT_READ | PROT_WRITE, MAP_SHARED, device, buffer.m.offset);
+            if (buffers[i].start == MAP_FAILED) {
+                perror("mmap");
+                return false;
+            }
+        }
+        return true;
+    }
+
+    void release(video_buffer_info *buffers, size_t count) override {
+        for (size_t i = 0; i < count; ++i) {
+            if (buffers[i].start != MAP_FAILED) {
+                v4l2_munmap(buffers[i].start, buffers[i].length);
+                buffers[i].start = MAP_FAILED;
+            }
+        }
+    }
+};
+
+// Our own memfd pages, which the device writes through a dmabuf /dev/udmabuf makes of them. The
+// dmabufs can be passed on to other processes or imported elsewhere as they are.
+class udmabuf_provider : public buffer_provider {
+public:
+    v4l2_memory memory() const override { return V4L2_MEMORY_DMABUF; }
+    const char *name() const override { return "udmabuf"; }
+
+    bool allocate(int, size_t size, video_buffer_info *buffers, size_t count) override {
+        const int device = open("/dev/udmabuf", O_RDWR | O_CLOEXEC);
+        if (device < 0) {
+            perror("Cannot open /dev/udmabuf");
+            return false;
+        }
+
+        const size_t length = round_up(size, static_cast<size_t>(sysconf(_SC_PAGESIZE)));
+        bool ok = true;
+        for (size_t i = 0; i < count && ok; ++i) {
+            ok = allocate_one(device, length, buffers[i]);
+        }
+        close(device);
+        return ok;
+    }
+
+    void release(video_buffer_info *buffers, size_t count) override {
+        for (size_t i = 0; i < count; ++i) {
+            if (buffers[i].start != MAP_FAILED) {
+                munmap(buffers[i].start, buffers[i].length);
+                buffers[i].start = MAP_FAILED;
+            }
+            if (buffers[i].fd >= 0) {
+                close(buffers[i].fd);
+                buffers[i].fd = -1;
+            }
+        }
+    }
+
+private:
+    static bool allocate_one(int device, size_t length, video_buffer_info& buffer) {
+        const int memfd = memfd_create("capture", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+        if (memfd < 0) {
+            perror("memfd_create");
+            return false;
+        }
+
+        // udmabuf only takes memfds that can't shrink under it
+        bool ok = ftruncate(memfd, static_cast<off_t>(length)) == 0 && fcntl(memfd, F_ADD_SEALS, F_SEAL_SHRINK) == 0;
+        if (ok) {
+            udmabuf_create create;
+            memset(&create, 0, sizeof(create));
+            create.memfd = static_cast<uint32_t>(memfd);
+            create.flags = UDMABUF_FLAGS_CLOEXEC;
+            create.size = length;
+            buffer.fd = ioctl(device, UDMABUF_CREATE, &create);
+            ok = buffer.fd >= 0;
+        }
+        if (ok) {
+            buffer.start = mmap(nullptr, length, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, memfd, 0);
+            ok = buffer.start != MAP_FAILED;
+        }
+        if (!ok) {
+            perror("udmabuf");
+        }
+
+        // the dmabuf and the mapping keep the pages
+        close(memfd);
+        buffer.length = length;
+        buffer.offset = 0;
+        return ok;
+    }
+};
+
+// One pool of huge pages, so the device's scatter list and our TLB stay short; a buffer is a
+// stretch of it handed to the driver as a user pointer. Falls back to transparent huge pages
+// when none are reserved in /proc/sys/vm/nr_hugepages.
+class hugepage_provider : public buffer_provider {
+public:
+    v4l2_memory memory() const override { return V4L2_MEMORY_USERPTR; }
+    const char *name() const override { return "hugepages"; }
+
+    bool allocate(int, size_t size, video_buffer_info *buffers, size_t count) override {
+        const size_t stride = round_up(size, huge_page_size);
+        pool_size = stride * count;
+        pool = mmap(nullptr, pool_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB | MAP_POPULATE, -1, 0);
+        if (pool == MAP_FAILED) {
+            std::cout << "No huge pages reserved for " << pool_size / 1024 / 1024 << " MB of capture buffers, using transparent huge pages" << std::endl;
+            pool = mmap(nullptr, pool_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+            if (pool == MAP_FAILED) {
+                perror("mmap");
+                return false;
+            }
+            madvise(pool, pool_size, MADV_HUGEPAGE);
+            // fault everything in now rather than on the driver's first pin
+            memset(pool, 0, pool_size);
+        }
+
+        for (size_t i = 0; i < count; ++i) {
+            buffers[i].start = static_cast<uint8_t *>(pool) + stride * i;
+            buffers[i].length = stride;
+            buffers[i].offset = 0;
+        }
+        return true;
+    }
+
+    void release(video_buffer_info *buffers, size_t count) override {
+        for (size_t i = 0; i < count; ++i) {
+            buffers[i].start = MAP_FAILED;
+        }
+        if (pool != MAP_FAILED) {
+            munmap(pool, pool_size);
+            pool = MAP_FAILED;
+        }
+    }
+
+private:
+    static constexpr size_t huge_page_size = 2 << 20;
+    void *pool = MAP_FAILED;
+    size_t pool_size = 0;
+};
+
+buffer_provider *buffer_provider::create(capture_memory memory) {
+    switch (memory) {
+        case capture_memory::udmabuf:
+            return new udmabuf_provider();
+        case capture_memory::hugepages:
+            return new hugepage_provider();
+        default:
+            return new mmap_provider();
+    }
+}
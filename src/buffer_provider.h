@@ -0,0 +1,36 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <linux/videodev2.h>
+
+struct video_buffer_info {
+    void *start;
+    size_t length;
+    uint32_t offset;
+    int fd = -1; // a dmabuf of the buffer, when the provider has one
+};
+
+// Where capture buffers come from.
+enum class capture_memory {
+    mmap,      // allocated by the driver and mapped
+    udmabuf,   // memfd pages turned into dmabufs with /dev/udmabuf, imported with V4L2_MEMORY_DMABUF
+    hugepages, // carved from a huge page pool, handed over with V4L2_MEMORY_USERPTR
+};
+
+// Allocates the buffers video_source captures into. Runs between REQBUFS with memory() and
+// the first QBUF, and after STREAMOFF again to free them.
+class buffer_provider {
+public:
+    virtual ~buffer_provider() = default;
+
+    static buffer_provider *create(capture_memory memory);
+
+    virtual v4l2_memory memory() const = 0;
+    virtual const char *name() const = 0;
+
+    // Fills in count buffers of at least size bytes each. False, with the reason printed, when
+    // that didn't work; whatever was allocated is freed by release() either way.
+    virtual bool allocate(int device, size_t size, video_buffer_info *buffers, size_t count) = 0;
+    virtual void release(video_buffer_info *buffers, size_t count) = 0;
+};
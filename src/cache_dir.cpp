@@ -0,0 +1,73 @@
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <sstream>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "cache_dir.h"
+
+static bool make_dir(const std::string& path) {
+    return mkdir(path.c_str(), 0755) == 0 || errno == EEXIST;
+}
+
+std::string cache_dir() {
+    static const std::string dir = []() -> std::string {
+        std::string base;
+        if (const char *xdg = getenv("XDG_CACHE_HOME"); xdg && *xdg) {
+            base = xdg;
+        } else if (const char *home = getenv("HOME"); home && *home) {
+            base = std::string(home) + "/.cache";
+        } else {
+            return "";
+        }
+
+        const std::string path = base + "/streamer";
+        if (!make_dir(base) || !make_dir(path)) {
+            return "";
+        }
+        return path;
+    }();
+    return dir;
+}
+
+std::string read_cache_file(const std::string& name) {
+    if (cache_dir().empty()) {
+        return "";
+    }
+
+    std::ifstream in(cache_dir() + "/" + name, std::ios::binary);
+    std::stringstream contents;
+    contents << in.rdbuf();
+    return contents.str();
+}
+
+void write_cache_file(const std::string& name, const std::string& contents) {
+    if (cache_dir().empty()) {
+        return;
+    }
+
+    // readers never see a half written file
+    const std::string path = cache_dir() + "/" + name;
+    const std::string temp = path + "." + std::to_string(getpid());
+    {
+        std::ofstream out(temp, std::ios::binary | std::ios::trunc);
+        out.write(contents.data(), contents.size());
+        if (!out) {
+            std::remove(temp.c_str());
+            return;
+        }
+    }
+    if (std::rename(temp.c_str(), path.c_str()) != 0) {
+        std::remove(temp.c_str());
+    }
+}
+
+std::string cache_file_name(const std::string& key) {
+    std::string name;
+    for (char c: key) {
+        const bool safe = (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9') || c == '-' || c == '.';
+        name += safe ? c : '_';
+    }
+    return name;
+}
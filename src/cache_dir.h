@@ -0,0 +1,18 @@
+#pragma once
+
+#include <string>
+
+// Small files remembered between runs, under $XDG_CACHE_HOME/streamer or ~/.cache/streamer.
+// Everything in there can be deleted at any time; it only makes the next start faster.
+
+// the cache directory, created on first use; empty when there is no usable home directory
+std::string cache_dir();
+
+// contents of a cache file, empty when it doesn't exist
+std::string read_cache_file(const std::string& name);
+
+// replaces a cache file atomically; failures are ignored, the cache is only an optimization
+void write_cache_file(const std::string& name, const std::string& contents);
+
+// turns an arbitrary key (bus info, renderer name...) into something usable in a file name
+std::string cache_file_name(const std::string& key);
@@ -0,0 +1,128 @@
+#include <climits>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/select.h>
+#include <linux/videodev2.h>
+#include <libudev.h>
+#include "device_monitor.h"
+
+device_monitor::device_monitor(const std::string& device_path, const std::string& bus_info_, callback on_removed, callback on_added)
+        : bus_info(bus_info_), current_node(device_node(device_path)), removed(std::move(on_removed)), added(std::move(on_added)) {
+
+    if (device_path.rfind("/dev/v4l/", 0) == 0) {
+        stable_link = device_path;
+    }
+
+    context = udev_new();
+    if (!context) {
+        std::cerr << "udev not available, video device hot-plug disabled" << std::endl;
+        return;
+    }
+
+    monitor = udev_monitor_new_from_netlink(context, "udev");
+    if (!monitor
+        || udev_monitor_filter_add_match_subsystem_devtype(monitor, "video4linux", nullptr) < 0
+        || udev_monitor_enable_receiving(monitor) < 0) {
+        std::cerr << "Cannot monitor udev, video device hot-plug disabled" << std::endl;
+        if (monitor) {
+            udev_monitor_unref(monitor);
+            monitor = nullptr;
+        }
+        return;
+    }
+
+    std::cout << "Watching for " << (stable_link.empty() ? "bus " + bus_info : stable_link) << " to be unplugged" << std::endl;
+
+    do_work = true;
+    std::thread th(&device_monitor::monitor_fun, this);
+    swap(th, monitor_thread);
+}
+
+device_monitor::~device_monitor() {
+    do_work = false;
+    if (monitor_thread.joinable()) {
+        monitor_thread.join();
+    }
+    if (monitor) {
+        udev_monitor_unref(monitor);
+    }
+    if (context) {
+        udev_unref(context);
+    }
+}
+
+std::string device_monitor::device_node(const std::string& path) {
+    char resolved[PATH_MAX];
+    if (realpath(path.c_str(), resolved)) {
+        return resolved;
+    }
+    return path;
+}
+
+void device_monitor::monitor_fun() {
+    const int fd = udev_monitor_get_fd(monitor);
+
+    while (do_work) {
+        fd_set fds;
+        FD_ZERO(&fds);
+        FD_SET(fd, &fds);
+
+        // short timeout so shutting down doesn't wait on a quiet bus
+        timeval tv;
+        tv.tv_sec = 0;
+        tv.tv_usec = 500000;
+
+        if (select(fd + 1, &fds, nullptr, nullptr, &tv) <= 0) {
+            continue;
+        }
+
+        udev_device *device = udev_monitor_receive_device(monitor);
+        if (!device) {
+            continue;
+        }
+
+        const char *action = udev_device_get_action(device);
+        const char *node = udev_device_get_devnode(device);
+        if (action && node) {
+            if (strcmp(action, "remove") == 0 && current_node == node) {
+                std::cout << "Video device " << node << " removed" << std::endl;
+                removed(node);
+            } else if (strcmp(action, "add") == 0 && is_our_device(device)) {
+                std::cout << "Video device is back as " << node << std::endl;
+                current_node = node;
+                added(node);
+            }
+        }
+
+        udev_device_unref(device);
+    }
+}
+
+bool device_monitor::is_our_device(udev_device *device) const {
+    if (!stable_link.empty()) {
+        udev_list_entry *link;
+        udev_list_entry_foreach(link, udev_device_get_devlinks_list_entry(device)) {
+            if (stable_link == udev_list_entry_get_name(link)) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    // UVC cameras add a metadata node with the same bus info, only the capture node counts
+    const int fd = open(udev_device_get_devnode(device), O_RDWR | O_NONBLOCK);
+    if (fd < 0) {
+        return false;
+    }
+    v4l2_capability caps;
+    memset(&caps, 0, sizeof(caps));
+    const bool queried = ioctl(fd, VIDIOC_QUERYCAP, &caps) == 0;
+    close(fd);
+
+    const uint32_t node_caps = (caps.capabilities & V4L2_CAP_DEVICE_CAPS) ? caps.device_caps : caps.capabilities;
+    return queried && bus_info == reinterpret_cast<const char *>(caps.bus_info) && (node_caps & V4L2_CAP_VIDEO_CAPTURE);
+}
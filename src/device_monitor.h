@@ -0,0 +1,42 @@
+#pragma once
+
+#include <functional>
+#include <string>
+#include <thread>
+
+struct udev;
+struct udev_monitor;
+struct udev_device;
+
+// Watches udev for a capture device going away and coming back, possibly under another
+// /dev/videoN. The device is recognized by what survives re-enumeration: the /dev/v4l/by-id or
+// by-path link it was opened through, otherwise the bus info VIDIOC_QUERYCAP reports.
+// Callbacks run on the monitor thread.
+class device_monitor {
+public:
+    using callback = std::function<void(const std::string& device_node)>;
+
+    device_monitor(const std::string& device_path, const std::string& bus_info, callback on_removed, callback on_added);
+    ~device_monitor();
+
+    // false when udev isn't available; the device is then not watched
+    bool active() const { return monitor != nullptr; }
+
+    // resolves symlinks, /dev/v4l/by-id/... becomes /dev/videoN
+    static std::string device_node(const std::string& path);
+
+private:
+    void monitor_fun();
+    bool is_our_device(udev_device *device) const;
+
+    std::string stable_link; // empty unless opened through /dev/v4l/
+    std::string bus_info;
+    std::string current_node;
+    callback removed;
+    callback added;
+
+    udev *context = nullptr;
+    udev_monitor *monitor = nullptr;
+    std::thread monitor_thread;
+    volatile bool do_work = false;
+};
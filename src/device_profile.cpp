@@ -0,0 +1,247 @@
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <sstream>
+#include <libv4l2.h>
+#include "device_profile.h"
+#include "device_monitor.h"
+#include "cache_dir.h"
+#include "video_frame.h"
+#include "fps_counter.h"
+
+#define CLEAR(x) memset(&(x), 0, sizeof(x))
+
+#define MAP_ENTRY(x) {x, #x}
+
+static std::string capabilities_to_string(uint32_t caps) {
+    static std::map<uint32_t, std::string> cap_names = {
+            MAP_ENTRY(V4L2_CAP_VIDEO_CAPTURE),
+            MAP_ENTRY(V4L2_CAP_VIDEO_CAPTURE_MPLANE),
+            MAP_ENTRY(V4L2_CAP_VIDEO_OUTPUT),
+            MAP_ENTRY(V4L2_CAP_VIDEO_OUTPUT_MPLANE),
+            MAP_ENTRY(V4L2_CAP_VIDEO_M2M),
+            MAP_ENTRY(V4L2_CAP_VIDEO_M2M_MPLANE),
+            MAP_ENTRY(V4L2_CAP_VIDEO_OVERLAY),
+            MAP_ENTRY(V4L2_CAP_VBI_CAPTURE),
+            MAP_ENTRY(V4L2_CAP_VBI_OUTPUT),
+            MAP_ENTRY(V4L2_CAP_SLICED_VBI_CAPTURE),
+            MAP_ENTRY(V4L2_CAP_SLICED_VBI_OUTPUT),
+            MAP_ENTRY(V4L2_CAP_RDS_CAPTURE),
+            MAP_ENTRY(V4L2_CAP_VIDEO_OUTPUT_OVERLAY),
+            MAP_ENTRY(V4L2_CAP_HW_FREQ_SEEK),
+            MAP_ENTRY(V4L2_CAP_RDS_OUTPUT),
+            MAP_ENTRY(V4L2_CAP_TUNER),
+            MAP_ENTRY(V4L2_CAP_AUDIO),
+            MAP_ENTRY(V4L2_CAP_RADIO),
+            MAP_ENTRY(V4L2_CAP_MODULATOR),
+            MAP_ENTRY(V4L2_CAP_SDR_CAPTURE),
+            MAP_ENTRY(V4L2_CAP_EXT_PIX_FORMAT),
+            MAP_ENTRY(V4L2_CAP_SDR_OUTPUT),
+            MAP_ENTRY(V4L2_CAP_READWRITE),
+            MAP_ENTRY(V4L2_CAP_ASYNCIO),
+            MAP_ENTRY(V4L2_CAP_STREAMING),
+            MAP_ENTRY(V4L2_CAP_TOUCH),
+            MAP_ENTRY(V4L2_CAP_DEVICE_CAPS),
+    };
+
+    std::stringstream ss;
+    for (auto& kv: cap_names) {
+        if (caps & kv.first) {
+            ss << kv.second << " | ";
+        }
+    }
+
+    return ss.str();
+}
+
+// USB devices carry their firmware revision in bcdDevice, two levels up from the video node
+static std::string firmware_revision(const std::string& device_path) {
+    const std::string node = device_monitor::device_node(device_path);
+    const std::string name = node.substr(node.find_last_of('/') + 1);
+
+    std::ifstream in("/sys/class/video4linux/" + name + "/device/../bcdDevice");
+    std::string revision;
+    in >> revision;
+    return revision;
+}
+
+static device_profile identify(const std::string& device_path, const v4l2_capability& caps) {
+    device_profile profile;
+    profile.driver = reinterpret_cast<const char *>(caps.driver);
+    profile.card = reinterpret_cast<const char *>(caps.card);
+    profile.bus_info = reinterpret_cast<const char *>(caps.bus_info);
+    profile.firmware = firmware_revision(device_path);
+    profile.version = caps.version;
+    profile.capabilities = caps.capabilities;
+    profile.device_caps = caps.device_caps;
+    return profile;
+}
+
+device_profile device_profile::load(int fd, const std::string& device_path, const v4l2_capability& caps) {
+    timer t;
+    device_profile current = identify(device_path, caps);
+    const std::string cache_name = "video-" + cache_file_name(current.driver + "-" + current.bus_info) + ".profile";
+
+    device_profile cached;
+    if (parse(read_cache_file(cache_name), cached) && cached.same_device(current)) {
+        std::cout << "Loaded device profile from cache in " << t.lap() * 1000.0f << " ms" << std::endl;
+        return cached;
+    }
+
+    current = probe(fd, device_path, caps);
+    write_cache_file(cache_name, current.serialize());
+    std::cout << "Probed device capabilities in " << t.lap() * 1000.0f << " ms" << std::endl;
+    return current;
+}
+
+device_profile device_profile::probe(int fd, const std::string& device_path, const v4l2_capability& caps) {
+    device_profile profile = identify(device_path, caps);
+
+    v4l2_fmtdesc fmtdesc;
+    CLEAR(fmtdesc);
+    fmtdesc.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+    while (v4l2_ioctl(fd, VIDIOC_ENUM_FMT, &fmtdesc) == 0) {
+        device_format format;
+        format.pixel_format = fmtdesc.pixelformat;
+        format.description = reinterpret_cast<const char *>(fmtdesc.description);
+
+        v4l2_frmsizeenum frame_size;
+        CLEAR(frame_size);
+        frame_size.pixel_format = fmtdesc.pixelformat;
+        while (v4l2_ioctl(fd, VIDIOC_ENUM_FRAMESIZES, &frame_size) == 0 && frame_size.type == V4L2_FRMSIZE_TYPE_DISCRETE) {
+            format.sizes.push_back({frame_size.discrete.width, frame_size.discrete.height});
+            frame_size.index++;
+        }
+
+        profile.formats.push_back(format);
+        fmtdesc.index++;
+    }
+
+    v4l2_input video_input;
+    CLEAR(video_input);
+    while (true) {
+        int r;
+        do {
+            r = v4l2_ioctl(fd, VIDIOC_ENUMINPUT, &video_input);
+        } while (r == -1 && (errno == EBUSY || errno == EAGAIN));
+
+        if (r == -1) break;
+
+        profile.inputs.push_back(reinterpret_cast<const char *>(video_input.name));
+        video_input.index++;
+    }
+
+    return profile;
+}
+
+bool device_profile::supports(uint32_t pixel_format) const {
+    if (formats.empty()) {
+        return true;
+    }
+    for (auto& format: formats) {
+        if (format.pixel_format == pixel_format) {
+            return true;
+        }
+    }
+    return false;
+}
+
+void device_profile::print() const {
+    std::cout << "Video capabilities:" << std::endl;
+    std::cout << "\tDriver: " << driver << std::endl;
+    std::cout << "\tCard: " << card << std::endl;
+    std::cout << "\tBus info: " << bus_info << std::endl;
+    std::cout << "\tVersion: " << version << std::endl;
+    if (!firmware.empty()) {
+        std::cout << "\tFirmware: " << firmware << std::endl;
+    }
+    std::cout << "\tCaps: " << capabilities_to_string(capabilities) << std::endl;
+    std::cout << "\tDevice caps: " << capabilities_to_string(device_caps) << std::endl;
+
+    std::cout << "Image formats" << std::endl;
+    for (auto& format: formats) {
+        std::cout << "\t" << fourcc_to_string(format.pixel_format) << ": " << format.description << std::endl;
+        for (auto& size: format.sizes) {
+            std::cout << "\t\t" << size[0] << "x" << size[1] << std::endl;
+        }
+    }
+
+    std::cout << "Video inputs" << std::endl;
+    for (size_t i = 0; i < inputs.size(); i++) {
+        std::cout << "\t" << i << ": " << inputs[i] << std::endl;
+    }
+}
+
+bool device_profile::same_device(const device_profile& other) const {
+    return driver == other.driver && card == other.card && bus_info == other.bus_info && firmware == other.firmware
+           && version == other.version && capabilities == other.capabilities && device_caps == other.device_caps;
+}
+
+// one "key value" pair per line, sizes belong to the format line before them
+std::string device_profile::serialize() const {
+    std::stringstream out;
+    out << "driver " << driver << "\n";
+    out << "card " << card << "\n";
+    out << "bus " << bus_info << "\n";
+    out << "firmware " << firmware << "\n";
+    out << "version " << version << "\n";
+    out << "caps " << capabilities << "\n";
+    out << "device_caps " << device_caps << "\n";
+    for (auto& format: formats) {
+        out << "format " << format.pixel_format << " " << format.description << "\n";
+        for (auto& size: format.sizes) {
+            out << "size " << size[0] << " " << size[1] << "\n";
+        }
+    }
+    for (auto& input: inputs) {
+        out << "input " << input << "\n";
+    }
+    return out.str();
+}
+
+bool device_profile::parse(const std::string& text, device_profile& profile) {
+    if (text.empty()) {
+        return false;
+    }
+
+    std::istringstream in(text);
+    std::string line;
+    while (std::getline(in, line)) {
+        const auto space = line.find(' ');
+        const std::string key = line.substr(0, space);
+        const std::string value = space == std::string::npos ? "" : line.substr(space + 1);
+        std::istringstream fields(value);
+
+        if (key == "driver") {
+            profile.driver = value;
+        } else if (key == "card") {
+            profile.card = value;
+        } else if (key == "bus") {
+            profile.bus_info = value;
+        } else if (key == "firmware") {
+            profile.firmware = value;
+        } else if (key == "version") {
+            fields >> profile.version;
+        } else if (key == "caps") {
+            fields >> profile.capabilities;
+        } else if (key == "device_caps") {
+            fields >> profile.device_caps;
+        } else if (key == "format") {
+            device_format format;
+            fields >> format.pixel_format;
+            fields.get();
+            std::getline(fields, format.description);
+            profile.formats.push_back(format);
+        } else if (key == "size" && !profile.formats.empty()) {
+            std::array<uint32_t, 2> size = {0, 0};
+            fields >> size[0] >> size[1];
+            profile.formats.back().sizes.push_back(size);
+        } else if (key == "input") {
+            profile.inputs.push_back(value);
+        } else if (!key.empty()) {
+            return false;
+        }
+    }
+    return !profile.driver.empty();
+}
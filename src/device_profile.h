@@ -0,0 +1,44 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <linux/videodev2.h>
+
+struct device_format {
+    uint32_t pixel_format = 0;
+    std::string description;
+    std::vector<std::array<uint32_t, 2>> sizes; // discrete frame sizes, empty for stepwise ones
+};
+
+// What a capture device can do, as far as enumerating it tells. Enumerating every format, size
+// and input takes long on some cards, so the result is cached per device and only probed again
+// when the driver, bus, driver version or USB firmware revision no longer match.
+struct device_profile {
+    std::string driver;
+    std::string card;
+    std::string bus_info;
+    std::string firmware;
+    uint32_t version = 0;
+    uint32_t capabilities = 0;
+    uint32_t device_caps = 0;
+    std::vector<device_format> formats;
+    std::vector<std::string> inputs;
+
+    // the cached profile of the open device, probed and cached when there is none or it is stale
+    static device_profile load(int fd, const std::string& device_path, const v4l2_capability& caps);
+
+    // enumerates everything the device offers
+    static device_profile probe(int fd, const std::string& device_path, const v4l2_capability& caps);
+
+    // true when the format is listed, or nothing is known about formats at all
+    bool supports(uint32_t pixel_format) const;
+
+    void print() const;
+
+private:
+    bool same_device(const device_profile& other) const;
+    std::string serialize() const;
+    static bool parse(const std::string& text, device_profile& profile);
+};
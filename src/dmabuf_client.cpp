@@ -0,0 +1,219 @@
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <linux/dma-buf.h>
+#include <poll.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include "dmabuf_client.h"
+
+static void sync_buffer(int fd, uint64_t flags) {
+    dma_buf_sync sync{flags | DMA_BUF_SYNC_READ};
+    while (ioctl(fd, DMA_BUF_IOCTL_SYNC, &sync) == -1 && (errno == EINTR || errno == EAGAIN)) {
+    }
+}
+
+dmabuf_client::dmabuf_client(const std::string& socket_path_) : socket_path(socket_path_) {
+    connect();
+}
+
+dmabuf_client::~dmabuf_client() {
+    disconnect();
+}
+
+bool dmabuf_client::connect() {
+    sockaddr_un address;
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    if (socket_path.size() >= sizeof(address.sun_path)) {
+        return false;
+    }
+    strncpy(address.sun_path, socket_path.c_str(), sizeof(address.sun_path) - 1);
+
+    const int fd = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+    if (fd < 0) {
+        return false;
+    }
+    if (::connect(fd, reinterpret_cast<sockaddr *>(&address), sizeof(address)) != 0) {
+        close(fd);
+        return false;
+    }
+    sock = fd;
+    return true;
+}
+
+void dmabuf_client::disconnect() {
+    drop_buffers();
+    if (sock >= 0) {
+        close(sock);
+        sock = -1;
+    }
+}
+
+void dmabuf_client::drop_buffers() {
+    for (auto& b: buffers) {
+        if (b.memory) {
+            munmap(b.memory, b.length);
+        }
+        close(b.fd);
+    }
+    buffers.clear();
+    generation++;
+}
+
+void dmabuf_client::take_buffers(const dmabuf_buffers_message& message, const int *fds, size_t fd_count) {
+    // the old buffers can only be freed once nobody holds an fd or a mapping to them any more
+    drop_buffers();
+
+    const size_t count = std::min<size_t>(message.count, dmabuf_max_buffers);
+    for (size_t i = 0; i < fd_count; i++) {
+        if (i < count && message.version == dmabuf_protocol_version) {
+            buffer b;
+            b.fd = fds[i];
+            b.length = message.lengths[i];
+            buffers.push_back(b);
+        } else {
+            close(fds[i]);
+        }
+    }
+}
+
+bool dmabuf_client::take_frame(const dmabuf_frame_message& message, dmabuf_frame& frame) {
+    if (message.index >= buffers.size()) {
+        return false;
+    }
+    auto& b = buffers[message.index];
+    if (message.size > b.length) {
+        return false;
+    }
+    if (!b.memory) {
+        void *memory = mmap(nullptr, b.length, PROT_READ, MAP_SHARED, b.fd, 0);
+        if (memory == MAP_FAILED) {
+            return false;
+        }
+        b.memory = memory;
+    }
+    sync_buffer(b.fd, DMA_BUF_SYNC_START);
+
+    video_frame& f = frame.frame;
+    f = video_frame();
+    f.data = static_cast<uint8_t *>(b.memory);
+    f.size = message.size;
+    f.sequence = message.sequence;
+    f.width = message.width;
+    f.height = message.height;
+    f.pixel_format = message.pixel_format;
+    f.plane_count = message.plane_count;
+    for (size_t p = 0; p < video_frame::max_planes; p++) {
+        f.planes[p] = message.planes[p];
+    }
+    f.timestamp = std::chrono::steady_clock::time_point(
+            std::chrono::duration_cast<std::chrono::steady_clock::duration>(std::chrono::nanoseconds(message.timestamp_ns)));
+
+    frame.fd = b.fd;
+    frame.index = message.index;
+    frame.id = message.id;
+    frame.generation = generation;
+    return true;
+}
+
+bool dmabuf_client::next(dmabuf_frame& frame, std::chrono::milliseconds timeout) {
+    const auto deadline = std::chrono::steady_clock::now() + timeout;
+    while (true) {
+        const auto left = std::max<int64_t>(std::chrono::duration_cast<std::chrono::milliseconds>(
+                deadline - std::chrono::steady_clock::now()).count(), 0);
+        if (sock < 0 && !connect()) {
+            // nobody exporting yet, poll for the socket to appear
+            if (left == 0) {
+                return false;
+            }
+            usleep(static_cast<useconds_t>(std::min<int64_t>(left, 10) * 1000));
+            continue;
+        }
+
+        pollfd fd{sock, POLLIN, 0};
+        const int r = poll(&fd, 1, static_cast<int>(left));
+        if (r < 0 && errno != EINTR) {
+            disconnect();
+            return false;
+        }
+        if (r <= 0) {
+            if (left == 0) {
+                return false;
+            }
+            continue;
+        }
+
+        // big enough for either message; they all start with their type
+        alignas(8) uint8_t message[std::max(sizeof(dmabuf_buffers_message), sizeof(dmabuf_frame_message))];
+        iovec iov{message, sizeof(message)};
+        alignas(cmsghdr) char control[CMSG_SPACE(sizeof(int) * dmabuf_max_buffers)];
+        msghdr header;
+        memset(&header, 0, sizeof(header));
+        header.msg_iov = &iov;
+        header.msg_iovlen = 1;
+        header.msg_control = control;
+        header.msg_controllen = sizeof(control);
+
+        const ssize_t n = recvmsg(sock, &header, MSG_DONTWAIT | MSG_CMSG_CLOEXEC);
+        if (n < 0 && (errno == EAGAIN || errno == EINTR)) {
+            continue;
+        }
+        if (n <= 0) {
+            // the exporter went away, its buffers with it
+            disconnect();
+            continue;
+        }
+
+        const int *fds = nullptr;
+        size_t fd_count = 0;
+        for (cmsghdr *cmsg = CMSG_FIRSTHDR(&header); cmsg; cmsg = CMSG_NXTHDR(&header, cmsg)) {
+            if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS) {
+                fds = reinterpret_cast<const int *>(CMSG_DATA(cmsg));
+                fd_count = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+            }
+        }
+
+        dmabuf_message_type type;
+        memcpy(&type, message, sizeof(type));
+        if (type == dmabuf_message_type::buffers && n == sizeof(dmabuf_buffers_message)) {
+            dmabuf_buffers_message buffers_message;
+            memcpy(&buffers_message, message, sizeof(buffers_message));
+            take_buffers(buffers_message, fds, fd_count);
+            continue;
+        }
+        for (size_t i = 0; i < fd_count; i++) {
+            close(fds[i]);
+        }
+
+        if (type == dmabuf_message_type::frame && n == sizeof(dmabuf_frame_message)) {
+            dmabuf_frame_message frame_message;
+            memcpy(&frame_message, message, sizeof(frame_message));
+            if (take_frame(frame_message, frame)) {
+                return true;
+            }
+            // a frame we can't read is released right away, not left to time out
+            dmabuf_release_message release;
+            release.id = frame_message.id;
+            send(sock, &release, sizeof(release), MSG_DONTWAIT | MSG_NOSIGNAL);
+        }
+    }
+}
+
+void dmabuf_client::release(const dmabuf_frame& frame) {
+    // the exporter forgot holds on buffers it replaced, and a new connection never had them
+    if (frame.generation != generation) {
+        return;
+    }
+    if (frame.index < buffers.size()) {
+        sync_buffer(buffers[frame.index].fd, DMA_BUF_SYNC_END);
+    }
+    if (sock >= 0) {
+        dmabuf_release_message message;
+        message.id = frame.id;
+        send(sock, &message, sizeof(message), MSG_DONTWAIT | MSG_NOSIGNAL);
+    }
+}
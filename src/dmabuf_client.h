@@ -0,0 +1,53 @@
+#pragma once
+
+#include <chrono>
+#include <string>
+#include <vector>
+#include "dmabuf_protocol.h"
+
+// A frame in a capture buffer shared by dmabuf_exporter. The buffer is ours, and the driver
+// won't write to it, until release(); the exporter drops subscribers that hold one for too long.
+struct dmabuf_frame {
+    video_frame frame; // data points into the mapped buffer
+    int fd = -1;       // the dmabuf, for importing into GL, VA-API or a DRM plane instead of reading
+    uint32_t index = 0;
+    uint64_t id = 0;
+    uint64_t generation = 0;
+};
+
+// Receives capture buffers another process exports with --export-dmabuf. Buffers are mapped on
+// first use; reads of the mapping are bracketed with DMA_BUF_IOCTL_SYNC for devices whose
+// memory isn't cache coherent.
+class dmabuf_client {
+public:
+    explicit dmabuf_client(const std::string& socket_path);
+    ~dmabuf_client();
+
+    // whether the socket is connected; next() tries to connect again when it isn't
+    bool connected() const { return sock >= 0; }
+
+    // Waits up to timeout for the next frame. Frames come in capture order; a subscriber that
+    // only wants the newest should release the ones that queued up behind it right away.
+    bool next(dmabuf_frame& frame, std::chrono::milliseconds timeout);
+
+    // hands the buffer back, the frame data must not be read after this
+    void release(const dmabuf_frame& frame);
+
+private:
+    struct buffer {
+        int fd = -1;
+        size_t length = 0;
+        void *memory = nullptr;
+    };
+
+    bool connect();
+    void disconnect();
+    void drop_buffers();
+    void take_buffers(const dmabuf_buffers_message& message, const int *fds, size_t fd_count);
+    bool take_frame(const dmabuf_frame_message& message, dmabuf_frame& frame);
+
+    std::string socket_path;
+    int sock = -1;
+    std::vector<buffer> buffers;
+    uint64_t generation = 0;
+};
@@ -0,0 +1,299 @@
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <random>
+#include <poll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include "dmabuf_exporter.h"
+
+dmabuf_exporter::dmabuf_exporter(const std::string& socket_path_, std::chrono::milliseconds hold_timeout_)
+        : socket_path(socket_path_), hold_timeout(hold_timeout_) {
+    next_id = static_cast<uint64_t>(std::random_device()()) << 32;
+    sockaddr_un address;
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    if (socket_path.size() >= sizeof(address.sun_path)) {
+        std::cerr << "Socket path too long: " << socket_path << std::endl;
+        return;
+    }
+    strncpy(address.sun_path, socket_path.c_str(), sizeof(address.sun_path) - 1);
+
+    // message boundaries keep a frame message and its release in one piece each
+    const int fd = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+    if (fd < 0) {
+        perror("socket");
+        return;
+    }
+    // left behind by a run that didn't get to clean up
+    unlink(socket_path.c_str());
+    if (bind(fd, reinterpret_cast<sockaddr *>(&address), sizeof(address)) != 0 || listen(fd, 8) != 0) {
+        perror(("Cannot listen on " + socket_path).c_str());
+        close(fd);
+        return;
+    }
+
+    event_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    stop_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    listen_fd = fd;
+
+    std::thread th(&dmabuf_exporter::serve, this);
+    swap(th, server_thread);
+    std::cout << "Exporting capture buffers on " << socket_path << std::endl;
+}
+
+dmabuf_exporter::~dmabuf_exporter() {
+    if (server_thread.joinable()) {
+        const uint64_t one = 1;
+        if (write(stop_fd, &one, sizeof(one)) < 0) {
+            perror("write");
+        }
+        server_thread.join();
+    }
+
+    for (auto& s: subscribers) {
+        close(s.fd);
+    }
+    for (int fd: buffer_fds) {
+        close(fd);
+    }
+    if (skipped) {
+        std::cout << "dmabuf export: " << skipped << " frames not offered, subscribers held too many buffers" << std::endl;
+    }
+
+    if (listen_fd >= 0) {
+        close(listen_fd);
+        unlink(socket_path.c_str());
+    }
+    if (event_fd >= 0) {
+        close(event_fd);
+    }
+    if (stop_fd >= 0) {
+        close(stop_fd);
+    }
+}
+
+void dmabuf_exporter::serve() {
+    while (true) {
+        std::vector<pollfd> fds = {{stop_fd, POLLIN, 0}, {listen_fd, POLLIN, 0}};
+        {
+            // only this thread adds and removes subscribers, so the indices hold until the next poll
+            std::lock_guard<std::mutex> lock(mutex);
+            for (const auto& s: subscribers) {
+                fds.push_back({s.fd, POLLIN, 0});
+            }
+        }
+
+        // wakes up now and then to look for subscribers that hold on for too long
+        if (poll(fds.data(), fds.size(), 100) < 0 && errno != EINTR) {
+            perror("poll");
+            return;
+        }
+        if (fds[0].revents) {
+            return;
+        }
+
+        std::lock_guard<std::mutex> lock(mutex);
+        for (size_t i = fds.size() - 2; i-- > 0;) {
+            const auto events = fds[i + 2].revents;
+            if ((events & POLLIN) && !read_releases(subscribers[i])) {
+                drop_subscriber(i, "disconnected");
+            } else if (events & (POLLHUP | POLLERR)) {
+                drop_subscriber(i, "disconnected");
+            }
+        }
+
+        const auto now = std::chrono::steady_clock::now();
+        for (size_t i = subscribers.size(); i-- > 0;) {
+            for (const auto& h: subscribers[i].holds) {
+                if (now - h.since > hold_timeout) {
+                    drop_subscriber(i, "held a buffer for too long");
+                    break;
+                }
+            }
+        }
+
+        if (fds[1].revents & POLLIN) {
+            accept_subscriber();
+        }
+    }
+}
+
+// called with the mutex held
+void dmabuf_exporter::accept_subscriber() {
+    const int fd = accept4(listen_fd, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+    if (fd < 0) {
+        perror("accept");
+        return;
+    }
+    if (!buffer_fds.empty() && !send_buffers(fd)) {
+        close(fd);
+        return;
+    }
+    subscribers.push_back({fd, {}});
+    std::cout << "dmabuf subscriber connected, " << subscribers.size() << " in total" << std::endl;
+}
+
+// false once the subscriber is gone; called with the mutex held
+bool dmabuf_exporter::read_releases(subscriber& s) {
+    while (true) {
+        dmabuf_release_message message;
+        const ssize_t n = recv(s.fd, &message, sizeof(message), MSG_DONTWAIT);
+        if (n == 0) {
+            return false;
+        }
+        if (n < 0) {
+            return errno == EAGAIN || errno == EINTR;
+        }
+        if (n != sizeof(message) || message.type != dmabuf_message_type::release) {
+            continue;
+        }
+
+        // releases for buffers that were replaced in the meantime find nothing
+        for (auto it = s.holds.begin(); it != s.holds.end(); ++it) {
+            if (it->id == message.id) {
+                release(it->index);
+                s.holds.erase(it);
+                break;
+            }
+        }
+    }
+}
+
+// whatever the subscriber held goes back to the driver; called with the mutex held
+void dmabuf_exporter::drop_subscriber(size_t i, const char *reason) {
+    auto& s = subscribers[i];
+    for (const auto& h: s.holds) {
+        release(h.index);
+    }
+    close(s.fd);
+    subscribers.erase(subscribers.begin() + i);
+    std::cout << "dmabuf subscriber " << reason << ", " << subscribers.size() << " left" << std::endl;
+}
+
+bool dmabuf_exporter::send_buffers(int fd) {
+    dmabuf_buffers_message message;
+    message.count = static_cast<uint32_t>(buffer_fds.size());
+    for (size_t i = 0; i < buffer_fds.size(); i++) {
+        message.lengths[i] = buffer_lengths[i];
+    }
+
+    iovec iov{&message, sizeof(message)};
+    msghdr header;
+    memset(&header, 0, sizeof(header));
+    header.msg_iov = &iov;
+    header.msg_iovlen = 1;
+
+    alignas(cmsghdr) char control[CMSG_SPACE(sizeof(int) * dmabuf_max_buffers)];
+    if (!buffer_fds.empty()) {
+        const size_t fds_size = sizeof(int) * buffer_fds.size();
+        header.msg_control = control;
+        header.msg_controllen = CMSG_SPACE(fds_size);
+        cmsghdr *cmsg = CMSG_FIRSTHDR(&header);
+        cmsg->cmsg_level = SOL_SOCKET;
+        cmsg->cmsg_type = SCM_RIGHTS;
+        cmsg->cmsg_len = CMSG_LEN(fds_size);
+        memcpy(CMSG_DATA(cmsg), buffer_fds.data(), fds_size);
+    }
+
+    return sendmsg(fd, &header, MSG_DONTWAIT | MSG_NOSIGNAL) == static_cast<ssize_t>(sizeof(message));
+}
+
+// called with the mutex held
+void dmabuf_exporter::release(uint32_t index) {
+    if (index >= holders.size() || holders[index] == 0 || --holders[index] > 0) {
+        return;
+    }
+    held_buffers--;
+    released.push_back(index);
+    const uint64_t one = 1;
+    if (write(event_fd, &one, sizeof(one)) < 0) {
+        perror("write");
+    }
+}
+
+void dmabuf_exporter::set_buffers(std::vector<int> fds, const std::vector<size_t>& lengths) {
+    std::lock_guard<std::mutex> lock(mutex);
+    for (int fd: buffer_fds) {
+        close(fd);
+    }
+    buffer_fds = std::move(fds);
+    buffer_lengths = lengths;
+    holders.assign(buffer_fds.size(), 0);
+    held_buffers = 0;
+    released.clear();
+
+    for (auto& s: subscribers) {
+        s.holds.clear();
+        // subscribers close their fds to the old buffers on this, which lets the driver free them
+        if (!send_buffers(s.fd)) {
+            // the server thread sees the hangup and drops it
+            shutdown(s.fd, SHUT_RDWR);
+        }
+    }
+}
+
+bool dmabuf_exporter::offer(uint32_t index, const video_frame& frame, uint32_t max_held) {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (subscribers.empty() || index >= holders.size()) {
+        return false;
+    }
+    if (held_buffers >= max_held) {
+        skipped++;
+        return false;
+    }
+
+    dmabuf_frame_message message;
+    message.index = index;
+    message.id = ++next_id;
+    message.sequence = frame.sequence;
+    message.timestamp_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(frame.timestamp.time_since_epoch()).count();
+    message.size = frame.size;
+    message.width = frame.width;
+    message.height = frame.height;
+    message.pixel_format = frame.pixel_format;
+    message.plane_count = frame.plane_count;
+    memcpy(message.planes, frame.planes, sizeof(message.planes));
+
+    const auto now = std::chrono::steady_clock::now();
+    for (auto& s: subscribers) {
+        const ssize_t n = send(s.fd, &message, sizeof(message), MSG_DONTWAIT | MSG_NOSIGNAL);
+        if (n == static_cast<ssize_t>(sizeof(message))) {
+            s.holds.push_back({message.id, index, now});
+            holders[index]++;
+        } else if (n < 0 && errno != EAGAIN) {
+            shutdown(s.fd, SHUT_RDWR);
+        }
+        // a full socket means the subscriber is behind, it just misses this frame
+    }
+
+    if (holders[index] == 0) {
+        return false;
+    }
+    held_buffers++;
+    return true;
+}
+
+std::vector<bool> dmabuf_exporter::reclaim() {
+    std::lock_guard<std::mutex> lock(mutex);
+    released.clear();
+    std::vector<bool> held(holders.size());
+    for (size_t i = 0; i < holders.size(); i++) {
+        held[i] = holders[i] > 0;
+    }
+    return held;
+}
+
+std::vector<uint32_t> dmabuf_exporter::take_released() {
+    uint64_t count;
+    if (read(event_fd, &count, sizeof(count)) < 0 && errno != EAGAIN) {
+        perror("read");
+    }
+    std::lock_guard<std::mutex> lock(mutex);
+    std::vector<uint32_t> result;
+    swap(result, released);
+    return result;
+}
@@ -0,0 +1,77 @@
+#pragma once
+
+#include <chrono>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include "dmabuf_protocol.h"
+
+// Hands capture buffers to subscriber processes as dmabuf fds over a Unix socket, so they read
+// the frames the driver wrote without a single copy. A buffer offered to subscribers stays out
+// of the driver's queue until all of them released it; one that holds on for longer than
+// hold_timeout gets disconnected, which releases everything it held. See dmabuf_protocol.h and
+// dmabuf_client.h for the other end.
+//
+// The capture thread calls set_buffers, offer, reclaim and take_released; a thread of its own
+// accepts subscribers and reads their releases.
+class dmabuf_exporter {
+public:
+    explicit dmabuf_exporter(const std::string& socket_path,
+                             std::chrono::milliseconds hold_timeout = std::chrono::milliseconds(1000));
+    ~dmabuf_exporter();
+
+    bool is_open() const { return listen_fd >= 0; }
+
+    // Takes over the exported fds and sends them to every subscriber; empty when the buffers
+    // are about to be freed. Forgets all holds on the previous buffers.
+    void set_buffers(std::vector<int> fds, const std::vector<size_t>& lengths);
+
+    // Sends the frame in buffer index to every subscriber, unless max_held buffers are held
+    // already. True when somebody took it: the buffer must not be queued until it comes back
+    // through take_released().
+    bool offer(uint32_t index, const video_frame& frame, uint32_t max_held);
+
+    // For requeueing everything at once after a restart: which buffers subscribers still hold.
+    // Buffers released but not yet taken count as free and won't be returned again.
+    std::vector<bool> reclaim();
+
+    // readable once take_released() has buffers to requeue
+    int release_fd() const { return event_fd; }
+    std::vector<uint32_t> take_released();
+
+private:
+    struct hold {
+        uint64_t id;
+        uint32_t index;
+        std::chrono::steady_clock::time_point since;
+    };
+    struct subscriber {
+        int fd;
+        std::vector<hold> holds;
+    };
+
+    void serve();
+    void accept_subscriber();
+    bool read_releases(subscriber& s);
+    void drop_subscriber(size_t i, const char *reason);
+    bool send_buffers(int fd);
+    void release(uint32_t index);
+
+    std::string socket_path;
+    std::chrono::milliseconds hold_timeout;
+    int listen_fd = -1;
+    int event_fd = -1;
+    int stop_fd = -1;
+    std::thread server_thread;
+
+    std::mutex mutex;
+    std::vector<int> buffer_fds;
+    std::vector<size_t> buffer_lengths;
+    std::vector<uint32_t> holders; // subscribers holding each buffer
+    uint32_t held_buffers = 0;
+    std::vector<uint32_t> released;
+    std::vector<subscriber> subscribers;
+    uint64_t next_id = 0; // a random generation in the upper half
+    uint64_t skipped = 0;
+};
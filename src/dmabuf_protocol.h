@@ -0,0 +1,49 @@
+#pragma once
+
+#include <cstdint>
+#include "video_frame.h"
+
+// The messages dmabuf_exporter and dmabuf_client exchange over a SOCK_SEQPACKET Unix socket.
+// The exporter sends a buffers message with the dmabuf fds attached whenever the set of capture
+// buffers changes, then a frame message per frame that names one of them. The subscriber owns
+// that buffer until it answers with a release message carrying the frame id; the driver only
+// gets the buffer back once every subscriber released it.
+
+static constexpr uint32_t dmabuf_protocol_version = 1;
+static constexpr uint32_t dmabuf_max_buffers = 32;
+
+enum class dmabuf_message_type : uint32_t {
+    buffers = 1,
+    frame = 2,
+    release = 3,
+};
+
+// fds for buffer 0..count-1 ride along as SCM_RIGHTS, count 0 when the buffers are gone
+struct dmabuf_buffers_message {
+    dmabuf_message_type type = dmabuf_message_type::buffers;
+    uint32_t version = dmabuf_protocol_version;
+    uint32_t count = 0;
+    uint32_t reserved = 0;
+    uint64_t lengths[dmabuf_max_buffers] = {};
+};
+
+struct dmabuf_frame_message {
+    dmabuf_message_type type = dmabuf_message_type::frame;
+    uint32_t index = 0;      // which buffer of the last buffers message
+    uint64_t id = 0;         // for the release; the upper 32 bits are random per exporter, so ids
+                             // of one that restarted don't collide
+    uint64_t sequence = 0;
+    int64_t timestamp_ns = 0; // capture time on CLOCK_MONOTONIC
+    uint64_t size = 0;
+    uint32_t width = 0;
+    uint32_t height = 0;
+    uint32_t pixel_format = 0;
+    uint32_t plane_count = 0;
+    video_plane planes[video_frame::max_planes];
+};
+
+struct dmabuf_release_message {
+    dmabuf_message_type type = dmabuf_message_type::release;
+    uint32_t reserved = 0;
+    uint64_t id = 0;
+};
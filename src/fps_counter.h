@@ -45,3 +45,38 @@ public:
     timer t;
 
 };
+
+// Accumulates duration samples (in milliseconds) between reports.
+class stage_stats {
+public:
+    void add(float ms) {
+        total += ms;
+        if (ms > peak) {
+            peak = ms;
+        }
+        samples++;
+    }
+
+    float average() const {
+        return samples ? total / samples : 0.0f;
+    }
+
+    float max() const {
+        return peak;
+    }
+
+    size_t count() const {
+        return samples;
+    }
+
+    void reset() {
+        total = 0;
+        peak = 0;
+        samples = 0;
+    }
+
+private:
+    float total = 0;
+    float peak = 0;
+    size_t samples = 0;
+};
@@ -0,0 +1,62 @@
+#include <iostream>
+#include "frame_checker.h"
+#include "frame_stamp.h"
+
+void frame_checker::check(const uint8_t *rgb, int width, int height, int stride) {
+    checked++;
+
+    uint32_t first_id = 0;
+    uint32_t newest_id = 0;
+    bool tagged = false;
+    bool consistent = true;
+
+    for (int y = 0; y < height; y++) {
+        uint32_t id;
+        if (!read_row_tag(rgb + static_cast<ptrdiff_t>(y) * stride, width, id)) {
+            continue;
+        }
+
+        if (!tagged) {
+            first_id = newest_id = id;
+            tagged = true;
+        } else if (id != first_id) {
+            consistent = false;
+            if (id > newest_id) {
+                newest_id = id;
+            }
+        }
+    }
+
+    if (!tagged) {
+        untagged++;
+        return;
+    }
+
+    if (!consistent) {
+        torn_frames++;
+    }
+
+    // account against the newest frame that made it into the buffer
+    if (have_last) {
+        if (newest_id == last_id) {
+            duplicated++;
+        } else if (newest_id > last_id + 1) {
+            skipped += newest_id - last_id - 1;
+        }
+    }
+    have_last = true;
+    last_id = newest_id;
+}
+
+void frame_checker::repeated() {
+    duplicated++;
+}
+
+void frame_checker::report() const {
+    std::cout << "Frame check: " << checked << " uploaded, " << torn_frames << " torn, "
+              << duplicated << " duplicated, " << skipped << " skipped";
+    if (untagged) {
+        std::cout << ", " << untagged << " without row tags";
+    }
+    std::cout << std::endl;
+}
@@ -0,0 +1,30 @@
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+
+// Validates the per-row frame ids written by the synthetic source (see frame_stamp.h) on every
+// frame the renderer is about to upload. Rows from different frames mean the buffer was
+// rewritten while we read it.
+class frame_checker {
+public:
+    // a newly latched frame, rgb is the exact copy that gets uploaded
+    void check(const uint8_t *rgb, int width, int height, int stride);
+
+    // a present that reused the previously uploaded frame
+    void repeated();
+
+    size_t torn() const { return torn_frames; }
+
+    void report() const;
+
+private:
+    bool have_last = false;
+    uint32_t last_id = 0;
+
+    size_t checked = 0;
+    size_t torn_frames = 0;
+    size_t duplicated = 0;
+    size_t skipped = 0;
+    size_t untagged = 0;
+};
@@ -0,0 +1,74 @@
+#include <thread>
+#include <cmath>
+#include <algorithm>
+#include "frame_pacer.h"
+
+// fixed headroom for scheduler wakeup jitter on top of the measured render cost
+static constexpr float wakeup_headroom = 0.0005f;
+
+frame_pacer::frame_pacer(float refresh_rate)
+        : last_vsync(clock::now()), period(1.0f / (refresh_rate > 0 ? refresh_rate : 60.0f)) {
+    update_margin();
+}
+
+frame_pacer::clock::time_point frame_pacer::wait_for_latch() {
+    const auto period_d = std::chrono::duration_cast<clock::duration>(std::chrono::duration<float>(period));
+    const auto margin_d = std::chrono::duration_cast<clock::duration>(std::chrono::duration<float>(margin));
+
+    const auto now = clock::now();
+    auto target = last_vsync + period_d;
+    while (target - margin_d < now) {
+        target += period_d;
+    }
+
+    std::this_thread::sleep_until(target - margin_d);
+    return target;
+}
+
+void frame_pacer::frame_rendered(clock::duration render_cost) {
+    const float cost = std::chrono::duration<float>(render_cost).count();
+
+    cost_average += (cost - cost_average) * 0.1f;
+    cost_deviation += (std::fabs(cost - cost_average) - cost_deviation) * 0.1f;
+    update_margin();
+}
+
+void frame_pacer::frame_presented(clock::time_point target_vsync, clock::time_point presented) {
+    // refine the refresh period from the distance between consecutive presents
+    const float delta = std::chrono::duration<float>(presented - last_vsync).count();
+    const float vsyncs = std::round(delta / period);
+    if (vsyncs >= 1 && std::fabs(delta - vsyncs * period) < period * 0.25f) {
+        period += (delta / vsyncs - period) * 0.05f;
+    }
+    last_vsync = presented;
+
+    // landing half a period past the target means the frame made the next vsync instead
+    const float lateness = std::chrono::duration<float>(presented - target_vsync).count();
+    if (lateness > period * 0.5f) {
+        missed_vsyncs++;
+        miss_penalty += 0.001f;
+    } else {
+        miss_penalty *= 0.95f;
+    }
+    update_margin();
+}
+
+void frame_pacer::update_margin() {
+    margin = std::clamp(cost_average + 4 * cost_deviation + miss_penalty + wakeup_headroom, 0.001f, period);
+}
+
+float frame_pacer::margin_ms() const {
+    return margin * 1000.0f;
+}
+
+float frame_pacer::period_ms() const {
+    return period * 1000.0f;
+}
+
+size_t frame_pacer::missed() const {
+    return missed_vsyncs;
+}
+
+void frame_pacer::reset_missed() {
+    missed_vsyncs = 0;
+}
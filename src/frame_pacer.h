@@ -0,0 +1,37 @@
+#pragma once
+
+#include <chrono>
+#include <cstddef>
+
+// Predicts upcoming vsyncs from observed presentation times and tells the render loop when to
+// latch the newest frame so that upload and draw finish just before the display needs them.
+// The margin left before vsync follows the measured render cost.
+class frame_pacer {
+public:
+    using clock = std::chrono::steady_clock;
+
+    explicit frame_pacer(float refresh_rate);
+
+    // sleeps until the latch deadline of the next reachable vsync and returns that vsync
+    clock::time_point wait_for_latch();
+
+    // render_cost: latch until the GPU finished drawing; presented: when the swap completed
+    void frame_rendered(clock::duration render_cost);
+    void frame_presented(clock::time_point target_vsync, clock::time_point presented);
+
+    float margin_ms() const;
+    float period_ms() const;
+    size_t missed() const;
+    void reset_missed();
+
+private:
+    void update_margin();
+
+    clock::time_point last_vsync;
+    float period;                   // seconds
+    float cost_average = 0;         // seconds
+    float cost_deviation = 0;       // seconds
+    float miss_penalty = 0;         // seconds
+    float margin = 0;               // seconds
+    size_t missed_vsyncs = 0;
+};
@@ -0,0 +1,58 @@
+#include "frame_source.h"
+
+video_frame frame_source::latest_frame() {
+    std::lock_guard<std::mutex> lock(frame_mutex);
+    return frame;
+}
+
+void frame_source::set_frame_callback(std::function<void()> callback) {
+    std::lock_guard<std::mutex> lock(callback_mutex);
+    on_frame = std::move(callback);
+}
+
+size_t frame_source::add_frame_sink(frame_sink sink) {
+    std::lock_guard<std::mutex> lock(callback_mutex);
+    sinks.emplace_back(next_sink_id, std::move(sink));
+    return next_sink_id++;
+}
+
+void frame_source::remove_frame_sink(size_t id) {
+    std::lock_guard<std::mutex> lock(callback_mutex);
+    for (auto s = sinks.begin(); s != sinks.end(); ++s) {
+        if (s->first == id) {
+            sinks.erase(s);
+            break;
+        }
+    }
+}
+
+void frame_source::publish(video_frame f, const frame_sink& first) {
+    {
+        std::lock_guard<std::mutex> lock(frame_mutex);
+        f.sequence = ++sequence;
+        frame = f;
+    }
+    if (first) {
+        first(f);
+    }
+
+    std::lock_guard<std::mutex> lock(callback_mutex);
+    for (auto& s: sinks) {
+        s.second(f);
+    }
+    if (on_frame) {
+        on_frame();
+    }
+}
+
+std::shared_lock<std::shared_mutex> frame_source::hold_buffers() {
+    return std::shared_lock<std::shared_mutex>(buffers_mutex);
+}
+
+std::unique_lock<std::shared_mutex> frame_source::lock_buffers() {
+    std::unique_lock<std::shared_mutex> lock(buffers_mutex);
+
+    std::lock_guard<std::mutex> frame_lock(frame_mutex);
+    frame.data = nullptr;
+    return lock;
+}
@@ -0,0 +1,76 @@
+#pragma once
+
+#include <atomic>
+#include <mutex>
+#include <shared_mutex>
+#include <functional>
+#include <string>
+#include <vector>
+#include "video_frame.h"
+
+// How well a source has been keeping up with its input; all zero for sources that can't stall.
+struct capture_health {
+    size_t stalls = 0;          // times frames stopped arriving for longer than the stall timeout
+    size_t recoveries = 0;      // stalls that ended with frames flowing again
+    float last_recovery_ms = 0; // from the last frame before a stall to the first one after it
+    float max_recovery_ms = 0;
+    bool stalled = false;
+};
+
+// Anything that produces frames for the renderer. Producers call publish() from their own
+// thread; consumers poll latest_frame() or get woken through the frame callback.
+class frame_source {
+public:
+    virtual ~frame_source() = default;
+
+    // the most recently published frame, data is null until the first one arrives
+    video_frame latest_frame();
+
+    // increments with every published frame
+    uint64_t frame_sequence() const { return sequence; }
+
+    // invoked on the producer thread after each new frame
+    void set_frame_callback(std::function<void()> callback);
+
+    // Sinks see every published frame on the producer thread, before consumers are woken. The
+    // frame data is only valid during the call and the producer waits for it, so sinks copy
+    // and return. Returns an id for remove_frame_sink().
+    using frame_sink = std::function<void(const video_frame&)>;
+    size_t add_frame_sink(frame_sink sink);
+    void remove_frame_sink(size_t id);
+
+    // Keeps the memory behind published frames valid while held. Take it before latest_frame()
+    // and keep it for as long as the frame data is read.
+    std::shared_lock<std::shared_mutex> hold_buffers();
+
+    // Switches to a new resolution without tearing the source down. Frames of the new size follow
+    // through latest_frame(); false when the source can't do that.
+    virtual bool reconfigure(int w, int h) { return false; }
+
+    virtual capture_health health() const { return {}; }
+
+    // nominal frames per second, 0 when unknown
+    virtual float frame_rate() const { return 0; }
+
+    // Passes the capture buffers themselves to other processes over a Unix socket at this path,
+    // see dmabuf_client.h. False when the source has no buffers to share.
+    virtual bool export_buffers(const std::string& socket_path) { return false; }
+
+protected:
+    // exclusive access for remapping or freeing buffers; drops the published frame
+    std::unique_lock<std::shared_mutex> lock_buffers();
+
+    // Assigns the next sequence number and hands the frame to consumers; first, when given,
+    // sees the numbered frame before the sinks do.
+    void publish(video_frame f, const frame_sink& first = nullptr);
+
+private:
+    std::shared_mutex buffers_mutex;
+    std::mutex frame_mutex;
+    video_frame frame;
+    std::atomic<uint64_t> sequence{0};
+    std::mutex callback_mutex;
+    std::function<void()> on_frame;
+    std::vector<std::pair<size_t, frame_sink>> sinks;
+    size_t next_sink_id = 0;
+};
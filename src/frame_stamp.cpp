@@ -0,0 +1,134 @@
+#include <cstddef>
+#include <cstring>
+#include "frame_stamp.h"
+
+static constexpr uint8_t sync_pattern = 0xb2;
+static constexpr uint8_t row_sync_pattern = 0x5a;
+
+// sync byte, 4 bytes frame id, 8 bytes timestamp, checksum byte
+static constexpr int payload_bytes = 14;
+static constexpr int payload_bits = payload_bytes * 8;
+
+static void pack(const frame_stamp& stamp, uint8_t *payload) {
+    payload[0] = sync_pattern;
+    for (int i = 0; i < 4; i++) {
+        payload[1 + i] = (stamp.frame_id >> (8 * i)) & 0xff;
+    }
+    for (int i = 0; i < 8; i++) {
+        payload[5 + i] = (stamp.timestamp_us >> (8 * i)) & 0xff;
+    }
+
+    uint8_t checksum = 0;
+    for (int i = 0; i < payload_bytes - 1; i++) {
+        checksum ^= payload[i];
+    }
+    payload[payload_bytes - 1] = checksum;
+}
+
+static bool unpack(const uint8_t *payload, frame_stamp& stamp) {
+    uint8_t checksum = 0;
+    for (int i = 0; i < payload_bytes - 1; i++) {
+        checksum ^= payload[i];
+    }
+    if (payload[0] != sync_pattern || payload[payload_bytes - 1] != checksum) {
+        return false;
+    }
+
+    stamp.frame_id = 0;
+    for (int i = 0; i < 4; i++) {
+        stamp.frame_id |= static_cast<uint32_t>(payload[1 + i]) << (8 * i);
+    }
+    stamp.timestamp_us = 0;
+    for (int i = 0; i < 8; i++) {
+        stamp.timestamp_us |= static_cast<uint64_t>(payload[5 + i]) << (8 * i);
+    }
+    return true;
+}
+
+static int blocks_per_row(int width) {
+    return (width - row_tag_pixels) / stamp_block_size;
+}
+
+int stamp_height(int width) {
+    const int per_row = blocks_per_row(width);
+    if (per_row == 0) {
+        return 0;
+    }
+    return (payload_bits + per_row - 1) / per_row * stamp_block_size;
+}
+
+void write_frame_stamp(uint8_t *rgb, int width, int stride, const frame_stamp& stamp) {
+    const int per_row = blocks_per_row(width);
+    if (per_row == 0) {
+        return;
+    }
+
+    uint8_t payload[payload_bytes];
+    pack(stamp, payload);
+
+    for (int bit = 0; bit < payload_bits; bit++) {
+        const uint8_t value = (payload[bit / 8] >> (bit % 8)) & 1 ? 0xff : 0x00;
+        const int x0 = (bit % per_row) * stamp_block_size;
+        const int y0 = (bit / per_row) * stamp_block_size;
+
+        for (int y = y0; y < y0 + stamp_block_size; y++) {
+            memset(rgb + static_cast<ptrdiff_t>(y) * stride + x0 * 3, value, stamp_block_size * 3);
+        }
+    }
+}
+
+bool read_frame_stamp(const uint8_t *rgb, int width, int stride, float scale_x, float scale_y, frame_stamp& stamp) {
+    const int per_row = blocks_per_row(width);
+    if (per_row == 0) {
+        return false;
+    }
+
+    uint8_t payload[payload_bytes] = {0};
+    for (int bit = 0; bit < payload_bits; bit++) {
+        // sample the block centre, away from edges blurred by filtering
+        const int x = static_cast<int>(((bit % per_row) * stamp_block_size + stamp_block_size / 2) * scale_x);
+        const int y = static_cast<int>(((bit / per_row) * stamp_block_size + stamp_block_size / 2) * scale_y);
+
+        const uint8_t green = rgb[static_cast<ptrdiff_t>(y) * stride + x * 3 + 1];
+        if (green > 127) {
+            payload[bit / 8] |= 1 << (bit % 8);
+        }
+    }
+
+    return unpack(payload, stamp);
+}
+
+void write_row_tags(uint8_t *rgb, int width, int height, int stride, uint32_t frame_id) {
+    if (width < row_tag_pixels) {
+        return;
+    }
+
+    // 4 bytes id, a sync byte and a check byte fill the two tag pixels
+    uint8_t tag[row_tag_pixels * 3];
+    uint8_t check = row_sync_pattern;
+    for (int i = 0; i < 4; i++) {
+        tag[i] = (frame_id >> (8 * i)) & 0xff;
+        check ^= tag[i];
+    }
+    tag[4] = row_sync_pattern;
+    tag[5] = check;
+
+    for (int y = 0; y < height; y++) {
+        memcpy(rgb + static_cast<ptrdiff_t>(y) * stride + (width - row_tag_pixels) * 3, tag, sizeof(tag));
+    }
+}
+
+bool read_row_tag(const uint8_t *row, int width, uint32_t& frame_id) {
+    if (width < row_tag_pixels) {
+        return false;
+    }
+
+    const uint8_t *tag = row + (width - row_tag_pixels) * 3;
+    uint8_t check = row_sync_pattern;
+    frame_id = 0;
+    for (int i = 0; i < 4; i++) {
+        frame_id |= static_cast<uint32_t>(tag[i]) << (8 * i);
+        check ^= tag[i];
+    }
+    return tag[4] == row_sync_pattern && tag[5] == check;
+}
@@ -0,0 +1,32 @@
+#pragma once
+
+#include <cstdint>
+
+// Frame identity burned into the top rows of synthetic frames as a grid of black and white
+// blocks, coarse enough to survive scaling and texture filtering on the way to the screen.
+// The right-most row_tag_pixels of every row are left to a per-row copy of the frame id,
+// used to tell torn frames from whole ones.
+struct frame_stamp {
+    uint32_t frame_id = 0;
+    uint64_t timestamp_us = 0; // capture time in microseconds on the steady clock
+};
+
+constexpr int stamp_block_size = 8;
+constexpr int row_tag_pixels = 2;
+
+// pixel rows taken by the stamp in a frame of the given width
+int stamp_height(int width);
+
+// rgb: 3 bytes per pixel, stride in bytes
+void write_frame_stamp(uint8_t *rgb, int width, int stride, const frame_stamp& stamp);
+
+// Decodes a stamp from an image of the frame's top rows that was scaled by scale_x/scale_y on
+// its way to the screen. A negative stride walks bottom-up images such as glReadPixels output.
+// Returns false when the sync pattern or checksum doesn't match.
+bool read_frame_stamp(const uint8_t *rgb, int width, int stride, float scale_x, float scale_y, frame_stamp& stamp);
+
+// writes the frame id into the tail of every row
+void write_row_tags(uint8_t *rgb, int width, int height, int stride, uint32_t frame_id);
+
+// false when the row carries no valid tag
+bool read_row_tag(const uint8_t *row, int width, uint32_t& frame_id);
@@ -0,0 +1,95 @@
+#include <glad/glad.h>
+#include "gpu_timer.h"
+
+gpu_timer::gpu_timer(size_t frames_in_flight) : frames(frames_in_flight) {
+    for (auto& f: frames) {
+        glGenQueries(stage_count, f.elapsed);
+        glGenQueries(1, &f.timestamp);
+        f.submit_time = 0;
+        f.pending = false;
+    }
+}
+
+gpu_timer::~gpu_timer() {
+    for (auto& f: frames) {
+        glDeleteQueries(stage_count, f.elapsed);
+        glDeleteQueries(1, &f.timestamp);
+    }
+}
+
+void gpu_timer::begin_frame() {
+    collect();
+
+    current = (current + 1) % frames.size();
+    if (frames[current].pending) {
+        // GPU is more than frames_in_flight behind; give up on that frame rather than wait
+        frames[current].pending = false;
+        missed_frames++;
+    }
+}
+
+void gpu_timer::begin(render_stage stage) {
+    glBeginQuery(GL_TIME_ELAPSED, frames[current].elapsed[static_cast<size_t>(stage)]);
+}
+
+void gpu_timer::end(render_stage stage) {
+    glEndQuery(GL_TIME_ELAPSED);
+}
+
+void gpu_timer::end_frame() {
+    auto& f = frames[current];
+    glQueryCounter(f.timestamp, GL_TIMESTAMP);
+
+    GLint64 now;
+    glGetInteger64v(GL_TIMESTAMP, &now);
+    f.submit_time = now;
+    f.pending = true;
+}
+
+void gpu_timer::collect() {
+    // walk from the oldest slot; queries complete in order, so stop at the first one not ready
+    for (size_t i = 1; i <= frames.size(); i++) {
+        auto& f = frames[(current + i) % frames.size()];
+        if (!f.pending) {
+            continue;
+        }
+
+        GLuint available = GL_FALSE;
+        glGetQueryObjectuiv(f.timestamp, GL_QUERY_RESULT_AVAILABLE, &available);
+        if (available == GL_FALSE) {
+            break;
+        }
+
+        for (size_t s = 0; s < stage_count; s++) {
+            GLuint64 ns = 0;
+            glGetQueryObjectui64v(f.elapsed[s], GL_QUERY_RESULT, &ns);
+            stage_times[s].add(ns / 1e6f);
+        }
+
+        GLuint64 done = 0;
+        glGetQueryObjectui64v(f.timestamp, GL_QUERY_RESULT, &done);
+        lag.add((static_cast<int64_t>(done) - f.submit_time) / 1e6f);
+
+        f.pending = false;
+    }
+}
+
+const stage_stats& gpu_timer::elapsed(render_stage stage) const {
+    return stage_times[static_cast<size_t>(stage)];
+}
+
+const stage_stats& gpu_timer::queue_lag() const {
+    return lag;
+}
+
+size_t gpu_timer::missed() const {
+    return missed_frames;
+}
+
+void gpu_timer::reset() {
+    for (auto& s: stage_times) {
+        s.reset();
+    }
+    lag.reset();
+    missed_frames = 0;
+}
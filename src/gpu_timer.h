@@ -0,0 +1,55 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+#include "fps_counter.h"
+
+enum class render_stage {
+    upload,
+    draw,
+    count
+};
+
+// Brackets render stages with GL_TIME_ELAPSED queries and stamps the end of every frame
+// with a GL_TIMESTAMP query. Results are only read back once the driver reports them
+// available, a few frames later, so measuring never stalls the render loop.
+class gpu_timer {
+public:
+    explicit gpu_timer(size_t frames_in_flight = 4);
+    ~gpu_timer();
+
+    void begin_frame();
+    void begin(render_stage stage);
+    void end(render_stage stage);
+    void end_frame();
+
+    // GPU time spent executing the given stage
+    const stage_stats& elapsed(render_stage stage) const;
+
+    // how far GPU completion of a frame trails the CPU submitting it
+    const stage_stats& queue_lag() const;
+
+    // frames whose queries were still pending when their slot was needed again
+    size_t missed() const;
+
+    void reset();
+
+private:
+    static constexpr size_t stage_count = static_cast<size_t>(render_stage::count);
+
+    struct frame_queries {
+        uint32_t elapsed[stage_count];
+        uint32_t timestamp;
+        int64_t submit_time;
+        bool pending;
+    };
+
+    void collect();
+
+    std::vector<frame_queries> frames;
+    size_t current = 0;
+    size_t missed_frames = 0;
+
+    stage_stats stage_times[stage_count];
+    stage_stats lag;
+};
@@ -0,0 +1,264 @@
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <iostream>
+#include <x264.h>
+#include "h264_encoder.h"
+#include "jpeg_decoder.h"
+#include "pixel_convert.h"
+
+h264_encoder::h264_encoder(const encoder_options& options_, packet_sink sink_, size_t queue_frames)
+        : options(options_), sink(std::move(sink_)), slots(queue_frames) {
+    if (options.frame_rate <= 0) {
+        options.frame_rate = 30;
+    }
+
+    for (size_t i = 0; i < slots.size(); i++) {
+        free_slots.push_back(i);
+    }
+    encode_thread = std::thread(&h264_encoder::encode_fun, this);
+}
+
+h264_encoder::~h264_encoder() {
+    {
+        std::lock_guard<std::mutex> lock(queue_mutex);
+        stopping = true;
+        queue_changed.notify_all();
+    }
+    encode_thread.join();
+    close_encoder();
+    delete decoder;
+
+    std::cout << "Encoded " << frames_encoded << " frames, dropped " << frames_dropped;
+    if (frames_skipped) {
+        std::cout << ", skipped " << frames_skipped;
+    }
+    std::cout << std::endl;
+}
+
+void h264_encoder::push(const video_frame& frame) {
+    if (!frame.data) {
+        return;
+    }
+
+    size_t index;
+    {
+        std::lock_guard<std::mutex> lock(queue_mutex);
+        if (free_slots.empty()) {
+            frames_dropped++;
+            return;
+        }
+        index = free_slots.back();
+        free_slots.pop_back();
+    }
+
+    // slots keep their capacity, so this only allocates for the first few frames
+    auto& s = slots[index];
+    s.data.assign(frame.data, frame.data + frame.size);
+    s.frame = frame;
+    s.frame.data = s.data.data();
+
+    std::lock_guard<std::mutex> lock(queue_mutex);
+    ready.push_back(index);
+    queue_changed.notify_one();
+}
+
+void h264_encoder::encode_fun() {
+    while (true) {
+        size_t index;
+        {
+            std::unique_lock<std::mutex> lock(queue_mutex);
+            queue_changed.wait(lock, [this]() { return !ready.empty() || stopping; });
+            if (ready.empty()) {
+                return;
+            }
+            index = ready.front();
+            ready.pop_front();
+        }
+
+        // the slot is free again as soon as the frame is converted
+        const video_frame frame = slots[index].frame;
+        video_frame source = frame;
+        bool converted;
+        if (frame.pixel_format == V4L2_PIX_FMT_MJPEG) {
+            if (!decoder) {
+                decoder = new jpeg_decoder(V4L2_PIX_FMT_RGB24);
+            }
+            converted = decoder->decode(frame, source) && convert_to_nv12(source, nv12);
+        } else {
+            converted = convert_to_nv12(frame, nv12);
+        }
+
+        {
+            std::lock_guard<std::mutex> lock(queue_mutex);
+            free_slots.push_back(index);
+        }
+
+        if (!converted) {
+            frames_skipped++;
+            continue;
+        }
+        source.data = nv12.data();
+        encode(source);
+    }
+}
+
+bool h264_encoder::open_encoder(uint32_t w, uint32_t h) {
+    if (encoder && w == width && h == height) {
+        return true;
+    }
+    if (!encoder && open_failed && w == width && h == height) {
+        return false;
+    }
+
+    // a new resolution starts a new sequence with fresh SPS/PPS in the same stream
+    close_encoder();
+    width = w;
+    height = h;
+
+    x264_param_t param;
+    if (x264_param_default_preset(&param, options.preset.c_str(), "zerolatency") < 0) {
+        std::cerr << "Unknown x264 preset " << options.preset << ", using veryfast" << std::endl;
+        x264_param_default_preset(&param, "veryfast", "zerolatency");
+    }
+    param.i_log_level = X264_LOG_WARNING;
+    param.i_threads = options.threads > 0 ? options.threads : X264_THREADS_AUTO;
+    param.i_width = static_cast<int>(w);
+    param.i_height = static_cast<int>(h);
+    param.i_csp = X264_CSP_NV12;
+
+    // timestamps come from the capture clock in microseconds, the rate only guides rate control
+    param.b_vfr_input = 1;
+    param.i_timebase_num = 1;
+    param.i_timebase_den = 1000000;
+    param.i_fps_num = static_cast<uint32_t>(std::lround(options.frame_rate * 1000));
+    param.i_fps_den = 1000;
+    param.i_keyint_max = std::max(1, static_cast<int>(std::lround(options.frame_rate * options.keyframe_seconds)));
+
+    // a VBV of half a second keeps bursts small enough for a network link
+    param.rc.i_rc_method = X264_RC_ABR;
+    param.rc.i_bitrate = static_cast<int>(options.bitrate_kbps);
+    param.rc.i_vbv_max_bitrate = static_cast<int>(options.bitrate_kbps);
+    param.rc.i_vbv_buffer_size = static_cast<int>(options.bitrate_kbps / 2);
+
+    // the NV12 conversion is BT.601 limited range
+    param.vui.b_fullrange = 0;
+    param.vui.i_colmatrix = 6;
+
+    // SPS/PPS in front of every keyframe, so a consumer can start at any of them
+    param.b_repeat_headers = 1;
+    param.b_annexb = 1;
+    x264_param_apply_profile(&param, "high");
+
+    encoder = x264_encoder_open(&param);
+    open_failed = encoder == nullptr;
+    if (!encoder) {
+        std::cerr << "Cannot open the H.264 encoder for " << w << "x" << h << " frames" << std::endl;
+        return false;
+    }
+    std::cout << "H.264 encoder: " << w << "x" << h << ", " << options.bitrate_kbps << " kbit/s, preset "
+              << options.preset << std::endl;
+    return true;
+}
+
+void h264_encoder::close_encoder() {
+    if (!encoder) {
+        return;
+    }
+
+    x264_nal_t *nals;
+    int count;
+    x264_picture_t out;
+    while (x264_encoder_delayed_frames(encoder) > 0) {
+        const int size = x264_encoder_encode(encoder, &nals, &count, nullptr, &out);
+        if (size < 0) {
+            break;
+        }
+        if (size > 0) {
+            emit(nals[0].p_payload, size, out.i_pts, out.i_dts, out.b_keyframe,
+                 reinterpret_cast<uintptr_t>(out.opaque));
+        }
+    }
+    x264_encoder_close(encoder);
+    encoder = nullptr;
+}
+
+void h264_encoder::encode(const video_frame& frame) {
+    if (!open_encoder(frame.width, frame.height)) {
+        frames_skipped++;
+        return;
+    }
+
+    if (!have_first) {
+        first_timestamp = frame.timestamp;
+        have_first = true;
+    }
+
+    // x264 wants strictly increasing timestamps, capture clocks can repeat after a restart
+    int64_t pts = std::chrono::duration_cast<std::chrono::microseconds>(frame.timestamp - first_timestamp).count();
+    if (pts <= last_pts) {
+        pts = last_pts + 1;
+    }
+    last_pts = pts;
+
+    x264_picture_t in, out;
+    x264_picture_init(&in);
+    in.img.i_csp = X264_CSP_NV12;
+    in.img.i_plane = 2;
+    in.img.plane[0] = nv12.data();
+    in.img.i_stride[0] = static_cast<int>(frame.width);
+    in.img.plane[1] = nv12.data() + static_cast<size_t>(frame.width) * frame.height;
+    in.img.i_stride[1] = static_cast<int>((frame.width + 1) / 2 * 2);
+    in.i_pts = pts;
+    in.i_type = keyframe_requested.exchange(false) ? X264_TYPE_IDR : X264_TYPE_AUTO;
+    in.opaque = reinterpret_cast<void *>(static_cast<uintptr_t>(frame.sequence));
+
+    x264_nal_t *nals;
+    int count;
+    const int size = x264_encoder_encode(encoder, &nals, &count, &in, &out);
+    if (size < 0) {
+        frames_skipped++;
+        return;
+    }
+    if (size > 0) {
+        // x264 lays the NAL units of a frame out back to back
+        emit(nals[0].p_payload, size, out.i_pts, out.i_dts, out.b_keyframe, reinterpret_cast<uintptr_t>(out.opaque));
+    }
+}
+
+void h264_encoder::emit(const uint8_t *data, int size, int64_t pts, int64_t dts, bool keyframe, uint64_t sequence) {
+    encoded_packet packet;
+    packet.data = data;
+    packet.size = static_cast<size_t>(size);
+    packet.sequence = sequence;
+    packet.width = width;
+    packet.height = height;
+    packet.pts_us = pts;
+    packet.dts_us = dts;
+    packet.keyframe = keyframe;
+    packet.timestamp = first_timestamp + std::chrono::microseconds(pts);
+
+    if (sink) {
+        sink(packet);
+    }
+
+    const auto now = std::chrono::steady_clock::now();
+    std::lock_guard<std::mutex> lock(stats_mutex);
+    frames_encoded++;
+    bytes_encoded += packet.size;
+    latency.add(std::chrono::duration<float, std::milli>(now - packet.timestamp).count());
+}
+
+void h264_encoder::report() {
+    const size_t dropped = frames_dropped;
+    const float seconds = report_timer.lap();
+
+    std::lock_guard<std::mutex> lock(stats_mutex);
+    std::cout << "Encoder: " << latency.count() << " frames, " << dropped - last_dropped << " dropped, "
+              << (seconds > 0 ? bytes_encoded * 8 / 1000.0f / seconds : 0) << " kbit/s, capture->packet avg "
+              << latency.average() << " ms, max " << latency.max() << " ms" << std::endl;
+
+    last_dropped = dropped;
+    bytes_encoded = 0;
+    latency.reset();
+}
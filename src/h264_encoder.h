@@ -0,0 +1,106 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include "fps_counter.h"
+#include "video_frame.h"
+
+struct x264_t;
+class jpeg_decoder;
+
+// The NAL units of one encoded frame in Annex B format.
+struct encoded_packet {
+    const uint8_t *data = nullptr;
+    size_t size = 0;
+    uint64_t sequence = 0;  // of the captured frame
+    uint32_t width = 0;
+    uint32_t height = 0;
+    int64_t pts_us = 0;     // presentation and decode time, relative to the first encoded frame
+    int64_t dts_us = 0;
+    bool keyframe = false;
+
+    // capture time on the steady (CLOCK_MONOTONIC) clock
+    std::chrono::steady_clock::time_point timestamp;
+};
+
+struct encoder_options {
+    uint32_t bitrate_kbps = 8000;
+    float frame_rate = 30;
+    std::string preset = "veryfast"; // x264 speed preset, always tuned for zero latency
+    int threads = 0;                 // 0 lets x264 pick from the core count
+    float keyframe_seconds = 2;
+};
+
+// Encodes frames to H.264 with x264 on a thread of its own, x264 spreads each frame over its
+// slice threads. The producer only copies a frame into a free slot of a small pool; when the
+// encoder falls behind the frame is dropped and counted, capture and display never wait for
+// it. Frames are converted to NV12 first, MJPEG frames get decoded for that.
+class h264_encoder {
+public:
+    // called on the encoder thread for every packet, data is only valid during the call
+    using packet_sink = std::function<void(const encoded_packet&)>;
+
+    h264_encoder(const encoder_options& options, packet_sink sink, size_t queue_frames = 3);
+    ~h264_encoder();
+
+    // call on the producer thread, e.g. from a frame sink
+    void push(const video_frame& frame);
+
+    // the next frame becomes an IDR frame, for a consumer joining mid stream
+    void request_keyframe() { keyframe_requested = true; }
+
+    // prints what happened since the last report
+    void report();
+
+private:
+    struct slot {
+        std::vector<uint8_t> data;
+        video_frame frame;
+    };
+
+    void encode_fun();
+    void encode(const video_frame& frame);
+    bool open_encoder(uint32_t width, uint32_t height);
+    void close_encoder();
+    void emit(const uint8_t *data, int size, int64_t pts, int64_t dts, bool keyframe, uint64_t sequence);
+
+    encoder_options options;
+    packet_sink sink;
+
+    std::vector<slot> slots;
+    std::vector<size_t> free_slots;
+    std::deque<size_t> ready;
+    std::mutex queue_mutex;
+    std::condition_variable queue_changed;
+    bool stopping = false;
+
+    // encoder thread only
+    x264_t *encoder = nullptr;
+    uint32_t width = 0, height = 0;
+    bool open_failed = false;
+    jpeg_decoder *decoder = nullptr;
+    std::vector<uint8_t> nv12;
+    std::chrono::steady_clock::time_point first_timestamp;
+    bool have_first = false;
+    int64_t last_pts = -1;
+
+    std::atomic<bool> keyframe_requested{false};
+    std::atomic<size_t> frames_dropped{0};
+    std::atomic<size_t> frames_skipped{0}; // not convertible or not encodable
+
+    std::mutex stats_mutex;
+    size_t frames_encoded = 0;
+    uint64_t bytes_encoded = 0;
+    stage_stats latency; // capture to packet
+    size_t last_dropped = 0;
+    timer report_timer;
+
+    std::thread encode_thread;
+};
@@ -0,0 +1,87 @@
+#include <algorithm>
+#include <csetjmp>
+#include <cstdio>
+#include <iostream>
+#include <jpeglib.h>
+#include "jpeg_decoder.h"
+
+struct jpeg_state {
+    jpeg_decompress_struct info;
+    jpeg_error_mgr errors;
+    jmp_buf bail;
+    char message[JMSG_LENGTH_MAX];
+};
+
+// libjpeg exits the process on errors by default; a corrupt frame from a flaky USB link should
+// only cost that frame
+static void bail_out(j_common_ptr info) {
+    auto state = static_cast<jpeg_state *>(info->client_data);
+    info->err->format_message(info, state->message);
+    longjmp(state->bail, 1);
+}
+
+// webcams regularly send frames with trailing garbage, which libjpeg warns about on every frame
+static void ignore_message(j_common_ptr, int) {
+}
+
+jpeg_decoder::jpeg_decoder(uint32_t pixel_format_) : state(new jpeg_state()), pixel_format(pixel_format_) {
+#ifndef JCS_EXTENSIONS
+    pixel_format = V4L2_PIX_FMT_RGB24;
+#endif
+    state->info.err = jpeg_std_error(&state->errors);
+    state->errors.error_exit = bail_out;
+    state->errors.emit_message = ignore_message;
+    state->info.client_data = state;
+    jpeg_create_decompress(&state->info);
+}
+
+jpeg_decoder::~jpeg_decoder() {
+    jpeg_destroy_decompress(&state->info);
+    delete state;
+}
+
+bool jpeg_decoder::decode(const video_frame& compressed, video_frame& decoded) {
+    auto& info = state->info;
+
+    if (setjmp(state->bail)) {
+        jpeg_abort_decompress(&info);
+        if (failures++ == 0) {
+            std::cerr << "Skipping corrupt MJPEG frame: " << state->message << std::endl;
+        }
+        return false;
+    }
+
+    jpeg_mem_src(&info, compressed.data, compressed.size);
+    jpeg_read_header(&info, TRUE);
+
+#ifdef JCS_EXTENSIONS
+    info.out_color_space = pixel_format == V4L2_PIX_FMT_XBGR32 ? JCS_EXT_BGRX : JCS_RGB;
+#else
+    info.out_color_space = JCS_RGB;
+#endif
+    // the fast paths are indistinguishable on screen and save a good part of the decode
+    info.dct_method = JDCT_IFAST;
+    info.do_fancy_upsampling = FALSE;
+    jpeg_start_decompress(&info);
+
+    const uint32_t stride = info.output_width * bytes_per_pixel(pixel_format);
+    pixels.resize(static_cast<size_t>(stride) * info.output_height);
+    while (info.output_scanline < info.output_height) {
+        JSAMPROW rows[16];
+        const uint32_t count = std::min<uint32_t>(16, info.output_height - info.output_scanline);
+        for (uint32_t i = 0; i < count; i++) {
+            rows[i] = pixels.data() + static_cast<size_t>(info.output_scanline + i) * stride;
+        }
+        jpeg_read_scanlines(&info, rows, count);
+    }
+    jpeg_finish_decompress(&info);
+
+    decoded = compressed;
+    decoded.data = pixels.data();
+    decoded.size = pixels.size();
+    decoded.width = info.output_width;
+    decoded.height = info.output_height;
+    decoded.pixel_format = pixel_format;
+    set_plane_layout(decoded, stride);
+    return true;
+}
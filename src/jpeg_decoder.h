@@ -0,0 +1,32 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+#include "video_frame.h"
+
+struct jpeg_state;
+
+// Decodes MJPEG frames into packed pixels the texture upload takes. Capture, recording and
+// replay pass compressed frames along untouched; only frames the display actually latches get
+// decoded here, on the render thread.
+class jpeg_decoder {
+public:
+    // pixel_format: V4L2_PIX_FMT_RGB24 or V4L2_PIX_FMT_XBGR32; without libjpeg-turbo's
+    // extended color spaces it decodes to RGB24 either way
+    explicit jpeg_decoder(uint32_t pixel_format);
+    ~jpeg_decoder();
+
+    // Decodes into a buffer that stays valid until the next call, the rest of the frame's
+    // metadata is carried over. False for corrupt frames.
+    bool decode(const video_frame& compressed, video_frame& decoded);
+
+    // corrupt frames so far
+    size_t failed() const { return failures; }
+
+private:
+    jpeg_state *state;
+    uint32_t pixel_format;
+    std::vector<uint8_t> pixels;
+    size_t failures = 0;
+};
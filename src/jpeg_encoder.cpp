@@ -0,0 +1,133 @@
+#include <algorithm>
+#include <cstdio>
+#include <jpeglib.h>
+#include "jpeg_encoder.h"
+#include "pixel_convert.h"
+
+struct jpeg_encoder_state {
+    jpeg_compress_struct info;
+    jpeg_error_mgr errors;
+    jpeg_destination_mgr destination;
+    std::vector<uint8_t> *output;
+
+    // convert_to_nv12 gives limited range, JFIF wants full range
+    uint8_t luma_range[256];
+    uint8_t chroma_range[256];
+};
+
+// libjpeg writes into the vector, which grows when it runs out
+static void start_output(j_compress_ptr info) {
+    auto state = static_cast<jpeg_encoder_state *>(info->client_data);
+    state->output->resize(std::max<size_t>(state->output->capacity(), 64 * 1024));
+    info->dest->next_output_byte = state->output->data();
+    info->dest->free_in_buffer = state->output->size();
+}
+
+static boolean grow_output(j_compress_ptr info) {
+    auto state = static_cast<jpeg_encoder_state *>(info->client_data);
+    const size_t used = state->output->size();
+    state->output->resize(used * 2);
+    info->dest->next_output_byte = state->output->data() + used;
+    info->dest->free_in_buffer = state->output->size() - used;
+    return TRUE;
+}
+
+static void finish_output(j_compress_ptr info) {
+    auto state = static_cast<jpeg_encoder_state *>(info->client_data);
+    state->output->resize(state->output->size() - info->dest->free_in_buffer);
+}
+
+static uint8_t clamp(int value) {
+    return static_cast<uint8_t>(std::min(std::max(value, 0), 255));
+}
+
+jpeg_encoder::jpeg_encoder(int quality_) : state(new jpeg_encoder_state()), quality(std::min(std::max(quality_, 1), 100)) {
+    // the error manager's default exits, which is fine: nothing here depends on the input data
+    state->info.err = jpeg_std_error(&state->errors);
+    state->info.client_data = state;
+    jpeg_create_compress(&state->info);
+
+    state->destination.init_destination = start_output;
+    state->destination.empty_output_buffer = grow_output;
+    state->destination.term_destination = finish_output;
+    state->info.dest = &state->destination;
+
+    for (int i = 0; i < 256; i++) {
+        state->luma_range[i] = clamp(((i - 16) * 255 + 109) / 219);
+        state->chroma_range[i] = clamp(128 + ((i - 128) * 255) / 224);
+    }
+}
+
+jpeg_encoder::~jpeg_encoder() {
+    jpeg_destroy_compress(&state->info);
+    delete state;
+}
+
+bool jpeg_encoder::encode(const video_frame& frame, std::vector<uint8_t>& jpeg) {
+    if (!convert_to_nv12(frame, nv12)) {
+        return false;
+    }
+
+    // Raw data input reads whole MCUs: 16 pixels wide and 16 lines high for luma, 8 for chroma.
+    // The planes are padded to that by repeating the edge pixels.
+    const uint32_t w = frame.width, h = frame.height;
+    const uint32_t cw = (w + 1) / 2, ch = (h + 1) / 2;
+    const uint32_t y_stride = (w + 15) / 16 * 16, c_stride = y_stride / 2;
+    const uint32_t y_lines = (h + 15) / 16 * 16, c_lines = y_lines / 2;
+    planes.resize(static_cast<size_t>(y_stride) * y_lines + static_cast<size_t>(c_stride) * c_lines * 2);
+    uint8_t *y_plane = planes.data();
+    uint8_t *cb_plane = y_plane + static_cast<size_t>(y_stride) * y_lines;
+    uint8_t *cr_plane = cb_plane + static_cast<size_t>(c_stride) * c_lines;
+
+    for (uint32_t row = 0; row < y_lines; row++) {
+        const uint8_t *src = nv12.data() + static_cast<size_t>(std::min(row, h - 1)) * w;
+        uint8_t *dst = y_plane + static_cast<size_t>(row) * y_stride;
+        for (uint32_t x = 0; x < y_stride; x++) {
+            dst[x] = state->luma_range[src[std::min(x, w - 1)]];
+        }
+    }
+    const uint8_t *chroma = nv12.data() + static_cast<size_t>(w) * h;
+    for (uint32_t row = 0; row < c_lines; row++) {
+        const uint8_t *src = chroma + static_cast<size_t>(std::min(row, ch - 1)) * cw * 2;
+        uint8_t *cb = cb_plane + static_cast<size_t>(row) * c_stride;
+        uint8_t *cr = cr_plane + static_cast<size_t>(row) * c_stride;
+        for (uint32_t x = 0; x < c_stride; x++) {
+            const uint32_t sx = std::min(x, cw - 1) * 2;
+            cb[x] = state->chroma_range[src[sx]];
+            cr[x] = state->chroma_range[src[sx + 1]];
+        }
+    }
+
+    auto& info = state->info;
+    state->output = &jpeg;
+    info.image_width = w;
+    info.image_height = h;
+    info.input_components = 3;
+    info.in_color_space = JCS_YCbCr;
+    jpeg_set_defaults(&info);
+    jpeg_set_quality(&info, quality, TRUE);
+    info.raw_data_in = TRUE;
+    info.dct_method = JDCT_IFAST;
+    info.comp_info[0].h_samp_factor = 2;
+    info.comp_info[0].v_samp_factor = 2;
+    info.comp_info[1].h_samp_factor = 1;
+    info.comp_info[1].v_samp_factor = 1;
+    info.comp_info[2].h_samp_factor = 1;
+    info.comp_info[2].v_samp_factor = 1;
+    jpeg_start_compress(&info, TRUE);
+
+    JSAMPROW y_rows[16], cb_rows[8], cr_rows[8];
+    JSAMPARRAY components[3] = {y_rows, cb_rows, cr_rows};
+    for (uint32_t line = 0; line < y_lines; line += 16) {
+        for (uint32_t i = 0; i < 16; i++) {
+            y_rows[i] = y_plane + static_cast<size_t>(line + i) * y_stride;
+        }
+        for (uint32_t i = 0; i < 8; i++) {
+            cb_rows[i] = cb_plane + static_cast<size_t>(line / 2 + i) * c_stride;
+            cr_rows[i] = cr_plane + static_cast<size_t>(line / 2 + i) * c_stride;
+        }
+        jpeg_write_raw_data(&info, components, 16);
+    }
+    jpeg_finish_compress(&info);
+    return true;
+}
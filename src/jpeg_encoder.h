@@ -0,0 +1,26 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+#include "video_frame.h"
+
+struct jpeg_encoder_state;
+
+// Compresses uncompressed frames to baseline 4:2:0 JPEG, for viewers that only take that. Every
+// format convert_to_nv12 knows is fed to libjpeg as raw YCbCr, so RGB isn't converted twice.
+class jpeg_encoder {
+public:
+    // quality: libjpeg's 1 to 100
+    explicit jpeg_encoder(int quality);
+    ~jpeg_encoder();
+
+    // Replaces the contents of jpeg. False for formats that can't be converted.
+    bool encode(const video_frame& frame, std::vector<uint8_t>& jpeg);
+
+private:
+    jpeg_encoder_state *state;
+    int quality;
+    std::vector<uint8_t> nv12;
+    std::vector<uint8_t> planes;
+};
@@ -0,0 +1,112 @@
+#include <glad/glad.h>
+#include <iostream>
+#include <algorithm>
+#include <cmath>
+#include "latency_probe.h"
+#include "frame_stamp.h"
+
+latency_probe::latency_probe(int w, int h, size_t frames)
+        : stream_width(w), stream_height(h), frames_to_measure(frames) {
+    glGenBuffers(1, &pack_pbo);
+    latencies.reserve(frames_to_measure);
+}
+
+latency_probe::~latency_probe() {
+    glDeleteBuffers(1, &pack_pbo);
+}
+
+void latency_probe::resize(int w, int h) {
+    stream_width = w;
+    stream_height = h;
+}
+
+void latency_probe::read_back(int x, int y, int w, int h) {
+    scale_x = w / static_cast<float>(stream_width);
+    scale_y = h / static_cast<float>(stream_height);
+    read_width = w;
+    read_height = std::min(h, static_cast<int>(std::ceil(stamp_height(stream_width) * scale_y)));
+
+    // the stamp sits at the top of the image, GL rows count from the bottom
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, pack_pbo);
+    glBufferData(GL_PIXEL_PACK_BUFFER, read_width * read_height * 3, nullptr, GL_STREAM_READ);
+    glPixelStorei(GL_PACK_ALIGNMENT, 1);
+    glReadPixels(x, y + h - read_height, read_width, read_height, GL_RGB, GL_UNSIGNED_BYTE, nullptr);
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+    pending = true;
+}
+
+void latency_probe::presented(std::chrono::steady_clock::time_point when) {
+    if (!pending) {
+        return;
+    }
+    pending = false;
+
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, pack_pbo);
+    auto *pixels = static_cast<const uint8_t *>(glMapBuffer(GL_PIXEL_PACK_BUFFER, GL_READ_ONLY));
+
+    frame_stamp stamp;
+    bool decoded = false;
+    if (pixels) {
+        // start at the top row and walk downwards
+        const int stride = read_width * 3;
+        decoded = read_frame_stamp(pixels + (read_height - 1) * stride, stream_width, -stride, scale_x, scale_y, stamp);
+        glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+    }
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+
+    if (!decoded) {
+        unreadable++;
+        return;
+    }
+
+    if (have_last && stamp.frame_id == last_id) {
+        repeats++;
+        return;
+    }
+    if (have_last && stamp.frame_id > last_id + 1) {
+        drops += stamp.frame_id - last_id - 1;
+    }
+    have_last = true;
+    last_id = stamp.frame_id;
+
+    const auto captured = std::chrono::steady_clock::time_point(std::chrono::microseconds(stamp.timestamp_us));
+    latencies.push_back(std::chrono::duration<float, std::milli>(when - captured).count());
+}
+
+bool latency_probe::done() const {
+    return latencies.size() >= frames_to_measure;
+}
+
+bool latency_probe::report(float max_latency_ms) const {
+    if (latencies.empty()) {
+        std::cout << "Latency: no stamped frames were displayed (" << unreadable << " unreadable)" << std::endl;
+        return false;
+    }
+
+    auto sorted = latencies;
+    std::sort(sorted.begin(), sorted.end());
+    auto percentile = [&sorted](float p) {
+        return sorted[std::min(sorted.size() - 1, static_cast<size_t>(p * sorted.size()))];
+    };
+
+    float total = 0;
+    for (auto l: sorted) {
+        total += l;
+    }
+
+    std::cout << "Capture->display latency over " << sorted.size() << " frames:" << std::endl;
+    std::cout << "\tmin: " << sorted.front() << " ms" << std::endl;
+    std::cout << "\tavg: " << total / sorted.size() << " ms" << std::endl;
+    std::cout << "\tp50: " << percentile(0.50f) << " ms" << std::endl;
+    std::cout << "\tp95: " << percentile(0.95f) << " ms" << std::endl;
+    std::cout << "\tmax: " << sorted.back() << " ms" << std::endl;
+    std::cout << "\trepeated presents: " << repeats << std::endl;
+    std::cout << "\tdropped frames: " << drops << std::endl;
+    std::cout << "\tunreadable presents: " << unreadable << std::endl;
+
+    if (max_latency_ms > 0 && percentile(0.95f) > max_latency_ms) {
+        std::cout << "Latency p95 above the " << max_latency_ms << " ms limit" << std::endl;
+        return false;
+    }
+    return true;
+}
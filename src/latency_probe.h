@@ -0,0 +1,44 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <vector>
+
+// Measures capture->display latency of stamped frames (see frame_stamp.h). The stamp rows are read
+// back from the back buffer after drawing, through a pack PBO so the read doesn't stall, and decoded
+// once the swap has completed.
+class latency_probe {
+public:
+    latency_probe(int stream_width, int stream_height, size_t frames_to_measure);
+    ~latency_probe();
+
+    // the stream changed resolution
+    void resize(int stream_width, int stream_height);
+
+    // after drawing, before the swap; the viewport the frame was drawn into
+    void read_back(int x, int y, int w, int h);
+
+    // once the swap has completed
+    void presented(std::chrono::steady_clock::time_point when);
+
+    bool done() const;
+
+    // prints the summary; false when the 95th percentile latency is above max_latency_ms (if set)
+    bool report(float max_latency_ms) const;
+
+private:
+    int stream_width, stream_height;
+    size_t frames_to_measure;
+
+    uint32_t pack_pbo = 0;
+    int read_width = 0, read_height = 0;
+    float scale_x = 1, scale_y = 1;
+    bool pending = false;
+
+    bool have_last = false;
+    uint32_t last_id = 0;
+    size_t repeats = 0;
+    size_t drops = 0;
+    size_t unreadable = 0;
+    std::vector<float> latencies;
+};
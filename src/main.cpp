@@ -5,15 +5,58 @@
 #include "audio_source.h"
 #include "video_source.h"
 
+static std::array<int, 2> parse_geometry(const std::string& geometry) {
+    auto pieces = split_string(geometry, "x");
+    auto width = std::stoi(pieces[0]);
+    auto height = pieces.size() > 1 ? std::stoi(pieces[1]) : 0;
+    return {width, height};
+}
+
 int main(int argc, char **argv) {
+    const auto start_time = std::chrono::steady_clock::now();
+
     cxxopts::Options options("streamer", "A video/audio streamer for v4l2 devices");
     options.positional_help("[list-video] [list-audio]")
             .show_positional_help();
 
     options.add_options()
-            ("v,video-device", "The video device", cxxopts::value<std::string>()->default_value("/dev/video1"))
+            ("v,video-device", "The video device, \"synthetic\" for a generated test pattern, or rtp://[host]:port to play RTP video sent there", cxxopts::value<std::string>()->default_value("/dev/video1"))
+            ("synthetic-fps", "Frame rate of the synthetic video source", cxxopts::value<float>()->default_value("60"))
+            ("synthetic-buffers", "Buffers the synthetic video source cycles through", cxxopts::value<size_t>()->default_value("4"))
             ("a,audio-device", "The ALSA audio device", cxxopts::value<std::string>()->default_value("default"))
             ("g,geometry", "Desired stream resolution in pixels WxH", cxxopts::value<std::string>()->default_value("800x600"))
+            ("geometries", "Comma separated resolutions (WxH) the g key switches between at runtime", cxxopts::value<std::string>()->default_value(""))
+            ("p,present", "Presentation policy: vsync, adaptive, immediate, on-frame or late-latch", cxxopts::value<std::string>()->default_value("vsync"))
+            ("upload-format", "Texture upload format: auto, rgb or bgra", cxxopts::value<std::string>()->default_value("auto"))
+            ("mjpeg", "Capture MJPEG when the device has it; recording and replay keep the compressed frames, only the display decodes them")
+            ("headless", "Render to a hidden window and skip audio")
+            ("measure-latency", "Measure capture->display latency over N frames of the synthetic source, then exit", cxxopts::value<size_t>()->default_value("0"))
+            ("max-latency", "With --measure-latency, exit with an error when p95 latency exceeds this many ms", cxxopts::value<float>()->default_value("0"))
+            ("check-frames", "Count torn, duplicated and skipped frames of the synthetic source; exit with an error on tearing")
+            ("timings", "Print CPU and GPU render stage timings every second")
+            ("record", "Record the video stream to this file", cxxopts::value<std::string>()->default_value(""))
+            ("record-format", "Recording format: y4m, raw with a <file>.idx index, h264, or mkv with audio", cxxopts::value<std::string>()->default_value("y4m"))
+            ("bitrate", "H.264 bitrate in kbit/s", cxxopts::value<uint32_t>()->default_value("8000"))
+            ("encoder-preset", "x264 speed preset, from ultrafast to placebo", cxxopts::value<std::string>()->default_value("veryfast"))
+            ("encoder-threads", "Encoder threads, 0 for one per core", cxxopts::value<int>()->default_value("0"))
+            ("replay-seconds", "Keep this many seconds of video and audio in memory, the d key saves them", cxxopts::value<float>()->default_value("0"))
+            ("replay-mb", "Memory for replay video frames in MB", cxxopts::value<size_t>()->default_value("1024"))
+            ("shm", "Publish frames to local processes in POSIX shared memory under this name", cxxopts::value<std::string>()->default_value(""))
+            ("shm-slots", "Frames the shared memory ring holds", cxxopts::value<uint32_t>()->default_value("4"))
+            ("export-dmabuf", "Pass the capture buffers to local processes as dmabufs over a Unix socket at this path", cxxopts::value<std::string>()->default_value(""))
+            ("capture-buffers", "V4L2 capture buffers; processes reading exported ones may hold all but two", cxxopts::value<size_t>()->default_value("4"))
+            ("http-port", "Serve the video as MJPEG over HTTP on this port, with /snapshot for single JPEGs", cxxopts::value<uint16_t>()->default_value("0"))
+            ("jpeg-quality", "JPEG quality for frames the HTTP server compresses, 1 to 100", cxxopts::value<int>()->default_value("80"))
+            ("rtp-send", "Send the video as uncompressed RFC 4175 RTP to host:port, unicast or multicast", cxxopts::value<std::string>()->default_value(""))
+            ("rtp-mtu", "IP packet size for RTP, 9000 on jumbo frame networks", cxxopts::value<uint32_t>()->default_value("1500"))
+            ("rtp-burst", "RTP packets sent back to back at line rate between pauses (the microburst size), at most 64", cxxopts::value<uint32_t>()->default_value("32"))
+            ("rtp-no-gso", "Send RTP bursts as packet batches instead of UDP GSO super packets")
+            ("rtp-jpeg", "Send RFC 2435 JPEG over RTP instead of uncompressed video, at --jpeg-quality")
+            ("rtp-loss", "For testing receivers: drop this share of the RTP packets sent, 0 to 1", cxxopts::value<float>()->default_value("0"))
+            ("rtp-jitter", "For testing receivers: delay each RTP frame by up to this many ms and swap some packets", cxxopts::value<uint32_t>()->default_value("0"))
+            ("rtp-delay", "Least playout delay of an rtp:// video device in ms", cxxopts::value<uint32_t>()->default_value("5"))
+            ("rtp-max-delay", "Most playout delay of an rtp:// video device in ms, however late frames come", cxxopts::value<uint32_t>()->default_value("200"))
+            ("capture-memory", "Capture into driver buffers (mmap), memfd pages through udmabuf, or a huge page pool (hugepages)", cxxopts::value<std::string>()->default_value("mmap"))
             ("h,help", "Print usage");
 
     options.allow_unrecognised_options();
@@ -39,15 +82,128 @@ int main(int argc, char **argv) {
         }
     }
 
-    auto video_device = result["video-device"].as<std::string>();
-    auto geometry = result["geometry"].as<std::string>();
-    auto pieces = split_string(geometry, "x");
-    auto width = std::stoi(pieces[0]);
-    auto height = pieces.size() > 1 ? std::stoi(pieces[1]) : 0;
+    streamer_options stream_options;
+    stream_options.start_time = start_time;
+    stream_options.video_device = result["video-device"].as<std::string>();
+    stream_options.audio_device = result["audio-device"].as<std::string>();
+    stream_options.synthetic_fps = result["synthetic-fps"].as<float>();
+    stream_options.synthetic_buffers = result["synthetic-buffers"].as<size_t>();
+    if (stream_options.synthetic_buffers < 1) {
+        std::cerr << "The synthetic video source needs at least one buffer" << std::endl;
+        return 1;
+    }
+
+    auto geometry = parse_geometry(result["geometry"].as<std::string>());
+    stream_options.stream_width = geometry[0];
+    stream_options.stream_height = geometry[1];
+
+    auto geometries = result["geometries"].as<std::string>();
+    if (!geometries.empty()) {
+        // start from the initial resolution so cycling comes back to it
+        stream_options.geometries.push_back(geometry);
+        for (auto& g: split_string(geometries, ",")) {
+            stream_options.geometries.push_back(parse_geometry(trim(g)));
+        }
+    }
 
-    auto audio_device = result["audio-device"].as<std::string>();
+    auto present = result["present"].as<std::string>();
+    if (present == "vsync") {
+        stream_options.present = present_policy::vsync;
+    } else if (present == "adaptive") {
+        stream_options.present = present_policy::adaptive;
+    } else if (present == "immediate") {
+        stream_options.present = present_policy::immediate;
+    } else if (present == "on-frame") {
+        stream_options.present = present_policy::on_frame;
+    } else if (present == "late-latch") {
+        stream_options.present = present_policy::late_latch;
+    } else {
+        std::cerr << "Unknown presentation policy: " << present << std::endl;
+        return 1;
+    }
+
+    auto upload = result["upload-format"].as<std::string>();
+    if (upload == "auto") {
+        stream_options.upload = upload_format::automatic;
+    } else if (upload == "rgb") {
+        stream_options.upload = upload_format::rgb;
+    } else if (upload == "bgra") {
+        stream_options.upload = upload_format::bgra;
+    } else {
+        std::cerr << "Unknown upload format: " << upload << std::endl;
+        return 1;
+    }
+
+    stream_options.show_timings = result.count("timings") > 0;
+    stream_options.headless = result.count("headless") > 0;
+    stream_options.measure_latency = result["measure-latency"].as<size_t>();
+    stream_options.max_latency_ms = result["max-latency"].as<float>();
+    stream_options.check_frames = result.count("check-frames") > 0;
+    stream_options.mjpeg = result.count("mjpeg") > 0;
+
+    stream_options.replay_seconds = result["replay-seconds"].as<float>();
+    stream_options.replay_megabytes = result["replay-mb"].as<size_t>();
+    stream_options.shm_name = result["shm"].as<std::string>();
+    stream_options.shm_slots = result["shm-slots"].as<uint32_t>();
+    stream_options.export_socket = result["export-dmabuf"].as<std::string>();
+    stream_options.capture_buffers = result["capture-buffers"].as<size_t>();
+    stream_options.http_port = result["http-port"].as<uint16_t>();
+    stream_options.jpeg_quality = result["jpeg-quality"].as<int>();
+    stream_options.rtp.destination = result["rtp-send"].as<std::string>();
+    stream_options.rtp.mtu = result["rtp-mtu"].as<uint32_t>();
+    stream_options.rtp.burst = result["rtp-burst"].as<uint32_t>();
+    stream_options.rtp.gso = result.count("rtp-no-gso") == 0;
+    stream_options.rtp.jpeg = result.count("rtp-jpeg") > 0;
+    stream_options.rtp.jpeg_quality = stream_options.jpeg_quality;
+    stream_options.rtp.loss = result["rtp-loss"].as<float>();
+    stream_options.rtp.jitter = std::chrono::milliseconds(result["rtp-jitter"].as<uint32_t>());
+    stream_options.rtp_min_delay_ms = result["rtp-delay"].as<uint32_t>();
+    stream_options.rtp_max_delay_ms = result["rtp-max-delay"].as<uint32_t>();
+
+    auto capture_memory = result["capture-memory"].as<std::string>();
+    if (capture_memory == "mmap") {
+        stream_options.memory = capture_memory::mmap;
+    } else if (capture_memory == "udmabuf") {
+        stream_options.memory = capture_memory::udmabuf;
+    } else if (capture_memory == "hugepages") {
+        stream_options.memory = capture_memory::hugepages;
+    } else {
+        std::cerr << "Unknown capture memory: " << capture_memory << std::endl;
+        return 1;
+    }
+
+    stream_options.record_path = result["record"].as<std::string>();
+    auto record_format = result["record-format"].as<std::string>();
+    if (record_format == "y4m") {
+        stream_options.record = record_format::y4m;
+    } else if (record_format == "raw") {
+        stream_options.record = record_format::raw;
+    } else if (record_format == "h264") {
+        stream_options.record = record_format::h264;
+    } else if (record_format == "mkv") {
+        stream_options.record = record_format::mkv;
+    } else {
+        std::cerr << "Unknown recording format: " << record_format << std::endl;
+        return 1;
+    }
+    stream_options.encoding.bitrate_kbps = result["bitrate"].as<uint32_t>();
+    stream_options.encoding.preset = result["encoder-preset"].as<std::string>();
+    stream_options.encoding.threads = result["encoder-threads"].as<int>();
+
+    if (stream_options.mjpeg && !result.count("record-format")) {
+        // y4m can't hold compressed frames, raw stores them as they came
+        stream_options.record = record_format::raw;
+    }
+
+    if (stream_options.measure_latency > 0 && stream_options.video_device != "synthetic") {
+        std::cerr << "Latency measurement needs the stamped frames of the synthetic video source (-v synthetic)" << std::endl;
+        return 1;
+    }
+    if (stream_options.check_frames && stream_options.video_device != "synthetic") {
+        std::cerr << "Frame checking needs the stamped frames of the synthetic video source (-v synthetic)" << std::endl;
+        return 1;
+    }
 
-    streamer stream(video_device, audio_device, width, height);
-    stream.loop();
-    return 0;
+    streamer stream(stream_options);
+    return stream.loop();
 }
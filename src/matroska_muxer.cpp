@@ -0,0 +1,386 @@
+#include <algorithm>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include "matroska_muxer.h"
+
+static constexpr uint32_t video_track = 1;
+static constexpr uint32_t audio_track_number = 2;
+
+// audio blocks of this long keep the per block overhead small
+static constexpr auto audio_block_duration = std::chrono::milliseconds(20);
+
+// how long the head of one track's queue waits for the other track before it is written anyway
+static constexpr auto max_interleave_delay = std::chrono::milliseconds(500);
+
+// clusters close after this long even without a keyframe; block times are 16 bit relative to it
+static constexpr int64_t max_cluster_ms = 1000;
+static constexpr size_t max_cluster_bytes = 16 << 20;
+
+// EBML element IDs, see the Matroska specification
+enum : uint32_t {
+    ebml_header = 0x1A45DFA3,
+    ebml_version = 0x4286,
+    ebml_read_version = 0x42F7,
+    ebml_max_id_length = 0x42F2,
+    ebml_max_size_length = 0x42F3,
+    doc_type = 0x4282,
+    doc_type_version = 0x4287,
+    doc_type_read_version = 0x4285,
+    segment = 0x18538067,
+    info = 0x1549A966,
+    timestamp_scale = 0x2AD7B1,
+    muxing_app = 0x4D80,
+    writing_app = 0x5741,
+    tracks = 0x1654AE6B,
+    track_entry = 0xAE,
+    track_number = 0xD7,
+    track_uid = 0x73C5,
+    track_type = 0x83,
+    flag_lacing = 0x9C,
+    codec_id = 0x86,
+    codec_private = 0x63A2,
+    video_settings = 0xE0,
+    pixel_width = 0xB0,
+    pixel_height = 0xBA,
+    audio_settings = 0xE1,
+    sampling_frequency = 0xB5,
+    channels = 0x9F,
+    bit_depth = 0x6264,
+    cluster_id = 0x1F43B675,
+    cluster_timestamp = 0xE7,
+    simple_block = 0xA3,
+};
+
+static void put_id(std::vector<uint8_t>& out, uint32_t id) {
+    // IDs carry their own length marker, written as is without leading zero bytes
+    for (int shift = 24; shift >= 0; shift -= 8) {
+        if ((id >> shift) || shift == 0) {
+            out.push_back(static_cast<uint8_t>(id >> shift));
+        }
+    }
+}
+
+static void put_size(std::vector<uint8_t>& out, uint64_t size) {
+    // all ones means unknown size, so a length holds one less than its bits allow
+    int length = 1;
+    while (length < 8 && size >= (1ull << (7 * length)) - 1) {
+        length++;
+    }
+    const uint64_t coded = size | (1ull << (7 * length));
+    for (int i = length - 1; i >= 0; i--) {
+        out.push_back(static_cast<uint8_t>(coded >> (8 * i)));
+    }
+}
+
+static void put_uint(std::vector<uint8_t>& out, uint32_t id, uint64_t value) {
+    int length = 1;
+    while (length < 8 && (value >> (8 * length))) {
+        length++;
+    }
+    put_id(out, id);
+    put_size(out, length);
+    for (int i = length - 1; i >= 0; i--) {
+        out.push_back(static_cast<uint8_t>(value >> (8 * i)));
+    }
+}
+
+static void put_float(std::vector<uint8_t>& out, uint32_t id, double value) {
+    uint64_t bits;
+    memcpy(&bits, &value, sizeof(bits));
+    put_id(out, id);
+    put_size(out, 8);
+    for (int i = 7; i >= 0; i--) {
+        out.push_back(static_cast<uint8_t>(bits >> (8 * i)));
+    }
+}
+
+static void put_binary(std::vector<uint8_t>& out, uint32_t id, const void *data, size_t size) {
+    put_id(out, id);
+    put_size(out, size);
+    out.insert(out.end(), static_cast<const uint8_t *>(data), static_cast<const uint8_t *>(data) + size);
+}
+
+static void put_string(std::vector<uint8_t>& out, uint32_t id, const std::string& value) {
+    put_binary(out, id, value.data(), value.size());
+}
+
+static void put_master(std::vector<uint8_t>& out, uint32_t id, const std::vector<uint8_t>& body) {
+    put_binary(out, id, body.data(), body.size());
+}
+
+// Calls f(nal, size) for each NAL unit of an Annex B stream.
+template<typename F>
+static void for_each_nal(const uint8_t *data, size_t size, F f) {
+    auto start_code = [&](size_t i) {
+        return i + 3 <= size && data[i] == 0 && data[i + 1] == 0 && data[i + 2] == 1;
+    };
+
+    size_t i = 0;
+    while (i < size && !start_code(i)) {
+        i++;
+    }
+    while (i < size) {
+        const size_t begin = i + 3;
+        size_t end = begin;
+        while (end < size && !start_code(end)) {
+            end++;
+        }
+        // the zero in front of a 4 byte start code belongs to it, not to this NAL
+        size_t nal_end = end;
+        while (nal_end > begin && end < size && data[nal_end - 1] == 0) {
+            nal_end--;
+        }
+        if (nal_end > begin) {
+            f(data + begin, nal_end - begin);
+        }
+        i = end;
+    }
+}
+
+matroska_muxer::matroska_muxer(async_writer& writer_, const audio_track& audio_, size_t max_queued_bytes)
+        : writer(writer_), audio(audio_), max_queued(max_queued_bytes) {
+    mux_thread = std::thread(&matroska_muxer::mux_fun, this);
+}
+
+matroska_muxer::~matroska_muxer() {
+    {
+        std::lock_guard<std::mutex> lock(queue_mutex);
+        stopping = true;
+        queue_changed.notify_all();
+    }
+    mux_thread.join();
+    flush_cluster();
+
+    if (packets_dropped) {
+        std::cout << "Recording dropped " << packets_dropped << " packets while the disk was behind" << std::endl;
+    }
+}
+
+void matroska_muxer::queue(packet&& p) {
+    std::lock_guard<std::mutex> lock(queue_mutex);
+    if (queued_bytes + p.data.size() > max_queued) {
+        packets_dropped++;
+        return;
+    }
+    queued_bytes += p.data.size();
+    (p.track == video_track ? video_queue : audio_queue).push_back(std::move(p));
+    queue_changed.notify_one();
+}
+
+void matroska_muxer::put_video(const encoded_packet& packet) {
+    matroska_muxer::packet p{video_track, packet.timestamp, packet.keyframe, packet.width, packet.height, {}};
+    p.data.assign(packet.data, packet.data + packet.size);
+    queue(std::move(p));
+}
+
+void matroska_muxer::put_audio(const float *samples, size_t frames, std::chrono::steady_clock::time_point timestamp) {
+    if (audio.channels == 0) {
+        return;
+    }
+
+    if (audio_block.empty()) {
+        audio_block_start = timestamp;
+        audio_block.reserve(audio.sample_rate * audio.channels * sizeof(float) / 25);
+    }
+    const auto bytes = reinterpret_cast<const uint8_t *>(samples);
+    audio_block.insert(audio_block.end(), bytes, bytes + frames * audio.channels * sizeof(float));
+
+    const auto block_frames = audio_block.size() / (audio.channels * sizeof(float));
+    if (block_frames * 1000 >= audio.sample_rate * static_cast<size_t>(audio_block_duration.count())) {
+        packet p{audio_track_number, audio_block_start, true, 0, 0, std::move(audio_block)};
+        audio_block = {};
+        queue(std::move(p));
+    }
+}
+
+void matroska_muxer::mux_fun() {
+    while (true) {
+        packet p;
+        {
+            std::unique_lock<std::mutex> lock(queue_mutex);
+
+            // write in capture time order: the head of a track waits for the other track to
+            // catch up, for a while
+            auto pick = [this]() -> std::deque<packet> * {
+                const bool has_video = !video_queue.empty(), has_audio = !audio_queue.empty();
+                if (has_video && has_audio) {
+                    return video_queue.front().timestamp <= audio_queue.front().timestamp ? &video_queue : &audio_queue;
+                }
+                auto *q = has_video ? &video_queue : has_audio ? &audio_queue : nullptr;
+                const bool waits_for_audio = audio.channels > 0 && has_video;
+                if (q && (stopping || (has_video && !waits_for_audio)
+                          || q->front().timestamp + max_interleave_delay < std::chrono::steady_clock::now())) {
+                    return q;
+                }
+                return nullptr;
+            };
+
+            std::deque<packet> *q;
+            while (!(q = pick())) {
+                if (stopping && video_queue.empty() && audio_queue.empty()) {
+                    return;
+                }
+                queue_changed.wait_for(lock, std::chrono::milliseconds(100));
+            }
+            p = std::move(q->front());
+            q->pop_front();
+            queued_bytes -= p.data.size();
+        }
+
+        write(p);
+    }
+}
+
+void matroska_muxer::write_header(const packet& keyframe) {
+    // avcC from the parameter sets in front of the keyframe
+    std::vector<uint8_t> sps, pps;
+    for_each_nal(keyframe.data.data(), keyframe.data.size(), [&](const uint8_t *nal, size_t size) {
+        const int type = nal[0] & 0x1f;
+        if (type == 7 && sps.empty()) {
+            sps.assign(nal, nal + size);
+        } else if (type == 8 && pps.empty()) {
+            pps.assign(nal, nal + size);
+        }
+    });
+    std::vector<uint8_t> avcc;
+    if (sps.size() >= 4 && !pps.empty()) {
+        avcc = {1, sps[1], sps[2], sps[3], 0xff, 0xe1,
+                static_cast<uint8_t>(sps.size() >> 8), static_cast<uint8_t>(sps.size())};
+        avcc.insert(avcc.end(), sps.begin(), sps.end());
+        avcc.insert(avcc.end(), {1, static_cast<uint8_t>(pps.size() >> 8), static_cast<uint8_t>(pps.size())});
+        avcc.insert(avcc.end(), pps.begin(), pps.end());
+    }
+
+    std::vector<uint8_t> out, body;
+    put_uint(body, ebml_version, 1);
+    put_uint(body, ebml_read_version, 1);
+    put_uint(body, ebml_max_id_length, 4);
+    put_uint(body, ebml_max_size_length, 8);
+    put_string(body, doc_type, "matroska");
+    put_uint(body, doc_type_version, 4);
+    put_uint(body, doc_type_read_version, 2);
+    put_master(out, ebml_header, body);
+
+    // unknown size: the segment simply runs to the end of the file
+    put_id(out, segment);
+    out.insert(out.end(), {0x01, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff});
+
+    body.clear();
+    put_uint(body, timestamp_scale, 1000000);
+    put_string(body, muxing_app, "streamer");
+    put_string(body, writing_app, "streamer");
+    put_master(out, info, body);
+
+    std::vector<uint8_t> entries, entry, settings;
+    put_uint(entry, track_number, video_track);
+    put_uint(entry, track_uid, video_track);
+    put_uint(entry, track_type, 1);
+    put_uint(entry, flag_lacing, 0);
+    put_string(entry, codec_id, "V_MPEG4/ISO/AVC");
+    put_binary(entry, codec_private, avcc.data(), avcc.size());
+    put_uint(settings, pixel_width, keyframe.width);
+    put_uint(settings, pixel_height, keyframe.height);
+    put_master(entry, video_settings, settings);
+    put_master(entries, track_entry, entry);
+
+    if (audio.channels > 0) {
+        entry.clear();
+        settings.clear();
+        put_uint(entry, track_number, audio_track_number);
+        put_uint(entry, track_uid, audio_track_number);
+        put_uint(entry, track_type, 2);
+        put_uint(entry, flag_lacing, 0);
+        put_string(entry, codec_id, "A_PCM/FLOAT/IEEE");
+        put_float(settings, sampling_frequency, audio.sample_rate);
+        put_uint(settings, channels, audio.channels);
+        put_uint(settings, bit_depth, 32);
+        put_master(entry, audio_settings, settings);
+        put_master(entries, track_entry, entry);
+    }
+    put_master(out, tracks, entries);
+
+    writer.append(out.data(), out.size());
+}
+
+void matroska_muxer::write(const packet& p) {
+    if (ended) {
+        return;
+    }
+    if (!header_written) {
+        // a player can't start before the first keyframe, the recording doesn't either
+        if (p.track != video_track || !p.keyframe) {
+            return;
+        }
+        write_header(p);
+        base = p.timestamp;
+        width = p.width;
+        height = p.height;
+        header_written = true;
+    }
+    if (p.track == video_track && (p.width != width || p.height != height)) {
+        // the avcC and pixel size in the track header would be wrong from here on
+        flush_cluster();
+        ended = true;
+        std::cerr << "Recording ended at the switch to " << p.width << "x" << p.height
+                  << ", a Matroska recording keeps the resolution it started with" << std::endl;
+        return;
+    }
+    if (p.timestamp < base) {
+        return;
+    }
+
+    int64_t time = std::chrono::duration_cast<std::chrono::milliseconds>(p.timestamp - base).count();
+    if (cluster_time >= 0 && ((p.track == video_track && p.keyframe) || time - cluster_time > max_cluster_ms
+                              || cluster.size() > max_cluster_bytes)) {
+        flush_cluster();
+    }
+    if (cluster_time < 0) {
+        cluster_time = time;
+        put_uint(cluster, cluster_timestamp, static_cast<uint64_t>(cluster_time));
+    }
+    // a packet that waited out the interleave delay may be a little behind the cluster
+    time = std::max(time, cluster_time);
+
+    const uint8_t *payload = p.data.data();
+    size_t payload_size = p.data.size();
+    if (p.track == video_track) {
+        // Matroska stores AVC with 4 byte NAL lengths instead of start codes
+        scratch.clear();
+        for_each_nal(p.data.data(), p.data.size(), [this](const uint8_t *nal, size_t size) {
+            const uint8_t length[4] = {static_cast<uint8_t>(size >> 24), static_cast<uint8_t>(size >> 16),
+                                       static_cast<uint8_t>(size >> 8), static_cast<uint8_t>(size)};
+            scratch.insert(scratch.end(), length, length + 4);
+            scratch.insert(scratch.end(), nal, nal + size);
+        });
+        payload = scratch.data();
+        payload_size = scratch.size();
+    }
+
+    const int16_t relative = static_cast<int16_t>(time - cluster_time);
+    put_id(cluster, simple_block);
+    put_size(cluster, 4 + payload_size);
+    cluster.push_back(static_cast<uint8_t>(0x80 | p.track));
+    cluster.push_back(static_cast<uint8_t>(relative >> 8));
+    cluster.push_back(static_cast<uint8_t>(relative));
+    cluster.push_back(p.keyframe ? 0x80 : 0x00);
+    cluster.insert(cluster.end(), payload, payload + payload_size);
+}
+
+void matroska_muxer::flush_cluster() {
+    if (cluster_time < 0) {
+        return;
+    }
+
+    std::vector<uint8_t> header;
+    put_id(header, cluster_id);
+    put_size(header, cluster.size());
+    writer.append(header.data(), header.size());
+    writer.append(cluster.data(), cluster.size());
+
+    // a cluster on the disk is a cluster that survives a crash
+    writer.flush(true);
+
+    cluster.clear();
+    cluster_time = -1;
+}
@@ -0,0 +1,82 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include "async_writer.h"
+#include "h264_encoder.h"
+
+// interleaved float samples; no audio track without channels
+struct audio_track {
+    uint32_t channels = 0;
+    uint32_t sample_rate = 0;
+};
+
+// Streams H.264 video and float PCM audio into a Matroska file as it goes. The segment has an
+// unknown size and every cluster is written whole and flushed to the disk when it closes, at
+// each keyframe or after a second, so a recording cut off by a crash or power loss plays up to
+// its last cluster without any repair. Packets of both tracks queue up to a fixed amount of
+// memory and are written in capture time order by a thread of its own; the file starts at the
+// first keyframe. The track header fixes the resolution, the file ends where it changes.
+class matroska_muxer {
+public:
+    matroska_muxer(async_writer& writer, const audio_track& audio, size_t max_queued_bytes = 64 << 20);
+
+    // writes what is queued and the last cluster
+    ~matroska_muxer();
+
+    // call on the encoder thread
+    void put_video(const encoded_packet& packet);
+
+    // call on the audio thread, samples in the format of the audio track
+    void put_audio(const float *samples, size_t frames, std::chrono::steady_clock::time_point timestamp);
+
+    // packets dropped because the queue was full
+    size_t dropped() const { return packets_dropped; }
+
+private:
+    struct packet {
+        uint32_t track;
+        std::chrono::steady_clock::time_point timestamp;
+        bool keyframe;
+        uint32_t width, height;
+        std::vector<uint8_t> data;
+    };
+
+    void queue(packet&& p);
+    void mux_fun();
+    void write(const packet& p);
+    void write_header(const packet& keyframe);
+    void flush_cluster();
+
+    async_writer& writer;
+    audio_track audio;
+    size_t max_queued;
+
+    std::mutex queue_mutex;
+    std::condition_variable queue_changed;
+    std::deque<packet> video_queue;
+    std::deque<packet> audio_queue;
+    size_t queued_bytes = 0;
+    bool stopping = false;
+    std::atomic<size_t> packets_dropped{0};
+
+    // audio thread: samples collect into blocks of a few ms before they are queued
+    std::vector<uint8_t> audio_block;
+    std::chrono::steady_clock::time_point audio_block_start;
+
+    // mux thread
+    bool header_written = false;
+    bool ended = false;          // the video changed resolution
+    uint32_t width = 0, height = 0;
+    std::chrono::steady_clock::time_point base;
+    std::vector<uint8_t> cluster;
+    int64_t cluster_time = -1; // ms, -1 while no cluster is open
+    std::vector<uint8_t> scratch;
+
+    std::thread mux_thread;
+};
@@ -0,0 +1,643 @@
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <linux/errqueue.h>
+#include <netinet/in.h>
+#include <fcntl.h>
+#include <netinet/tcp.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include "jpeg_encoder.h"
+#include "mjpeg_server.h"
+
+// below this, pinning the pages costs more than copying them
+static constexpr size_t zerocopy_min_bytes = 32 * 1024;
+static constexpr size_t max_request_bytes = 8 * 1024;
+
+// file descriptors left for capture, display, recording and the rest when clients are limited
+// by the open file limit
+static constexpr size_t reserved_fds = 128;
+// how long a snapshot waits for a frame; frames only come while somebody waits
+static constexpr auto snapshot_timeout = std::chrono::seconds(5);
+// while accepting is paused for want of file descriptors, how often it tries again
+static constexpr int accept_retry_ms = 1000;
+
+static const char part_trailer[] = "\r\n";
+static const char busy[] = "HTTP/1.0 503 Service Unavailable\r\nConnection: close\r\n\r\n";
+
+mjpeg_server::mjpeg_server(uint16_t port_, int quality_, size_t max_clients_)
+        : port(port_), quality(quality_), max_clients(max_clients_) {
+    if (max_clients == 0) {
+        rlimit limit;
+        size_t files = 1024;
+        if (getrlimit(RLIMIT_NOFILE, &limit) == 0 && limit.rlim_cur != RLIM_INFINITY) {
+            files = static_cast<size_t>(limit.rlim_cur);
+        }
+        max_clients = files > 2 * reserved_fds ? files - reserved_fds : files / 2;
+    }
+    reserve_fd = open("/dev/null", O_RDONLY | O_CLOEXEC);
+
+    const int fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (fd < 0) {
+        perror("socket");
+        return;
+    }
+    const int one = 1;
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+
+    sockaddr_in address;
+    memset(&address, 0, sizeof(address));
+    address.sin_family = AF_INET;
+    address.sin_addr.s_addr = htonl(INADDR_ANY);
+    address.sin_port = htons(port);
+    if (bind(fd, reinterpret_cast<sockaddr *>(&address), sizeof(address)) != 0 || listen(fd, SOMAXCONN) != 0) {
+        perror(("Cannot listen on port " + std::to_string(port)).c_str());
+        close(fd);
+        return;
+    }
+
+    epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    wake_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    stop_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    for (int watched: {fd, wake_fd, stop_fd}) {
+        epoll_event event;
+        memset(&event, 0, sizeof(event));
+        event.events = EPOLLIN;
+        event.data.fd = watched;
+        epoll_ctl(epoll_fd, EPOLL_CTL_ADD, watched, &event);
+    }
+    listen_fd = fd;
+
+    std::thread encoder(&mjpeg_server::encode_loop, this);
+    swap(encoder, encode_thread);
+    std::thread server(&mjpeg_server::serve, this);
+    swap(server, server_thread);
+    std::cout << "Serving MJPEG on http://0.0.0.0:" << port << "/ and /snapshot" << std::endl;
+}
+
+mjpeg_server::~mjpeg_server() {
+    {
+        std::lock_guard<std::mutex> lock(pending_mutex);
+        stopping = true;
+    }
+    pending_cv.notify_one();
+    if (encode_thread.joinable()) {
+        encode_thread.join();
+    }
+    if (server_thread.joinable()) {
+        const uint64_t one = 1;
+        if (write(stop_fd, &one, sizeof(one)) < 0) {
+            perror("write");
+        }
+        server_thread.join();
+    }
+
+    for (auto& entry: connections) {
+        close(entry.first);
+    }
+    if (listen_fd >= 0) {
+        std::cout << "HTTP: sent " << served << " frames, skipped " << skipped << " for slow clients";
+        if (failed_encodes) {
+            std::cout << ", " << failed_encodes << " frames couldn't be encoded";
+        }
+        std::cout << std::endl;
+        close(listen_fd);
+    }
+    for (int fd: {epoll_fd, wake_fd, stop_fd, reserve_fd}) {
+        if (fd >= 0) {
+            close(fd);
+        }
+    }
+}
+
+void mjpeg_server::push(const video_frame& frame) {
+    if (!wanted.load(std::memory_order_relaxed) || !frame.data) {
+        return;
+    }
+
+    // an encoder still busy with the last one gets the newest once it is done
+    std::lock_guard<std::mutex> lock(pending_mutex);
+    pending_data.assign(frame.data, frame.data + frame.size);
+    pending = frame;
+    pending.data = pending_data.data();
+    have_pending = true;
+    pending_cv.notify_one();
+}
+
+void mjpeg_server::encode_loop() {
+    jpeg_encoder encoder(quality);
+    std::vector<uint8_t> data;
+    while (true) {
+        video_frame frame;
+        {
+            std::unique_lock<std::mutex> lock(pending_mutex);
+            pending_cv.wait(lock, [this]() { return have_pending || stopping; });
+            if (stopping) {
+                return;
+            }
+            swap(data, pending_data);
+            frame = pending;
+            frame.data = data.data();
+            have_pending = false;
+        }
+
+        auto encoded = std::make_shared<http_frame>();
+        if (frame.pixel_format == V4L2_PIX_FMT_MJPEG) {
+            // what the camera compressed goes out as it is
+            data.resize(frame.size);
+            encoded->jpeg = std::move(data);
+            data = std::vector<uint8_t>();
+        } else if (!encoder.encode(frame, encoded->jpeg)) {
+            failed_encodes++;
+            continue;
+        }
+        encoded->part_header = "--frame\r\nContent-Type: image/jpeg\r\nContent-Length: "
+                               + std::to_string(encoded->jpeg.size()) + "\r\n\r\n";
+
+        {
+            std::lock_guard<std::mutex> lock(latest_mutex);
+            latest = std::move(encoded);
+        }
+        const uint64_t one = 1;
+        if (write(wake_fd, &one, sizeof(one)) < 0) {
+            perror("write");
+        }
+    }
+}
+
+void mjpeg_server::serve() {
+    epoll_event events[64];
+    while (true) {
+        const int n = epoll_wait(epoll_fd, events, 64, next_timeout());
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            perror("epoll_wait");
+            return;
+        }
+
+        for (int i = 0; i < n; i++) {
+            const int fd = events[i].data.fd;
+            if (fd == stop_fd) {
+                return;
+            }
+            if (fd == listen_fd) {
+                accept_clients();
+                continue;
+            }
+            if (fd == wake_fd) {
+                frame_ready();
+                continue;
+            }
+
+            auto it = connections.find(fd);
+            if (it == connections.end()) {
+                continue;
+            }
+            auto& c = it->second;
+            const auto ready = events[i].events;
+            bool alive = true;
+            if (ready & EPOLLERR) {
+                alive = zerocopy_done(c);
+            }
+            if (alive && (ready & (EPOLLIN | EPOLLHUP))) {
+                alive = read_request(c);
+            }
+            if (alive && (ready & EPOLLOUT)) {
+                alive = flush(c);
+            }
+            if (!alive) {
+                close_connection(fd);
+            }
+        }
+        if (accept_paused && std::chrono::steady_clock::now() - paused_at >= std::chrono::milliseconds(accept_retry_ms)) {
+            pause_accepting(false);
+        }
+        expire_snapshots();
+    }
+}
+
+// Until the next snapshot deadline, or the next try at accepting; -1 for nothing to wait for.
+int mjpeg_server::next_timeout() const {
+    int timeout = accept_paused ? accept_retry_ms : -1;
+    if (waiting_snapshots == 0) {
+        return timeout;
+    }
+    const auto now = std::chrono::steady_clock::now();
+    for (const auto& entry: connections) {
+        const auto& c = entry.second;
+        if (c.st == connection::state::snapshot && !c.sending && !c.next && c.head.empty()) {
+            const auto left = std::chrono::duration_cast<std::chrono::milliseconds>(c.deadline - now).count() + 1;
+            const int ms = static_cast<int>(std::max<int64_t>(left, 0));
+            timeout = timeout < 0 ? ms : std::min(timeout, ms);
+        }
+    }
+    return timeout;
+}
+
+// Snapshots that got no frame in time are told so.
+void mjpeg_server::expire_snapshots() {
+    if (waiting_snapshots == 0) {
+        return;
+    }
+    const auto now = std::chrono::steady_clock::now();
+    std::vector<int> dead;
+    for (auto& entry: connections) {
+        auto& c = entry.second;
+        if (c.st == connection::state::snapshot && !c.sending && !c.next && c.head.empty() && now >= c.deadline) {
+            waiting_snapshots--;
+            c.head = busy;
+            c.st = connection::state::closing;
+            if (!flush(c)) {
+                dead.push_back(entry.first);
+            }
+        }
+    }
+    for (int fd: dead) {
+        close_connection(fd);
+    }
+    update_wanted();
+}
+
+void mjpeg_server::accept_clients() {
+    while (true) {
+        const int fd = accept4(listen_fd, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (fd < 0) {
+            if (errno == EMFILE || errno == ENFILE) {
+                // the client would stay in the backlog and the listener readable for good
+                if (!reject_one()) {
+                    pause_accepting(true);
+                    return;
+                }
+                continue;
+            }
+            if (errno != EAGAIN && errno != EINTR && errno != ECONNABORTED) {
+                perror("accept");
+            }
+            if (errno != EINTR && errno != ECONNABORTED) {
+                return;
+            }
+            continue;
+        }
+
+        if (connections.size() >= max_clients) {
+            send(fd, busy, sizeof(busy) - 1, MSG_DONTWAIT | MSG_NOSIGNAL);
+            close(fd);
+            continue;
+        }
+
+        // the end of each frame shouldn't wait for an ack
+        const int one = 1;
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+        epoll_event event;
+        memset(&event, 0, sizeof(event));
+        event.events = EPOLLIN;
+        event.data.fd = fd;
+        epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &event);
+
+        connection c;
+        c.fd = fd;
+#ifdef SO_ZEROCOPY
+        c.zerocopy = setsockopt(fd, SOL_SOCKET, SO_ZEROCOPY, &one, sizeof(one)) == 0;
+#endif
+        connections.emplace(fd, std::move(c));
+    }
+}
+
+// Out of file descriptors: gives up the reserve one to accept a client and turn it away. False
+// when that didn't work either.
+bool mjpeg_server::reject_one() {
+    if (reserve_fd < 0) {
+        return false;
+    }
+    close(reserve_fd);
+    const int fd = accept4(listen_fd, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+    if (fd >= 0) {
+        send(fd, busy, sizeof(busy) - 1, MSG_DONTWAIT | MSG_NOSIGNAL);
+        close(fd);
+    }
+    reserve_fd = open("/dev/null", O_RDONLY | O_CLOEXEC);
+    return fd >= 0 && reserve_fd >= 0;
+}
+
+// Stops watching the listener while no client can be accepted; serve() tries again after a
+// while or once a client is gone.
+void mjpeg_server::pause_accepting(bool pause) {
+    if (accept_paused == pause) {
+        return;
+    }
+    if (pause) {
+        std::cerr << "HTTP: out of file descriptors, not accepting clients for now" << std::endl;
+        paused_at = std::chrono::steady_clock::now();
+    }
+    epoll_event event;
+    memset(&event, 0, sizeof(event));
+    event.events = pause ? 0 : EPOLLIN;
+    event.data.fd = listen_fd;
+    epoll_ctl(epoll_fd, EPOLL_CTL_MOD, listen_fd, &event);
+    accept_paused = pause;
+}
+
+// false once the client is gone
+bool mjpeg_server::read_request(connection& c) {
+    char buffer[4096];
+    while (true) {
+        const ssize_t n = recv(c.fd, buffer, sizeof(buffer), MSG_DONTWAIT);
+        if (n == 0) {
+            return false;
+        }
+        if (n < 0) {
+            return errno == EAGAIN || errno == EINTR;
+        }
+        if (c.st != connection::state::request) {
+            // nothing more is expected; whatever comes is read so the socket doesn't clog
+            continue;
+        }
+
+        c.request.append(buffer, static_cast<size_t>(n));
+        const size_t end = c.request.find("\r\n\r\n");
+        if (end == std::string::npos) {
+            if (c.request.size() > max_request_bytes) {
+                return false;
+            }
+            continue;
+        }
+
+        // GET <path>[?query] HTTP/1.x
+        const std::string line = c.request.substr(0, c.request.find("\r\n"));
+        const size_t method_end = line.find(' ');
+        const size_t path_end = line.find(' ', method_end + 1);
+        if (method_end == std::string::npos || path_end == std::string::npos) {
+            return false;
+        }
+        const std::string method = line.substr(0, method_end);
+        std::string path = line.substr(method_end + 1, path_end - method_end - 1);
+        path = path.substr(0, path.find('?'));
+        c.request.clear();
+
+        if (method != "GET") {
+            c.head = "HTTP/1.0 405 Method Not Allowed\r\nAllow: GET\r\nContent-Length: 0\r\nConnection: close\r\n\r\n";
+            c.st = connection::state::closing;
+        } else {
+            start_response(c, path);
+        }
+        if (!flush(c)) {
+            return false;
+        }
+    }
+}
+
+void mjpeg_server::start_response(connection& c, const std::string& path) {
+    // frames only come while somebody waits for them, so the last one may be from long ago
+    std::shared_ptr<const http_frame> current;
+    if (streams > 0) {
+        std::lock_guard<std::mutex> lock(latest_mutex);
+        current = latest;
+    }
+
+    if (path == "/" || path == "/stream") {
+        c.st = connection::state::stream;
+        c.head = "HTTP/1.0 200 OK\r\n"
+                 "Content-Type: multipart/x-mixed-replace; boundary=frame\r\n"
+                 "Cache-Control: no-cache, no-store\r\n"
+                 "Pragma: no-cache\r\n"
+                 "Connection: close\r\n\r\n";
+        c.next = current;
+        streams++;
+    } else if (path == "/snapshot" || path == "/snapshot.jpg") {
+        c.st = connection::state::snapshot;
+        c.next = current;
+        if (!current) {
+            c.deadline = std::chrono::steady_clock::now() + snapshot_timeout;
+            waiting_snapshots++;
+        }
+    } else {
+        c.head = "HTTP/1.0 404 Not Found\r\nContent-Length: 0\r\nConnection: close\r\n\r\n";
+        c.st = connection::state::closing;
+    }
+    update_wanted();
+}
+
+// Writes as much as the socket takes, then waits for EPOLLOUT. False once the client is gone.
+bool mjpeg_server::flush(connection& c) {
+    while (true) {
+        if (!c.sending && c.head.empty()) {
+            if (!c.next || c.st == connection::state::closing) {
+                poll_out(c, false);
+                return true;
+            }
+            c.sending = std::move(c.next);
+            c.next.reset();
+            c.sent = 0;
+            if (c.st == connection::state::snapshot) {
+                c.head = "HTTP/1.0 200 OK\r\nContent-Type: image/jpeg\r\nContent-Length: "
+                         + std::to_string(c.sending->jpeg.size())
+                         + "\r\nCache-Control: no-cache, no-store\r\nConnection: close\r\n\r\n";
+            }
+        }
+
+        iovec parts[4];
+        size_t count = 0;
+        if (!c.head.empty()) {
+            parts[count++] = {const_cast<char *>(c.head.data()), c.head.size()};
+        }
+        if (c.sending) {
+            const auto& f = *c.sending;
+            if (c.st == connection::state::stream) {
+                parts[count++] = {const_cast<char *>(f.part_header.data()), f.part_header.size()};
+            }
+            parts[count++] = {const_cast<uint8_t *>(f.jpeg.data()), f.jpeg.size()};
+            if (c.st == connection::state::stream) {
+                parts[count++] = {const_cast<char *>(part_trailer), sizeof(part_trailer) - 1};
+            }
+        }
+
+        // skip what went out already
+        size_t total = 0;
+        for (size_t i = 0; i < count; i++) {
+            total += parts[i].iov_len;
+        }
+        size_t skip = c.sent, first = 0;
+        while (skip >= parts[first].iov_len) {
+            skip -= parts[first++].iov_len;
+        }
+        parts[first].iov_base = static_cast<uint8_t *>(parts[first].iov_base) + skip;
+        parts[first].iov_len -= skip;
+
+        msghdr message;
+        memset(&message, 0, sizeof(message));
+        message.msg_iov = parts + first;
+        message.msg_iovlen = count - first;
+
+        // the connection's own header may change under a zero copy send, the shared frame can't
+        int flags = MSG_DONTWAIT | MSG_NOSIGNAL;
+        bool zerocopy = false;
+#ifdef MSG_ZEROCOPY
+        zerocopy = c.zerocopy && c.head.empty() && total - c.sent >= zerocopy_min_bytes;
+        if (zerocopy) {
+            flags |= MSG_ZEROCOPY;
+        }
+#endif
+        const ssize_t n = sendmsg(c.fd, &message, flags);
+        if (n < 0) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                poll_out(c, true);
+                return true;
+            }
+            if (errno == EINTR) {
+                continue;
+            }
+            if (errno == ENOBUFS && zerocopy) {
+                // out of optmem for the notifications, copy instead
+                c.zerocopy = false;
+                continue;
+            }
+            return false;
+        }
+        if (zerocopy) {
+            c.in_flight.emplace_back(c.zerocopy_id++, c.sending);
+        }
+
+        c.sent += static_cast<size_t>(n);
+        if (c.sent < total) {
+            continue;
+        }
+
+        const bool had_frame = c.sending != nullptr;
+        c.head.clear();
+        c.sending.reset();
+        c.sent = 0;
+        if (had_frame) {
+            served++;
+        }
+        if (c.st == connection::state::closing || (c.st == connection::state::snapshot && had_frame)) {
+            // the client closes once it has everything; closing first could reset the connection
+            c.st = connection::state::closing;
+            shutdown(c.fd, SHUT_WR);
+            poll_out(c, false);
+            return true;
+        }
+    }
+}
+
+void mjpeg_server::poll_out(connection& c, bool enable) {
+    if (c.polling_out == enable) {
+        return;
+    }
+    epoll_event event;
+    memset(&event, 0, sizeof(event));
+    event.events = EPOLLIN | (enable ? EPOLLOUT : 0);
+    event.data.fd = c.fd;
+    epoll_ctl(epoll_fd, EPOLL_CTL_MOD, c.fd, &event);
+    c.polling_out = enable;
+}
+
+// Drains the error queue, where the kernel reports finished zero copy sends. False when it
+// held a real error instead.
+bool mjpeg_server::zerocopy_done(connection& c) {
+    while (true) {
+        alignas(cmsghdr) char control[128];
+        msghdr message;
+        memset(&message, 0, sizeof(message));
+        message.msg_control = control;
+        message.msg_controllen = sizeof(control);
+        if (recvmsg(c.fd, &message, MSG_ERRQUEUE | MSG_DONTWAIT) < 0) {
+            int error = 0;
+            socklen_t length = sizeof(error);
+            getsockopt(c.fd, SOL_SOCKET, SO_ERROR, &error, &length);
+            return (errno == EAGAIN || errno == EINTR) && error == 0;
+        }
+
+        for (cmsghdr *cmsg = CMSG_FIRSTHDR(&message); cmsg; cmsg = CMSG_NXTHDR(&message, cmsg)) {
+            if (!((cmsg->cmsg_level == SOL_IP && cmsg->cmsg_type == IP_RECVERR)
+                  || (cmsg->cmsg_level == SOL_IPV6 && cmsg->cmsg_type == IPV6_RECVERR))) {
+                continue;
+            }
+            const auto error = reinterpret_cast<const sock_extended_err *>(CMSG_DATA(cmsg));
+            if (error->ee_errno != 0 || error->ee_origin != SO_EE_ORIGIN_ZEROCOPY) {
+                return false;
+            }
+
+            // sends ee_info to ee_data are done with their frames
+            while (!c.in_flight.empty() && static_cast<int32_t>(c.in_flight.front().first - error->ee_data) <= 0) {
+                c.in_flight.pop_front();
+            }
+            if (error->ee_code & SO_EE_CODE_ZEROCOPY_COPIED) {
+                // the kernel copied after all, as it does over loopback; skip the bookkeeping
+                c.zerocopy = false;
+            }
+        }
+    }
+}
+
+void mjpeg_server::close_connection(int fd) {
+    auto it = connections.find(fd);
+    if (it == connections.end()) {
+        return;
+    }
+    const auto& c = it->second;
+    if (c.st == connection::state::stream) {
+        streams--;
+    } else if (c.st == connection::state::snapshot && !c.sending && !c.next && c.head.empty()) {
+        waiting_snapshots--;
+    }
+
+    // frames still in flight for a zero copy send are only dropped with the socket
+    epoll_ctl(epoll_fd, EPOLL_CTL_DEL, fd, nullptr);
+    close(fd);
+    connections.erase(it);
+    pause_accepting(false);
+    update_wanted();
+}
+
+void mjpeg_server::frame_ready() {
+    uint64_t count;
+    if (read(wake_fd, &count, sizeof(count)) < 0) {
+        return;
+    }
+    std::shared_ptr<const http_frame> frame;
+    {
+        std::lock_guard<std::mutex> lock(latest_mutex);
+        frame = latest;
+    }
+    if (!frame) {
+        return;
+    }
+
+    std::vector<int> dead;
+    for (auto& entry: connections) {
+        auto& c = entry.second;
+        if (c.st == connection::state::stream) {
+            if (c.next) {
+                // still busy with an older frame: only the newest is worth sending next
+                skipped++;
+            }
+            c.next = frame;
+        } else if (c.st == connection::state::snapshot && !c.sending && !c.next && c.head.empty()) {
+            c.next = frame;
+            waiting_snapshots--;
+        } else {
+            continue;
+        }
+
+        // a client waiting for the socket to drain picks the frame up from there
+        if (!c.polling_out && !flush(c)) {
+            dead.push_back(entry.first);
+        }
+    }
+    for (int fd: dead) {
+        close_connection(fd);
+    }
+    update_wanted();
+}
+
+void mjpeg_server::update_wanted() {
+    wanted = streams + waiting_snapshots > 0;
+}
@@ -0,0 +1,114 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+#include "video_frame.h"
+
+// An encoded frame, shared by every client sending it and never changed once published.
+struct http_frame {
+    std::string part_header; // multipart boundary and part headers
+    std::vector<uint8_t> jpeg;
+};
+
+// Serves the video as multipart/x-mixed-replace MJPEG on /, and single JPEGs on /snapshot.
+// Each frame is encoded once, or passed through when the camera sends MJPEG, and all clients
+// send from the same buffer. A client holds at most the frame it is sending and the newest one
+// after it, so one that can't keep up skips frames and never holds up the others.
+//
+// push() runs on the capture thread and only copies; JPEG encoding has a thread of its own and
+// an epoll loop on another does all the networking.
+class mjpeg_server {
+public:
+    // max_clients: 0 for what the open file limit leaves room for
+    mjpeg_server(uint16_t port, int quality, size_t max_clients = 0);
+    ~mjpeg_server();
+
+    bool is_open() const { return listen_fd >= 0; }
+
+    // call on the producer thread, e.g. from a frame sink; returns right away while nobody watches
+    void push(const video_frame& frame);
+
+private:
+    struct connection {
+        enum class state {
+            request,  // reading the request
+            stream,   // sending frames until the client goes
+            snapshot, // sending one frame, then closing
+            closing,  // everything sent, waiting for the client to close
+        };
+        int fd;
+        state st = state::request;
+        std::string request;
+        std::string head; // response header, goes out before the first frame
+        std::shared_ptr<const http_frame> sending;
+        std::shared_ptr<const http_frame> next;
+        size_t sent = 0;   // bytes of head and sending already written
+        bool polling_out = false;
+        std::chrono::steady_clock::time_point deadline; // of a snapshot waiting for its frame
+
+        // MSG_ZEROCOPY sends read the frame after sendmsg returns, it is kept until the
+        // kernel reports them done
+        bool zerocopy = false;
+        uint32_t zerocopy_id = 0;
+        std::deque<std::pair<uint32_t, std::shared_ptr<const http_frame>>> in_flight;
+    };
+
+    void encode_loop();
+    void serve();
+    void accept_clients();
+    bool reject_one();
+    void pause_accepting(bool pause);
+    int next_timeout() const;
+    void expire_snapshots();
+    bool read_request(connection& c);
+    void start_response(connection& c, const std::string& path);
+    bool flush(connection& c);
+    void poll_out(connection& c, bool enable);
+    bool zerocopy_done(connection& c);
+    void close_connection(int fd);
+    void frame_ready();
+    void update_wanted();
+
+    uint16_t port;
+    int quality;
+    size_t max_clients;
+    int listen_fd = -1;
+    int epoll_fd = -1;
+    int wake_fd = -1;
+    int stop_fd = -1;
+    int reserve_fd = -1;          // given up to turn a client away when out of file descriptors
+    bool accept_paused = false;
+    std::chrono::steady_clock::time_point paused_at;
+    std::thread encode_thread;
+    std::thread server_thread;
+
+    // capture thread to encoder: the newest frame not encoded yet
+    std::mutex pending_mutex;
+    std::condition_variable pending_cv;
+    std::vector<uint8_t> pending_data;
+    video_frame pending;
+    bool have_pending = false;
+    bool stopping = false;
+    std::atomic<bool> wanted{false}; // somebody waits for frames
+
+    // encoder to the server loop
+    std::mutex latest_mutex;
+    std::shared_ptr<const http_frame> latest;
+
+    // owned by the server loop
+    std::unordered_map<int, connection> connections;
+    size_t streams = 0;
+    size_t waiting_snapshots = 0;
+    uint64_t served = 0;
+    uint64_t skipped = 0;
+    uint64_t failed_encodes = 0;
+};
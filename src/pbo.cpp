@@ -4,6 +4,9 @@
 #include <cstring>
 #include "streamer.h"
 #include "pbo.h"
+#include "pixel_convert.h"
+#include "program_cache.h"
+#include "fps_counter.h"
 #include <glm/mat4x4.hpp>
 #include <glm/gtc/matrix_transform.hpp>
 #include <glm/gtc/type_ptr.hpp>
@@ -55,7 +58,7 @@ const char *fragment_shader_text =
 GLuint create_program(const char *vertexSrc,
                       const char *fragmentSrc);
 
-pbo::pbo(streamer *e, int w, int h) : eng(e), width(w), height(h) {
+pbo::pbo(streamer *e, int w, int h, upload_format f) : eng(e), width(w), height(h), format(f) {
 
     //buffers
     glGenVertexArrays(1, &vao_id);
@@ -91,7 +94,7 @@ pbo::pbo(streamer *e, int w, int h) : eng(e), width(w), height(h) {
     glBindTexture(GL_TEXTURE_2D, tex_id);
     glTexImage2D(GL_TEXTURE_2D,
                  0,
-                 GL_RGB,
+                 format == upload_format::bgra ? GL_RGBA8 : GL_RGB8,
                  width,
                  height,
                  0,
@@ -165,26 +168,172 @@ void pbo::draw() {
 }
 
 
-void pbo::fill(unsigned char *src) {
-    if (src == nullptr) return;
+// Describes a padded line stride to GL so the buffer uploads as is: either the padding matches
+// what GL_UNPACK_ALIGNMENT adds to tight rows, or the stride is a whole number of pixels for
+// GL_UNPACK_ROW_LENGTH. Returns false when the rows have to be repacked.
+static bool unpack_layout(uint32_t stride, uint32_t bpp, int width, GLint& row_length, GLint& alignment) {
+    const uint32_t row_bytes = width * bpp;
+    for (GLint a: {8, 4, 2, 1}) {
+        if (stride % a == 0 && (row_bytes + a - 1) / a * a == stride) {
+            row_length = 0;
+            alignment = a;
+            return true;
+        }
+    }
 
-    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, pbo_ids[pbo_i]);
-    {
-        // send to texture
-        glBindTexture(GL_TEXTURE_2D, tex_id);
-        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB8, width, height, 0, GL_RGB, GL_UNSIGNED_BYTE, nullptr);
-        glBindTexture(GL_TEXTURE_2D, 0);
+    if (stride % bpp == 0) {
+        row_length = stride / bpp;
+        alignment = 1;
+        return true;
+    }
+    return false;
+}
+
+void pbo::fill(const video_frame& frame) {
+    if (frame.data == nullptr) return;
+
+    const uint32_t src_bpp = bytes_per_pixel(frame.pixel_format);
+    const bool rgb_source = frame.pixel_format == V4L2_PIX_FMT_RGB24;
+    const bool bgrx_source = frame.pixel_format == V4L2_PIX_FMT_XBGR32 || frame.pixel_format == V4L2_PIX_FMT_BGR32;
+
+    if ((!rgb_source && !bgrx_source) || frame.width != (uint32_t) width || frame.height != (uint32_t) height) {
+        if (!warned_format) {
+            std::cerr << "Can't upload " << frame.width << "x" << frame.height << " "
+                      << fourcc_to_string(frame.pixel_format) << " frames into a " << width << "x" << height << " texture" << std::endl;
+            warned_format = true;
+        }
+        return;
+    }
+
+    const uint32_t src_row_bytes = width * src_bpp;
+    const uint32_t stride = frame.planes[0].stride;
+    const uint8_t *src = frame.data + frame.planes[0].offset;
+
+    // the last line needs no padding, some drivers leave it out of the image size
+    const size_t src_size = static_cast<size_t>(stride) * (height - 1) + src_row_bytes;
+    if (frame.planes[0].offset + src_size > frame.size) {
+        return;
     }
-    //glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
 
+    // RGB24 frames headed for a BGRA texture get expanded row by row into tight 4 byte texels
+    const bool expand = rgb_source && format == upload_format::bgra;
+    const uint32_t upload_bpp = expand ? 4 : src_bpp;
+    const GLenum gl_format = upload_bpp == 4 ? GL_BGRA : GL_RGB;
+    const GLenum gl_type = upload_bpp == 4 ? GL_UNSIGNED_INT_8_8_8_8_REV : GL_UNSIGNED_BYTE;
+
+    GLint row_length = 0, alignment = 4;
+    const bool direct = !expand && unpack_layout(stride, src_bpp, width, row_length, alignment);
+    if (!direct && !expand) {
+        alignment = 1;
+    }
+
+    // Alternate between the two PBOs so mapping never waits on the transfer still reading
+    // the other one, but upload the frame we just copied: it is on screen right after this call
+    // instead of one fill() later.
     pbo_i = (pbo_i + 1) % 2;
     glBindBuffer(GL_PIXEL_UNPACK_BUFFER, pbo_ids[pbo_i]);
     {
+        const size_t pbo_size = direct ? static_cast<size_t>(stride) * height : static_cast<size_t>(width) * upload_bpp * height;
+
+        // orphan the previous storage so the map doesn't synchronize with the GPU
+        glBufferData(GL_PIXEL_UNPACK_BUFFER, pbo_size, nullptr, GL_STREAM_DRAW);
         auto mapped_buffer = (unsigned char *) glMapBuffer(GL_PIXEL_UNPACK_BUFFER, GL_WRITE_ONLY);
-        memcpy(mapped_buffer, src, width * height * 3);
+        if (direct) {
+            memcpy(mapped_buffer, src, src_size);
+        } else if (expand && stride == src_row_bytes) {
+            rgb24_to_bgrx32(src, mapped_buffer, static_cast<size_t>(width) * height);
+        } else {
+            for (int y = 0; y < height; y++) {
+                auto *dst_row = mapped_buffer + static_cast<size_t>(y) * width * upload_bpp;
+                auto *src_row = src + static_cast<size_t>(y) * stride;
+                if (expand) {
+                    rgb24_to_bgrx32(src_row, dst_row, width);
+                } else {
+                    memcpy(dst_row, src_row, src_row_bytes);
+                }
+            }
+        }
         glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
     }
-    //glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+    {
+        // send to texture
+        glPixelStorei(GL_UNPACK_ALIGNMENT, alignment);
+        glPixelStorei(GL_UNPACK_ROW_LENGTH, row_length);
+
+        glBindTexture(GL_TEXTURE_2D, tex_id);
+        glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, width, height, gl_format, gl_type, nullptr);
+        glBindTexture(GL_TEXTURE_2D, 0);
+
+        glPixelStorei(GL_UNPACK_ROW_LENGTH, 0);
+        glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+    }
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+}
+
+upload_format pbo::benchmark_upload_formats(int width, int height) {
+    const int iterations = 20;
+    const std::vector<uint8_t> frame(static_cast<size_t>(width) * height * 3, 0x80);
+
+    auto measure = [&](upload_format f) {
+        const bool bgra = f == upload_format::bgra;
+        const size_t size = static_cast<size_t>(width) * height * (bgra ? 4 : 3);
+
+        GLuint tex, buffer;
+        glGenTextures(1, &tex);
+        glBindTexture(GL_TEXTURE_2D, tex);
+        glTexImage2D(GL_TEXTURE_2D, 0, bgra ? GL_RGBA8 : GL_RGB8, width, height, 0, GL_RGB, GL_UNSIGNED_BYTE, nullptr);
+        glGenBuffers(1, &buffer);
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, buffer);
+        glPixelStorei(GL_UNPACK_ALIGNMENT, bgra ? 4 : 1);
+
+        timer t;
+        float elapsed = 0;
+        // the first two rounds warm up the driver and aren't counted
+        for (int i = 0; i < iterations + 2; i++) {
+            t.lap();
+            glBufferData(GL_PIXEL_UNPACK_BUFFER, size, nullptr, GL_STREAM_DRAW);
+            auto mapped = (uint8_t *) glMapBuffer(GL_PIXEL_UNPACK_BUFFER, GL_WRITE_ONLY);
+            if (bgra) {
+                rgb24_to_bgrx32(frame.data(), mapped, static_cast<size_t>(width) * height);
+            } else {
+                memcpy(mapped, frame.data(), size);
+            }
+            glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+            glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, width, height,
+                            bgra ? GL_BGRA : GL_RGB, bgra ? GL_UNSIGNED_INT_8_8_8_8_REV : GL_UNSIGNED_BYTE, nullptr);
+            glFinish();
+            if (i >= 2) {
+                elapsed += t.lap();
+            }
+        }
+
+        glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+        glDeleteBuffers(1, &buffer);
+        glBindTexture(GL_TEXTURE_2D, 0);
+        glDeleteTextures(1, &tex);
+
+        return elapsed * 1000.0f / iterations;
+    };
+
+    const float rgb_ms = measure(upload_format::rgb);
+    const float bgra_ms = measure(upload_format::bgra);
+    std::cout << "Upload benchmark " << width << "x" << height << ": RGB " << rgb_ms << " ms, BGRA " << bgra_ms
+              << " ms per frame" << std::endl;
+
+    return bgra_ms < rgb_ms ? upload_format::bgra : upload_format::rgb;
+}
+
+void pbo::resize(int w, int h) {
+    width = w;
+    height = h;
+    warned_format = false;
+
+    // the PBOs get respecified to the frame size on every fill
+    glBindTexture(GL_TEXTURE_2D, tex_id);
+    glTexImage2D(GL_TEXTURE_2D, 0, format == upload_format::bgra ? GL_RGBA8 : GL_RGB8, width, height, 0,
+                 GL_RGB, GL_UNSIGNED_BYTE, nullptr);
+    glBindTexture(GL_TEXTURE_2D, 0);
 }
 
 void pbo::toggle_texture_filtering() const {
@@ -204,6 +353,10 @@ void pbo::toggle_texture_filtering() const {
 
 GLuint create_program(const char *vertexSrc,
                       const char *fragmentSrc) {
+    if (GLuint cached = load_program_binary(vertexSrc, fragmentSrc)) {
+        return cached;
+    }
+
     // Create the shaders
     GLuint vs = glCreateShader(GL_VERTEX_SHADER);
     GLuint fs = glCreateShader(GL_FRAGMENT_SHADER);
@@ -239,6 +392,10 @@ GLuint create_program(const char *vertexSrc,
     GLuint program = glCreateProgram();
     glAttachShader(program, vs);
     glAttachShader(program, fs);
+    const bool cacheable = program_binaries_supported();
+    if (cacheable) {
+        glProgramParameteri(program, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+    }
     glLinkProgram(program);
 
     // Check the program
@@ -250,6 +407,10 @@ GLuint create_program(const char *vertexSrc,
         std::cout << &errmsg[0] << std::endl;
     }
 
+    if (cacheable && res == GL_TRUE) {
+        save_program_binary(program, vertexSrc, fragmentSrc);
+    }
+
     glDeleteShader(vs);
     glDeleteShader(fs);
 
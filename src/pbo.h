@@ -1,16 +1,31 @@
 #pragma once
 
+#include "video_frame.h"
+
 class streamer;
 
+enum class upload_format {
+    automatic,  // benchmark both at startup and keep the faster one
+    rgb,        // GL_RGB/GL_UNSIGNED_BYTE, 3 byte texels
+    bgra,       // GL_BGRA/GL_UNSIGNED_INT_8_8_8_8_REV, RGB24 frames get expanded on upload
+};
+
 class pbo {
 
 public:
-	explicit pbo(streamer* e, int width, int height);
+	explicit pbo(streamer* e, int width, int height, upload_format format = upload_format::rgb);
 	~pbo();
 
-	void fill(unsigned char* src);
+    // Times PBO uploads of a width x height RGB24 frame in each format, CPU side included, and
+    // returns the faster one. Needs a current GL context.
+    static upload_format benchmark_upload_formats(int width, int height);
+
+	void fill(const video_frame& frame);
 	void draw();
 
+    // reallocates the texture for frames of a new size
+    void resize(int width, int height);
+
 	uint tex_id;
 
     void toggle_texture_filtering() const;
@@ -28,10 +43,13 @@ private:
     int32_t tex_loc;
 
     int width, height;
+    upload_format format;
 
 	uint32_t pbo_ids[2];
 	int pbo_i;
 	uint8_t* buffers_data;
 	uint8_t* buffers[2];
+
+    bool warned_format = false;
 };
 
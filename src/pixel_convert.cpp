@@ -0,0 +1,304 @@
+#include <cstring>
+#include "pixel_convert.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define HAVE_SSSE3_PATH 1
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
+static void rgb24_to_bgrx32_scalar(const uint8_t *src, uint8_t *dst, size_t pixels) {
+    for (size_t i = 0; i < pixels; i++) {
+        dst[0] = src[2];
+        dst[1] = src[1];
+        dst[2] = src[0];
+        dst[3] = 0xff;
+        src += 3;
+        dst += 4;
+    }
+}
+
+#ifdef HAVE_SSSE3_PATH
+__attribute__((target("ssse3")))
+static void rgb24_to_bgrx32_ssse3(const uint8_t *src, uint8_t *dst, size_t pixels) {
+    // one shuffle turns 4 RGB pixels (12 bytes) into 4 BGRX pixels (16 bytes)
+    const __m128i shuffle = _mm_setr_epi8(2, 1, 0, -1, 5, 4, 3, -1, 8, 7, 6, -1, 11, 10, 9, -1);
+    const __m128i alpha = _mm_set1_epi32(static_cast<int>(0xff000000));
+
+    size_t i = 0;
+    for (; i + 16 <= pixels; i += 16) {
+        const __m128i a = _mm_loadu_si128(reinterpret_cast<const __m128i *>(src));
+        const __m128i b = _mm_loadu_si128(reinterpret_cast<const __m128i *>(src + 16));
+        const __m128i c = _mm_loadu_si128(reinterpret_cast<const __m128i *>(src + 32));
+
+        const __m128i p0 = a;
+        const __m128i p1 = _mm_alignr_epi8(b, a, 12);
+        const __m128i p2 = _mm_alignr_epi8(c, b, 8);
+        const __m128i p3 = _mm_srli_si128(c, 4);
+
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(dst), _mm_or_si128(_mm_shuffle_epi8(p0, shuffle), alpha));
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(dst + 16), _mm_or_si128(_mm_shuffle_epi8(p1, shuffle), alpha));
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(dst + 32), _mm_or_si128(_mm_shuffle_epi8(p2, shuffle), alpha));
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(dst + 48), _mm_or_si128(_mm_shuffle_epi8(p3, shuffle), alpha));
+
+        src += 48;
+        dst += 64;
+    }
+
+    rgb24_to_bgrx32_scalar(src, dst, pixels - i);
+}
+#endif
+
+void rgb24_to_bgrx32(const uint8_t *src, uint8_t *dst, size_t pixels) {
+#if defined(HAVE_SSSE3_PATH)
+    static const bool has_ssse3 = __builtin_cpu_supports("ssse3");
+    if (has_ssse3) {
+        rgb24_to_bgrx32_ssse3(src, dst, pixels);
+        return;
+    }
+#elif defined(__ARM_NEON)
+    size_t i = 0;
+    for (; i + 16 <= pixels; i += 16) {
+        const uint8x16x3_t rgb = vld3q_u8(src);
+        uint8x16x4_t bgrx;
+        bgrx.val[0] = rgb.val[2];
+        bgrx.val[1] = rgb.val[1];
+        bgrx.val[2] = rgb.val[0];
+        bgrx.val[3] = vdupq_n_u8(0xff);
+        vst4q_u8(dst, bgrx);
+        src += 48;
+        dst += 64;
+    }
+    pixels -= i;
+#endif
+    rgb24_to_bgrx32_scalar(src, dst, pixels);
+}
+
+bool convert_to_nv12(const video_frame& frame, std::vector<uint8_t>& nv12) {
+    const uint32_t w = frame.width, h = frame.height;
+    const uint32_t cw = (w + 1) / 2, ch = (h + 1) / 2;
+    const uint32_t bpp = bytes_per_pixel(frame.pixel_format);
+    if (bpp == 0 || w == 0 || h == 0) {
+        return false;
+    }
+
+    // chroma planes are checked where they are read
+    const uint32_t stride = frame.planes[0].stride;
+    if (frame.planes[0].offset + static_cast<size_t>(stride) * (h - 1) + w * bpp > frame.size) {
+        return false;
+    }
+    auto plane_fits = [&](uint32_t p, uint32_t row_bytes) {
+        return frame.planes[p].offset + static_cast<size_t>(frame.planes[p].stride) * (ch - 1) + row_bytes <= frame.size;
+    };
+
+    nv12.resize(static_cast<size_t>(w) * h + static_cast<size_t>(cw) * 2 * ch);
+    uint8_t *luma = nv12.data();
+    uint8_t *chroma = luma + static_cast<size_t>(w) * h;
+    const uint8_t *src = frame.data + frame.planes[0].offset;
+
+    auto copy_luma = [&]() {
+        for (uint32_t y = 0; y < h; y++) {
+            memcpy(luma + static_cast<size_t>(y) * w, src + static_cast<size_t>(y) * stride, w);
+        }
+    };
+
+    switch (frame.pixel_format) {
+        case V4L2_PIX_FMT_NV12:
+        case V4L2_PIX_FMT_NV21: {
+            if (frame.plane_count < 2 || !plane_fits(1, cw * 2)) {
+                return false;
+            }
+            copy_luma();
+            const bool swap = frame.pixel_format == V4L2_PIX_FMT_NV21;
+            for (uint32_t y = 0; y < ch; y++) {
+                const uint8_t *uv = frame.data + frame.planes[1].offset + static_cast<size_t>(y) * frame.planes[1].stride;
+                uint8_t *dst = chroma + static_cast<size_t>(y) * cw * 2;
+                if (!swap) {
+                    memcpy(dst, uv, cw * 2);
+                    continue;
+                }
+                for (uint32_t x = 0; x < cw; x++) {
+                    dst[2 * x] = uv[2 * x + 1];
+                    dst[2 * x + 1] = uv[2 * x];
+                }
+            }
+            return true;
+        }
+        case V4L2_PIX_FMT_YUV420:
+        case V4L2_PIX_FMT_YVU420: {
+            if (frame.plane_count < 3 || !plane_fits(1, cw) || !plane_fits(2, cw)) {
+                return false;
+            }
+            copy_luma();
+            const uint32_t u_plane = frame.pixel_format == V4L2_PIX_FMT_YUV420 ? 1 : 2;
+            const uint32_t v_plane = 3 - u_plane;
+            for (uint32_t y = 0; y < ch; y++) {
+                const uint8_t *u = frame.data + frame.planes[u_plane].offset + static_cast<size_t>(y) * frame.planes[u_plane].stride;
+                const uint8_t *v = frame.data + frame.planes[v_plane].offset + static_cast<size_t>(y) * frame.planes[v_plane].stride;
+                uint8_t *dst = chroma + static_cast<size_t>(y) * cw * 2;
+                for (uint32_t x = 0; x < cw; x++) {
+                    dst[2 * x] = u[x];
+                    dst[2 * x + 1] = v[x];
+                }
+            }
+            return true;
+        }
+        case V4L2_PIX_FMT_YUYV:
+        case V4L2_PIX_FMT_UYVY: {
+            if (w % 2) {
+                return false;
+            }
+            const int y_at = frame.pixel_format == V4L2_PIX_FMT_YUYV ? 0 : 1;
+            const int c_at = 1 - y_at;
+            for (uint32_t y = 0; y < h; y++) {
+                const uint8_t *row = src + static_cast<size_t>(y) * stride;
+                uint8_t *dst = luma + static_cast<size_t>(y) * w;
+                for (uint32_t x = 0; x < w; x++) {
+                    dst[x] = row[2 * x + y_at];
+                }
+            }
+            for (uint32_t y = 0; y < ch; y++) {
+                const uint8_t *top = src + static_cast<size_t>(2 * y) * stride;
+                const uint8_t *bottom = 2 * y + 1 < h ? top + stride : top;
+                uint8_t *dst = chroma + static_cast<size_t>(y) * cw * 2;
+                for (uint32_t x = 0; x < cw; x++) {
+                    dst[2 * x] = static_cast<uint8_t>((top[4 * x + c_at] + bottom[4 * x + c_at] + 1) / 2);
+                    dst[2 * x + 1] = static_cast<uint8_t>((top[4 * x + c_at + 2] + bottom[4 * x + c_at + 2] + 1) / 2);
+                }
+            }
+            return true;
+        }
+        default:
+            break;
+    }
+
+    // packed RGB variants: where red, green and blue sit within a pixel
+    int r_at, g_at = 1, b_at;
+    if (frame.pixel_format == V4L2_PIX_FMT_RGB24) {
+        r_at = 0;
+        b_at = 2;
+    } else if (bpp == 3 || bpp == 4) {
+        r_at = 2;
+        b_at = 0;
+    } else {
+        return false;
+    }
+
+    for (uint32_t y = 0; y < h; y++) {
+        const uint8_t *px = src + static_cast<size_t>(y) * stride;
+        uint8_t *dst = luma + static_cast<size_t>(y) * w;
+        for (uint32_t x = 0; x < w; x++, px += bpp) {
+            dst[x] = static_cast<uint8_t>(16 + ((66 * px[r_at] + 129 * px[g_at] + 25 * px[b_at] + 128) >> 8));
+        }
+    }
+    // chroma from the average of each 2x2 block, edge pixels repeated on odd sizes
+    for (uint32_t y = 0; y < ch; y++) {
+        const uint8_t *top = src + static_cast<size_t>(2 * y) * stride;
+        const uint8_t *bottom = 2 * y + 1 < h ? top + stride : top;
+        uint8_t *dst = chroma + static_cast<size_t>(y) * cw * 2;
+        for (uint32_t x = 0; x < cw; x++) {
+            const size_t left = static_cast<size_t>(2 * x) * bpp;
+            const size_t right = 2 * x + 1 < w ? left + bpp : left;
+            const int r = top[left + r_at] + top[right + r_at] + bottom[left + r_at] + bottom[right + r_at];
+            const int g = top[left + g_at] + top[right + g_at] + bottom[left + g_at] + bottom[right + g_at];
+            const int b = top[left + b_at] + top[right + b_at] + bottom[left + b_at] + bottom[right + b_at];
+            dst[2 * x] = static_cast<uint8_t>(128 + ((-38 * r - 74 * g + 112 * b + 512) >> 10));
+            dst[2 * x + 1] = static_cast<uint8_t>(128 + ((112 * r - 94 * g - 18 * b + 512) >> 10));
+        }
+    }
+    return true;
+}
+
+bool convert_to_uyvy(const video_frame& frame, std::vector<uint8_t>& uyvy) {
+    const uint32_t w = frame.width, h = frame.height;
+    if (w % 2 || w == 0 || h == 0) {
+        return false;
+    }
+    uyvy.resize(static_cast<size_t>(w) * 2 * h);
+
+    const uint32_t stride = frame.planes[0].stride;
+    const uint8_t *src = frame.data + frame.planes[0].offset;
+    if (frame.pixel_format == V4L2_PIX_FMT_UYVY || frame.pixel_format == V4L2_PIX_FMT_YUYV) {
+        if (frame.planes[0].offset + static_cast<size_t>(stride) * (h - 1) + w * 2 > frame.size) {
+            return false;
+        }
+        for (uint32_t y = 0; y < h; y++) {
+            const uint8_t *row = src + static_cast<size_t>(y) * stride;
+            uint8_t *dst = uyvy.data() + static_cast<size_t>(y) * w * 2;
+            if (frame.pixel_format == V4L2_PIX_FMT_UYVY) {
+                memcpy(dst, row, w * 2);
+                continue;
+            }
+            for (uint32_t x = 0; x < w * 2; x += 2) {
+                dst[x] = row[x + 1];
+                dst[x + 1] = row[x];
+            }
+        }
+        return true;
+    }
+
+    // everything else goes through NV12, each chroma line serves two lines
+    static thread_local std::vector<uint8_t> nv12;
+    if (!convert_to_nv12(frame, nv12)) {
+        return false;
+    }
+    const uint8_t *luma = nv12.data();
+    const uint8_t *chroma = luma + static_cast<size_t>(w) * h;
+    for (uint32_t y = 0; y < h; y++) {
+        const uint8_t *l = luma + static_cast<size_t>(y) * w;
+        const uint8_t *c = chroma + static_cast<size_t>(y / 2) * w;
+        uint8_t *dst = uyvy.data() + static_cast<size_t>(y) * w * 2;
+        for (uint32_t x = 0; x < w; x += 2) {
+            dst[2 * x] = c[x];
+            dst[2 * x + 1] = l[x];
+            dst[2 * x + 2] = c[x + 1];
+            dst[2 * x + 3] = l[x + 1];
+        }
+    }
+    return true;
+}
+
+static inline uint8_t clamp_byte(int v) {
+    return static_cast<uint8_t>(v < 0 ? 0 : v > 255 ? 255 : v);
+}
+
+bool convert_yuv422_to_rgb(const video_frame& frame, uint32_t pixel_format, std::vector<uint8_t>& rgb) {
+    if (frame.pixel_format != V4L2_PIX_FMT_UYVY && frame.pixel_format != V4L2_PIX_FMT_YUYV) {
+        return false;
+    }
+    const uint32_t w = frame.width, h = frame.height;
+    const uint32_t stride = frame.planes[0].stride;
+    if (w % 2 || h == 0 || frame.planes[0].offset + static_cast<size_t>(stride) * (h - 1) + w * 2 > frame.size) {
+        return false;
+    }
+    const bool bgrx = pixel_format == V4L2_PIX_FMT_XBGR32;
+    const int bpp = bgrx ? 4 : 3;
+    const int r_at = bgrx ? 2 : 0, b_at = bgrx ? 0 : 2;
+    const int y_at = frame.pixel_format == V4L2_PIX_FMT_YUYV ? 0 : 1;
+    const int c_at = 1 - y_at;
+    rgb.resize(static_cast<size_t>(w) * h * bpp);
+
+    for (uint32_t line = 0; line < h; line++) {
+        const uint8_t *src = frame.data + frame.planes[0].offset + static_cast<size_t>(line) * stride;
+        uint8_t *dst = rgb.data() + static_cast<size_t>(line) * w * bpp;
+        for (uint32_t x = 0; x < w; x += 2, src += 4, dst += 2 * bpp) {
+            // 16.16 fixed point coefficients of the BT.601 inverse
+            const int u = src[c_at] - 128, v = src[c_at + 2] - 128;
+            const int r = 104597 * v;
+            const int g = -25675 * u - 53279 * v;
+            const int b = 132201 * u;
+            for (int p = 0; p < 2; p++) {
+                const int y = 76309 * (src[y_at + 2 * p] - 16) + 32768;
+                uint8_t *px = dst + p * bpp;
+                px[r_at] = clamp_byte((y + r) >> 16);
+                px[1] = clamp_byte((y + g) >> 16);
+                px[b_at] = clamp_byte((y + b) >> 16);
+                if (bgrx) {
+                    px[3] = 0xff;
+                }
+            }
+        }
+    }
+    return true;
+}
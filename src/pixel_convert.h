@@ -0,0 +1,25 @@
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+#include <vector>
+#include "video_frame.h"
+
+// Expands packed RGB24 pixels to BGRX32 (B, G, R, 0xff in memory), the layout GL uploads as
+// GL_BGRA/GL_UNSIGNED_INT_8_8_8_8_REV. Uses SSSE3 or NEON when the CPU has it.
+void rgb24_to_bgrx32(const uint8_t *src, uint8_t *dst, size_t pixels);
+
+// Converts an uncompressed frame to tightly packed NV12, a luma plane followed by interleaved
+// CbCr at half resolution. RGB goes through BT.601 limited range, 4:2:2 chroma is averaged
+// over line pairs. False for formats it doesn't know and frames shorter than their layout.
+bool convert_to_nv12(const video_frame& frame, std::vector<uint8_t>& nv12);
+
+// Converts an uncompressed frame to packed UYVY 4:2:2 (Cb Y0 Cr Y1), the RFC 4175 pgroup
+// layout. 4:2:2 input is only reordered, anything else has its 4:2:0 chroma repeated over
+// line pairs. False for odd widths and formats convert_to_nv12 doesn't know.
+bool convert_to_uyvy(const video_frame& frame, std::vector<uint8_t>& uyvy);
+
+// Converts a UYVY or YUYV frame to tightly packed RGB24 or BGRX32 (pixel_format
+// V4L2_PIX_FMT_RGB24 or _XBGR32) with BT.601 limited range, each chroma sample shared by its
+// pixel pair. False for other formats and frames shorter than their layout.
+bool convert_yuv422_to_rgb(const video_frame& frame, uint32_t pixel_format, std::vector<uint8_t>& rgb);
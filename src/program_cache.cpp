@@ -0,0 +1,105 @@
+#include <cstdint>
+#include <cstring>
+#include <sstream>
+#include <string>
+#include <vector>
+#include "program_cache.h"
+#include "cache_dir.h"
+
+static const char *program_cache_magic = "streamer-program 1";
+
+static std::string gl_string(GLenum name) {
+    auto s = glGetString(name);
+    return s ? reinterpret_cast<const char *>(s) : "";
+}
+
+// what a binary is only valid for: the driver that produced it
+static std::string driver_id() {
+    return gl_string(GL_VENDOR) + "|" + gl_string(GL_RENDERER) + "|" + gl_string(GL_VERSION);
+}
+
+// FNV-1a, only used to name cache files
+static uint64_t hash(const std::string& data) {
+    uint64_t h = 0xcbf29ce484222325ull;
+    for (unsigned char c: data) {
+        h ^= c;
+        h *= 0x100000001b3ull;
+    }
+    return h;
+}
+
+static std::string cache_name(const char *vertex_src, const char *fragment_src) {
+    std::stringstream name;
+    name << "program-" << std::hex << hash(driver_id() + '\0' + vertex_src + '\0' + fragment_src) << ".bin";
+    return name.str();
+}
+
+bool program_binaries_supported() {
+    if (!glGetProgramBinary || !glProgramBinary || !(GLAD_GL_VERSION_4_1 || GLAD_GL_ARB_get_program_binary)) {
+        return false;
+    }
+    GLint formats = 0;
+    glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &formats);
+    return formats > 0;
+}
+
+GLuint load_program_binary(const char *vertex_src, const char *fragment_src) {
+    if (!program_binaries_supported()) {
+        return 0;
+    }
+
+    // header lines, then the binary: magic, driver id, binary format
+    const std::string entry = read_cache_file(cache_name(vertex_src, fragment_src));
+    std::istringstream in(entry);
+    std::string magic, driver;
+    GLenum binary_format = 0;
+    if (!std::getline(in, magic) || magic != program_cache_magic
+        || !std::getline(in, driver) || driver != driver_id()
+        || !(in >> binary_format) || in.get() != '\n') {
+        return 0;
+    }
+    const size_t offset = static_cast<size_t>(in.tellg());
+    if (offset >= entry.size()) {
+        return 0;
+    }
+
+    GLuint program = glCreateProgram();
+    glProgramBinary(program, binary_format, entry.data() + offset, static_cast<GLsizei>(entry.size() - offset));
+
+    // a driver update can reject binaries even under the same version string
+    GLint linked = GL_FALSE;
+    glGetProgramiv(program, GL_LINK_STATUS, &linked);
+    while (glGetError() != GL_NO_ERROR) {
+        linked = GL_FALSE;
+    }
+    if (linked != GL_TRUE) {
+        glDeleteProgram(program);
+        return 0;
+    }
+    return program;
+}
+
+void save_program_binary(GLuint program, const char *vertex_src, const char *fragment_src) {
+    if (!program_binaries_supported()) {
+        return;
+    }
+
+    GLint length = 0;
+    glGetProgramiv(program, GL_PROGRAM_BINARY_LENGTH, &length);
+    if (length <= 0) {
+        return;
+    }
+
+    std::vector<char> binary(length);
+    GLenum binary_format = 0;
+    GLsizei written = 0;
+    glGetProgramBinary(program, length, &written, &binary_format, binary.data());
+    if (glGetError() != GL_NO_ERROR || written <= 0) {
+        return;
+    }
+
+    std::stringstream entry;
+    entry << program_cache_magic << "\n" << driver_id() << "\n" << binary_format << "\n";
+    entry.write(binary.data(), written);
+    write_cache_file(cache_name(vertex_src, fragment_src), entry.str());
+}
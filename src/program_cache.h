@@ -0,0 +1,16 @@
+#pragma once
+
+#include <glad/glad.h>
+
+// Linked shader programs saved with glGetProgramBinary, so later starts skip compiling GLSL.
+// Entries are keyed by a hash of the shader sources and the GL vendor, renderer and version
+// string; anything that doesn't load cleanly just means compiling from source again.
+
+// a linked program from the cache, 0 when there is none or the driver rejects it
+GLuint load_program_binary(const char *vertex_src, const char *fragment_src);
+
+// stores a program linked with GL_PROGRAM_BINARY_RETRIEVABLE_HINT set
+void save_program_binary(GLuint program, const char *vertex_src, const char *fragment_src);
+
+// whether the context can hand out program binaries at all
+bool program_binaries_supported();
@@ -0,0 +1,397 @@
+#include <cmath>
+#include <cstring>
+#include <iostream>
+#include "recorder.h"
+
+recorder::recorder(const std::string& path_, record_format format_, float frame_rate_, const encoder_options& encoding,
+                   const audio_track& audio_, size_t queue_frames)
+        : path(path_), writer(path_), format(format_), frame_rate(frame_rate_ > 0 ? frame_rate_ : 30), audio(audio_), slots(queue_frames) {
+
+    if (!writer.is_open()) {
+        return;
+    }
+
+    if (format == record_format::h264 || format == record_format::mkv) {
+        encoder_options options = encoding;
+        options.frame_rate = frame_rate;
+        if (format == record_format::mkv) {
+            muxer = new matroska_muxer(writer, audio);
+        }
+        encoder = new h264_encoder(options, [this](const encoded_packet& packet) {
+            if (muxer) {
+                muxer->put_video(packet);
+            } else {
+                writer.append(packet.data, packet.size);
+            }
+            frames_written++;
+        });
+        std::cout << "Recording to " << path << (muxer ? " (mkv)" : " (h264)") << std::endl;
+        return;
+    }
+
+    if (format == record_format::raw) {
+        index.open(path + ".idx", std::ios::trunc);
+        write_raw_index_header(index);
+    }
+
+    for (size_t i = 0; i < slots.size(); i++) {
+        free_slots.push_back(i);
+    }
+
+    std::cout << "Recording to " << path << (format == record_format::y4m ? " (y4m)" : " (raw)") << std::endl;
+    write_thread = std::thread(&recorder::write_fun, this);
+}
+
+recorder::~recorder() {
+    if (encoder) {
+        // flushes the packets still in the encoder, and prints its own summary
+        delete encoder;
+        delete muxer;
+        writer.close();
+        report_failure();
+        return;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(queue_mutex);
+        stopping = true;
+        queue_changed.notify_all();
+    }
+    if (write_thread.joinable()) {
+        write_thread.join();
+    }
+    writer.close();
+    if (report_failure()) {
+        return;
+    }
+
+    std::cout << "Recorded " << frames_written << " frames, dropped " << frames_dropped;
+    if (frames_skipped) {
+        std::cout << ", skipped " << frames_skipped << " in a format the recording can't hold";
+    }
+    std::cout << std::endl;
+}
+
+void recorder::push(const video_frame& frame) {
+    // a recording that failed stays stopped
+    if (!frame.data || !writer.is_open() || writer.failed()) {
+        return;
+    }
+    if (encoder) {
+        encoder->push(frame);
+        return;
+    }
+
+    size_t index;
+    {
+        std::lock_guard<std::mutex> lock(queue_mutex);
+        if (free_slots.empty()) {
+            frames_dropped++;
+            return;
+        }
+        index = free_slots.back();
+        free_slots.pop_back();
+    }
+
+    // slots keep their capacity, so this only allocates for the first few frames
+    auto& s = slots[index];
+    s.data.assign(frame.data, frame.data + frame.size);
+    s.frame = frame;
+    s.frame.data = s.data.data();
+
+    std::lock_guard<std::mutex> lock(queue_mutex);
+    ready.push_back(index);
+    queue_changed.notify_one();
+}
+
+void recorder::push_audio(const float *samples, size_t frames, uint32_t channels, uint32_t sample_rate,
+                          std::chrono::steady_clock::time_point timestamp) {
+    if (muxer && channels == audio.channels && sample_rate == audio.sample_rate) {
+        muxer->put_audio(samples, frames, timestamp);
+    }
+}
+
+void recorder::write_fun() {
+    while (true) {
+        size_t index;
+        {
+            std::unique_lock<std::mutex> lock(queue_mutex);
+            queue_changed.wait(lock, [this]() { return !ready.empty() || stopping; });
+            if (ready.empty()) {
+                return;
+            }
+            index = ready.front();
+            ready.pop_front();
+        }
+
+        // appending blocks while the disk is behind; meanwhile push() runs out of slots and drops
+        const auto& frame = slots[index].frame;
+        if (format == record_format::y4m) {
+            write_y4m(frame);
+        } else {
+            write_raw(frame);
+        }
+
+        std::lock_guard<std::mutex> lock(queue_mutex);
+        free_slots.push_back(index);
+    }
+}
+
+void write_raw_index_header(std::ostream& index) {
+    index << "# offset size width height fourcc timestamp_us sequence" << std::endl;
+}
+
+bool write_raw_frame(async_writer& writer, std::ostream& index, const video_frame& frame) {
+    const uint64_t offset = writer.position();
+
+    const uint32_t bpp = bytes_per_pixel(frame.pixel_format);
+    if (bpp == 0) {
+        // compressed, keep it as it came
+        writer.append(frame.data, frame.size);
+    } else {
+        // plane row sizes and counts, strides dropped
+        const uint32_t chroma_width = (frame.width + 1) / 2, chroma_height = (frame.height + 1) / 2;
+        uint32_t row_bytes[video_frame::max_planes] = {frame.width * bpp, 0, 0};
+        uint32_t rows[video_frame::max_planes] = {frame.height, 0, 0};
+        if (frame.plane_count == 2) {
+            row_bytes[1] = chroma_width * 2;
+            rows[1] = chroma_height;
+        } else if (frame.plane_count == 3) {
+            row_bytes[1] = row_bytes[2] = chroma_width;
+            rows[1] = rows[2] = chroma_height;
+        }
+
+        for (uint32_t p = 0; p < frame.plane_count; p++) {
+            const auto& plane = frame.planes[p];
+            if (plane.offset + static_cast<size_t>(plane.stride) * (rows[p] - 1) + row_bytes[p] > frame.size) {
+                return false;
+            }
+        }
+        for (uint32_t p = 0; p < frame.plane_count; p++) {
+            for (uint32_t y = 0; y < rows[p]; y++) {
+                writer.append(frame.data + frame.planes[p].offset + static_cast<size_t>(y) * frame.planes[p].stride, row_bytes[p]);
+            }
+        }
+    }
+
+    const auto timestamp_us = std::chrono::duration_cast<std::chrono::microseconds>(frame.timestamp.time_since_epoch()).count();
+    index << offset << " " << writer.position() - offset << " " << frame.width << " " << frame.height << " "
+          << fourcc_to_string(frame.pixel_format) << " " << timestamp_us << " " << frame.sequence << "\n";
+    return true;
+}
+
+void recorder::write_raw(const video_frame& frame) {
+    if (write_raw_frame(writer, index, frame)) {
+        frames_written++;
+    } else {
+        frames_skipped++;
+    }
+}
+
+// chroma layout of the y4m stream for a capture format, nullptr when there is none
+static const char *y4m_colorspace(uint32_t pixel_format) {
+    switch (pixel_format) {
+        case V4L2_PIX_FMT_YUV420:
+        case V4L2_PIX_FMT_YVU420:
+        case V4L2_PIX_FMT_NV12:
+        case V4L2_PIX_FMT_NV21:
+            return "420jpeg";
+        case V4L2_PIX_FMT_YUYV:
+        case V4L2_PIX_FMT_UYVY:
+            return "422";
+        case V4L2_PIX_FMT_RGB24:
+        case V4L2_PIX_FMT_BGR24:
+        case V4L2_PIX_FMT_XBGR32:
+        case V4L2_PIX_FMT_ABGR32:
+        case V4L2_PIX_FMT_BGR32:
+            return "444";
+        default:
+            return nullptr;
+    }
+}
+
+void recorder::write_y4m(const video_frame& frame) {
+    if (!header_written) {
+        const char *colorspace = y4m_colorspace(frame.pixel_format);
+        if (!colorspace) {
+            std::cerr << "Can't record " << fourcc_to_string(frame.pixel_format) << " frames as y4m, use the raw format" << std::endl;
+            frames_skipped++;
+            return;
+        }
+
+        stream_width = frame.width;
+        stream_height = frame.height;
+        stream_format = frame.pixel_format;
+
+        const std::string header = "YUV4MPEG2 W" + std::to_string(frame.width) + " H" + std::to_string(frame.height)
+                                   + " F" + std::to_string(std::lround(frame_rate * 1000)) + ":1000 Ip A1:1 C" + colorspace + "\n";
+        writer.append(header.data(), header.size());
+        header_written = true;
+    }
+
+    // a y4m stream has one format throughout
+    if (frame.width != stream_width || frame.height != stream_height || frame.pixel_format != stream_format || !y4m_planes(frame)) {
+        frames_skipped++;
+        return;
+    }
+
+    static const char frame_header[] = "FRAME\n";
+    writer.append(frame_header, sizeof(frame_header) - 1);
+    writer.append(planes.data(), planes.size());
+    frames_written++;
+}
+
+// Converts the frame into y4m's planar layout, in planes. RGB goes through BT.601 limited range.
+bool recorder::y4m_planes(const video_frame& frame) {
+    const uint32_t w = frame.width, h = frame.height;
+    const uint32_t cw = (w + 1) / 2, ch = (h + 1) / 2;
+    const uint32_t bpp = bytes_per_pixel(frame.pixel_format);
+    const uint8_t *src = frame.data + frame.planes[0].offset;
+    const uint32_t stride = frame.planes[0].stride;
+    if (bpp == 0 || w == 0 || h == 0) {
+        return false;
+    }
+
+    // chroma planes are checked where they are read
+    if (frame.planes[0].offset + static_cast<size_t>(stride) * (h - 1) + w * bpp > frame.size) {
+        return false;
+    }
+    auto plane_fits = [&](uint32_t p, uint32_t row_bytes) {
+        return frame.planes[p].offset + static_cast<size_t>(frame.planes[p].stride) * (ch - 1) + row_bytes <= frame.size;
+    };
+
+    auto copy_plane = [&](uint8_t *dst, const uint8_t *plane, uint32_t plane_stride, uint32_t row_bytes, uint32_t rows) {
+        for (uint32_t y = 0; y < rows; y++) {
+            memcpy(dst + static_cast<size_t>(y) * row_bytes, plane + static_cast<size_t>(y) * plane_stride, row_bytes);
+        }
+    };
+
+    switch (frame.pixel_format) {
+        case V4L2_PIX_FMT_YUV420:
+        case V4L2_PIX_FMT_YVU420: {
+            if (frame.plane_count < 3 || !plane_fits(1, cw) || !plane_fits(2, cw)) {
+                return false;
+            }
+            planes.resize(static_cast<size_t>(w) * h + 2 * static_cast<size_t>(cw) * ch);
+            uint8_t *u = planes.data() + static_cast<size_t>(w) * h;
+            uint8_t *v = u + static_cast<size_t>(cw) * ch;
+            if (frame.pixel_format == V4L2_PIX_FMT_YVU420) {
+                std::swap(u, v);
+            }
+            copy_plane(planes.data(), src, stride, w, h);
+            copy_plane(u, frame.data + frame.planes[1].offset, frame.planes[1].stride, cw, ch);
+            copy_plane(v, frame.data + frame.planes[2].offset, frame.planes[2].stride, cw, ch);
+            return true;
+        }
+        case V4L2_PIX_FMT_NV12:
+        case V4L2_PIX_FMT_NV21: {
+            if (frame.plane_count < 2 || !plane_fits(1, cw * 2)) {
+                return false;
+            }
+            planes.resize(static_cast<size_t>(w) * h + 2 * static_cast<size_t>(cw) * ch);
+            uint8_t *u = planes.data() + static_cast<size_t>(w) * h;
+            uint8_t *v = u + static_cast<size_t>(cw) * ch;
+            if (frame.pixel_format == V4L2_PIX_FMT_NV21) {
+                std::swap(u, v);
+            }
+            copy_plane(planes.data(), src, stride, w, h);
+            for (uint32_t y = 0; y < ch; y++) {
+                const uint8_t *uv = frame.data + frame.planes[1].offset + static_cast<size_t>(y) * frame.planes[1].stride;
+                for (uint32_t x = 0; x < cw; x++) {
+                    *u++ = uv[2 * x];
+                    *v++ = uv[2 * x + 1];
+                }
+            }
+            return true;
+        }
+        case V4L2_PIX_FMT_YUYV:
+        case V4L2_PIX_FMT_UYVY: {
+            // pixel pairs share their chroma, an odd width has half a pair
+            if (w % 2) {
+                return false;
+            }
+            planes.resize(static_cast<size_t>(w) * h + 2 * static_cast<size_t>(cw) * h);
+            uint8_t *luma = planes.data();
+            uint8_t *u = luma + static_cast<size_t>(w) * h;
+            uint8_t *v = u + static_cast<size_t>(cw) * h;
+            const int y_at = frame.pixel_format == V4L2_PIX_FMT_YUYV ? 0 : 1;
+            const int c_at = 1 - y_at;
+            for (uint32_t y = 0; y < h; y++) {
+                const uint8_t *row = src + static_cast<size_t>(y) * stride;
+                for (uint32_t x = 0; x < w; x++) {
+                    *luma++ = row[2 * x + y_at];
+                }
+                for (uint32_t x = 0; x < cw; x++) {
+                    *u++ = row[4 * x + c_at];
+                    *v++ = row[4 * x + c_at + 2];
+                }
+            }
+            return true;
+        }
+        default:
+            break;
+    }
+
+    // packed RGB variants: where red, green and blue sit within a pixel
+    int r_at, g_at = 1, b_at;
+    if (frame.pixel_format == V4L2_PIX_FMT_RGB24) {
+        r_at = 0;
+        b_at = 2;
+    } else if (bpp == 3 || bpp == 4) {
+        r_at = 2;
+        b_at = 0;
+    } else {
+        return false;
+    }
+
+    const size_t plane_size = static_cast<size_t>(w) * h;
+    planes.resize(plane_size * 3);
+    uint8_t *luma = planes.data(), *u = luma + plane_size, *v = u + plane_size;
+    for (uint32_t y = 0; y < h; y++) {
+        const uint8_t *px = src + static_cast<size_t>(y) * stride;
+        for (uint32_t x = 0; x < w; x++, px += bpp) {
+            const int r = px[r_at], g = px[g_at], b = px[b_at];
+            *luma++ = static_cast<uint8_t>(16 + ((66 * r + 129 * g + 25 * b + 128) >> 8));
+            *u++ = static_cast<uint8_t>(128 + ((-38 * r - 74 * g + 112 * b + 128) >> 8));
+            *v++ = static_cast<uint8_t>(128 + ((112 * r - 94 * g - 18 * b + 128) >> 8));
+        }
+    }
+    return true;
+}
+
+void recorder::report() {
+    if (report_failure()) {
+        return;
+    }
+    if (encoder) {
+        encoder->report();
+        const uint64_t bytes = writer.written();
+        std::cout << "Recording: " << (bytes - last_bytes) / (1024.0 * 1024.0) << " MB to disk, "
+                  << writer.waits() << " waits for the disk so far" << std::endl;
+        last_bytes = bytes;
+        return;
+    }
+
+    const size_t written = frames_written, dropped = frames_dropped;
+    const uint64_t bytes = writer.written();
+
+    std::cout << "Recording: " << written - last_written << " frames written, " << dropped - last_dropped << " dropped, "
+              << (bytes - last_bytes) / (1024.0 * 1024.0) << " MB to disk, " << writer.waits() << " waits for the disk so far" << std::endl;
+
+    last_written = written;
+    last_dropped = dropped;
+    last_bytes = bytes;
+}
+
+// Says so once when the disk refused a write, true from then on.
+bool recorder::report_failure() {
+    if (!writer.failed()) {
+        return false;
+    }
+    if (!failure_reported) {
+        std::cerr << "Recording to " << path << " failed and stopped, the file ends after "
+                  << writer.written() / (1024.0 * 1024.0) << " MB" << std::endl;
+        failure_reported = true;
+    }
+    return true;
+}
@@ -0,0 +1,97 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <fstream>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include "async_writer.h"
+#include "h264_encoder.h"
+#include "matroska_muxer.h"
+#include "video_frame.h"
+
+// Appends a frame without line padding and describes it with a line in the index; false when
+// the frame is shorter than its layout says. Shared by everything that writes the raw format.
+bool write_raw_frame(async_writer& writer, std::ostream& index, const video_frame& frame);
+
+// the first line of a raw index
+void write_raw_index_header(std::ostream& index);
+
+enum class record_format {
+    y4m, // planar YUV as YUV4MPEG2; RGB frames become 4:4:4
+    raw, // frames back to back without padding, described line by line in <path>.idx
+    h264, // an H.264 Annex B elementary stream
+    mkv,  // H.264 and float PCM audio in Matroska, playable up to the last cluster after a crash
+};
+
+// Records published frames to disk on a thread of its own. The producer only copies a frame
+// into a free slot of a fixed pool; when the disk falls behind and no slot is free the frame
+// is dropped and counted, capture and presentation never wait for storage. H.264 recordings
+// go through the encoder's own queue instead, its thread appends the packets.
+class recorder {
+public:
+    recorder(const std::string& path, record_format format, float frame_rate, const encoder_options& encoding = {},
+             const audio_track& audio = {}, size_t queue_frames = 8);
+    ~recorder();
+
+    bool is_open() const { return writer.is_open(); }
+
+    // y4m and Matroska hold one resolution, frames of another aren't recorded
+    bool fixed_resolution() const { return format == record_format::y4m || format == record_format::mkv; }
+
+    // call on the producer thread, e.g. from a frame sink
+    void push(const video_frame& frame);
+
+    // call on the audio thread; only Matroska recordings keep audio
+    void push_audio(const float *samples, size_t frames, uint32_t channels, uint32_t sample_rate,
+                    std::chrono::steady_clock::time_point timestamp);
+
+    // prints what happened since the last report
+    void report();
+
+private:
+    struct slot {
+        std::vector<uint8_t> data;
+        video_frame frame;
+    };
+
+    void write_fun();
+    void write_raw(const video_frame& frame);
+    void write_y4m(const video_frame& frame);
+    bool y4m_planes(const video_frame& frame);
+    bool report_failure();
+
+    std::string path;
+    async_writer writer;
+    record_format format;
+    float frame_rate;
+    std::ofstream index;
+    h264_encoder *encoder = nullptr;
+    matroska_muxer *muxer = nullptr;
+    audio_track audio;
+
+    std::vector<slot> slots;
+    std::vector<size_t> free_slots;
+    std::deque<size_t> ready;
+    std::mutex queue_mutex;
+    std::condition_variable queue_changed;
+    bool stopping = false;
+
+    // y4m: the stream format is fixed by the first frame
+    bool header_written = false;
+    uint32_t stream_width = 0, stream_height = 0, stream_format = 0;
+    std::vector<uint8_t> planes; // the current frame converted to planar YUV
+
+    std::atomic<size_t> frames_written{0};
+    std::atomic<size_t> frames_dropped{0};
+    std::atomic<size_t> frames_skipped{0}; // couldn't be written in this format
+    size_t last_written = 0;
+    size_t last_dropped = 0;
+    uint64_t last_bytes = 0;
+    bool failure_reported = false;
+
+    std::thread write_thread;
+};
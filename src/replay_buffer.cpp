@@ -0,0 +1,253 @@
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include "replay_buffer.h"
+#include "async_writer.h"
+#include "recorder.h"
+
+replay_ring::replay_ring(size_t capacity_, std::chrono::steady_clock::duration window_)
+        : arena(new uint8_t[capacity_]), capacity(capacity_), window(window_) {
+    // touch every page now rather than on the capture thread later
+    memset(arena, 0, capacity);
+}
+
+replay_ring::~replay_ring() {
+    delete[] arena;
+}
+
+size_t replay_ring::record_space(size_t payload) {
+    return (sizeof(record) + payload + 15) & ~static_cast<size_t>(15);
+}
+
+replay_ring::record replay_ring::header_at(size_t offset) const {
+    record r;
+    memcpy(&r, arena + offset, sizeof(record));
+    return r;
+}
+
+// records never straddle the end of the arena, a marker or too little room means the next one is at 0
+size_t replay_ring::skip_wrap(size_t offset) const {
+    if (offset + sizeof(record) > capacity || header_at(offset).wrap) {
+        return 0;
+    }
+    return offset;
+}
+
+bool replay_ring::fits(size_t pos, size_t need) const {
+    if (count == 0) {
+        return pos + need <= capacity;
+    }
+    if (tail < head) {
+        // free: [head, capacity) and [0, tail)
+        return pos == head || pos + need <= tail;
+    }
+    // free: [head, tail)
+    return pos == head && pos + need <= tail;
+}
+
+void replay_ring::evict_oldest() {
+    tail = skip_wrap(tail);
+    tail += record_space(header_at(tail).size);
+    tail_number++;
+    if (--count == 0) {
+        head = tail = 0;
+    } else {
+        tail = skip_wrap(tail);
+    }
+}
+
+bool replay_ring::put(record header, const void *payload) {
+    const size_t need = record_space(header.size);
+    if (need > capacity) {
+        return false;
+    }
+
+    std::lock_guard<std::mutex> lock(ring_mutex);
+    while (count > 0 && header_at(tail).timestamp + window < header.timestamp) {
+        evict_oldest();
+    }
+
+    size_t pos;
+    while (true) {
+        pos = head + need <= capacity ? head : 0;
+        if (fits(pos, need)) {
+            break;
+        }
+        evict_oldest();
+    }
+
+    if (pos != head && head + sizeof(record) <= capacity) {
+        record marker;
+        marker.wrap = 1;
+        memcpy(arena + head, &marker, sizeof(record));
+    }
+
+    header.wrap = 0;
+    header.number = head_number++;
+    memcpy(arena + pos, &header, sizeof(record));
+    if (header.size) {
+        memcpy(arena + pos + sizeof(record), payload, header.size);
+    }
+
+    head = pos + need;
+    count++;
+    newest = header.timestamp;
+    return true;
+}
+
+bool replay_ring::copy(cursor& c, uint64_t end, record& header, std::vector<uint8_t>& payload) {
+    std::lock_guard<std::mutex> lock(ring_mutex);
+    if (c.number < tail_number) {
+        c = {tail_number, tail};
+    }
+    if (c.number >= end || c.number >= head_number) {
+        return false;
+    }
+
+    const size_t offset = skip_wrap(c.offset);
+    header = header_at(offset);
+    payload.assign(arena + offset + sizeof(record), arena + offset + sizeof(record) + header.size);
+
+    c.offset = offset + record_space(header.size);
+    c.number = header.number + 1;
+    return true;
+}
+
+uint64_t replay_ring::next_number() {
+    std::lock_guard<std::mutex> lock(ring_mutex);
+    return head_number;
+}
+
+std::chrono::steady_clock::duration replay_ring::held() {
+    std::lock_guard<std::mutex> lock(ring_mutex);
+    if (count == 0) {
+        return {};
+    }
+    return newest - header_at(tail).timestamp;
+}
+
+// audio is sized for 48 kHz stereo float in blocks of about a millisecond, with some slack
+static size_t audio_capacity(float seconds) {
+    const double per_second = 48000 * 2 * sizeof(float) + 1000 * sizeof(replay_ring::record);
+    return static_cast<size_t>(seconds * per_second * 1.25);
+}
+
+static std::chrono::steady_clock::duration window(float seconds) {
+    return std::chrono::duration_cast<std::chrono::steady_clock::duration>(std::chrono::duration<float>(seconds));
+}
+
+replay_buffer::replay_buffer(float seconds, size_t video_megabytes)
+        : video(video_megabytes << 20, window(seconds)), audio(audio_capacity(seconds), window(seconds)) {
+    std::cout << "Keeping up to " << seconds << " s of replay in " << video_megabytes << " MB of video memory" << std::endl;
+}
+
+replay_buffer::~replay_buffer() {
+    if (dump_thread.joinable()) {
+        dump_thread.join();
+    }
+}
+
+void replay_buffer::put_video(const video_frame& frame) {
+    if (!frame.data) {
+        return;
+    }
+
+    replay_ring::record header;
+    header.size = frame.size;
+    header.timestamp = frame.timestamp;
+    header.frame = frame;
+    header.frame.data = nullptr;
+    if (!video.put(header, frame.data)) {
+        video_dropped++;
+    }
+}
+
+void replay_buffer::put_audio(const float *samples, size_t frames, uint32_t channels, uint32_t sample_rate,
+                              std::chrono::steady_clock::time_point timestamp) {
+    replay_ring::record header;
+    header.size = frames * channels * sizeof(float);
+    header.timestamp = timestamp;
+    header.channels = channels;
+    header.sample_rate = sample_rate;
+    audio.put(header, samples);
+}
+
+bool replay_buffer::dump(const std::string& prefix) {
+    if (dumping.exchange(true)) {
+        return false;
+    }
+    if (dump_thread.joinable()) {
+        dump_thread.join();
+    }
+
+    const float seconds = std::chrono::duration<float>(video.held()).count();
+    std::cout << "Saving the last " << seconds << " s to " << prefix << ".*" << std::endl;
+
+    // everything up to now; what arrives while dumping belongs to the next replay
+    dump_thread = std::thread(&replay_buffer::dump_fun, this, prefix, video.next_number(), audio.next_number());
+    return true;
+}
+
+void replay_buffer::dump_fun(std::string prefix, uint64_t video_end, uint64_t audio_end) {
+    replay_ring::record header;
+    std::vector<uint8_t> payload;
+    size_t frames = 0, blocks = 0, lost = 0;
+    bool failed = false;
+
+    {
+        async_writer out(prefix + ".raw");
+        std::ofstream index(prefix + ".raw.idx", std::ios::trunc);
+        write_raw_index_header(index);
+
+        replay_ring::cursor c;
+        uint64_t expected = 0;
+        while (out.is_open() && !out.failed() && video.copy(c, video_end, header, payload)) {
+            if (frames > 0) {
+                // capture overwrote these before we got to them
+                lost += header.number - expected;
+            }
+            expected = header.number + 1;
+
+            video_frame frame = header.frame;
+            frame.data = payload.data();
+            if (write_raw_frame(out, index, frame)) {
+                frames++;
+            }
+        }
+        out.close();
+        failed = failed || out.failed();
+    }
+
+    {
+        async_writer out(prefix + ".f32");
+        std::ofstream index(prefix + ".f32.idx", std::ios::trunc);
+        index << "# offset frames channels sample_rate timestamp_us" << std::endl;
+
+        replay_ring::cursor c;
+        while (out.is_open() && !out.failed() && audio.copy(c, audio_end, header, payload)) {
+            const auto timestamp_us = std::chrono::duration_cast<std::chrono::microseconds>(header.timestamp.time_since_epoch()).count();
+            index << out.position() << " " << header.size / (header.channels * sizeof(float)) << " " << header.channels << " "
+                  << header.sample_rate << " " << timestamp_us << "\n";
+            out.append(payload.data(), payload.size());
+            blocks++;
+        }
+        out.close();
+        failed = failed || out.failed();
+    }
+
+    if (failed) {
+        std::cerr << "Saving the replay to " << prefix << ".* failed, the files are cut short" << std::endl;
+        dumping = false;
+        return;
+    }
+
+    std::cout << "Saved " << frames << " frames and " << blocks << " audio blocks to " << prefix << ".*";
+    if (lost) {
+        std::cout << ", " << lost << " frames were overwritten before they could be saved";
+    }
+    if (video_dropped) {
+        std::cout << ", " << video_dropped << " frames were too large to keep at all";
+    }
+    std::cout << std::endl;
+    dumping = false;
+}
@@ -0,0 +1,96 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include "video_frame.h"
+
+// A byte arena holding variable sized records oldest to newest, allocated once. Adding a record
+// evicts the oldest ones until it fits, and anything older than the time window, so steady
+// state recording never allocates. Records are numbered so a reader working through the ring
+// a record at a time notices when the writer overtook it.
+class replay_ring {
+public:
+    struct record {
+        uint32_t size = 0; // payload bytes
+        uint32_t wrap = 0; // marks the unused end of the arena
+        uint64_t number = 0;
+        std::chrono::steady_clock::time_point timestamp;
+        video_frame frame; // video: layout of the payload, data unused
+        uint32_t channels = 0; // audio: interleaved float samples
+        uint32_t sample_rate = 0;
+    };
+
+    replay_ring(size_t capacity, std::chrono::steady_clock::duration window);
+    ~replay_ring();
+
+    // false when the payload is larger than the whole arena
+    bool put(record header, const void *payload);
+
+    // where a reader is, starts at the oldest record
+    struct cursor {
+        uint64_t number = 0;
+        size_t offset = 0;
+    };
+
+    // Copies the record at the cursor, or the oldest one when the writer already evicted it,
+    // and advances. False once the cursor reaches `end` or the newest record.
+    bool copy(cursor& c, uint64_t end, record& header, std::vector<uint8_t>& payload);
+
+    // the number the next record will get
+    uint64_t next_number();
+
+    // span of time currently held
+    std::chrono::steady_clock::duration held();
+
+private:
+    static size_t record_space(size_t payload);
+    bool fits(size_t pos, size_t need) const;
+    void evict_oldest();
+    record header_at(size_t offset) const;
+    size_t skip_wrap(size_t offset) const;
+
+    uint8_t *arena;
+    size_t capacity;
+    std::chrono::steady_clock::duration window;
+
+    std::mutex ring_mutex;
+    size_t head = 0;  // where the next record goes
+    size_t tail = 0;  // the oldest record
+    size_t count = 0;
+    uint64_t tail_number = 0;
+    uint64_t head_number = 0;
+    std::chrono::steady_clock::time_point newest;
+};
+
+// Keeps the last seconds of video frames, in their capture format, and audio input around so
+// they can be saved after something interesting happened. Dumping runs on its own thread and
+// takes one record at a time from the rings, capture keeps going meanwhile.
+class replay_buffer {
+public:
+    replay_buffer(float seconds, size_t video_megabytes);
+    ~replay_buffer();
+
+    // frame and audio sinks, call on the producer threads
+    void put_video(const video_frame& frame);
+    void put_audio(const float *samples, size_t frames, uint32_t channels, uint32_t sample_rate,
+                   std::chrono::steady_clock::time_point timestamp);
+
+    // Writes the video to <prefix>.raw/.raw.idx and the audio to <prefix>.f32/.f32.idx in the
+    // background; false while a previous dump is still running.
+    bool dump(const std::string& prefix);
+
+private:
+    void dump_fun(std::string prefix, uint64_t video_end, uint64_t audio_end);
+
+    replay_ring video;
+    replay_ring audio;
+    std::atomic<size_t> video_dropped{0}; // frames larger than the whole arena
+
+    std::thread dump_thread;
+    std::atomic<bool> dumping{false};
+};
@@ -0,0 +1,86 @@
+#include <cstring>
+#include <iostream>
+#include <cstdio>
+#include <arpa/inet.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <unistd.h>
+#include "rtp.h"
+
+bool resolve_udp_address(const std::string& address, bool passive, sockaddr_storage& result, socklen_t& length) {
+    std::string host, port;
+    const size_t colon = address.rfind(':');
+    if (colon == std::string::npos) {
+        port = address;
+    } else {
+        host = address.substr(0, colon);
+        port = address.substr(colon + 1);
+        if (host.size() >= 2 && host.front() == '[' && host.back() == ']') {
+            host = host.substr(1, host.size() - 2);
+        }
+    }
+
+    addrinfo hints;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_DGRAM;
+    hints.ai_flags = passive ? AI_PASSIVE : 0;
+    addrinfo *found = nullptr;
+    const int r = getaddrinfo(host.empty() ? nullptr : host.c_str(), port.c_str(), &hints, &found);
+    if (r != 0 || !found) {
+        std::cerr << "Cannot resolve " << address << ": " << gai_strerror(r) << std::endl;
+        return false;
+    }
+    memcpy(&result, found->ai_addr, found->ai_addrlen);
+    length = found->ai_addrlen;
+    freeaddrinfo(found);
+    return true;
+}
+
+int open_udp_receiver(const std::string& address) {
+    sockaddr_storage local;
+    socklen_t length;
+    if (!resolve_udp_address(address, true, local, length)) {
+        return -1;
+    }
+    const int fd = socket(local.ss_family, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+    if (fd < 0) {
+        perror("socket");
+        return -1;
+    }
+    const int one = 1;
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+    // a 1080p60 frame is 4 MB, give the reader a few frames of slack
+    const int receive_buffer_size = 16 << 20;
+    setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &receive_buffer_size, sizeof(receive_buffer_size));
+    if (bind(fd, reinterpret_cast<sockaddr *>(&local), length) != 0) {
+        perror(("Cannot bind " + address).c_str());
+        close(fd);
+        return -1;
+    }
+
+    // multicast groups need joining on top of binding their address
+    bool joined = true;
+    if (local.ss_family == AF_INET) {
+        const auto& a = reinterpret_cast<const sockaddr_in&>(local);
+        if (IN_MULTICAST(ntohl(a.sin_addr.s_addr))) {
+            ip_mreqn request{};
+            request.imr_multiaddr = a.sin_addr;
+            joined = setsockopt(fd, IPPROTO_IP, IP_ADD_MEMBERSHIP, &request, sizeof(request)) == 0;
+        }
+    } else if (local.ss_family == AF_INET6) {
+        const auto& a = reinterpret_cast<const sockaddr_in6&>(local);
+        if (IN6_IS_ADDR_MULTICAST(&a.sin6_addr)) {
+            ipv6_mreq request{};
+            request.ipv6mr_multiaddr = a.sin6_addr;
+            joined = setsockopt(fd, IPPROTO_IPV6, IPV6_ADD_MEMBERSHIP, &request, sizeof(request)) == 0;
+        }
+    }
+    if (!joined) {
+        perror(("Cannot join " + address).c_str());
+        close(fd);
+        return -1;
+    }
+
+    return fd;
+}
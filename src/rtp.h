@@ -0,0 +1,107 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <sys/socket.h>
+
+// RTP (RFC 3550) framing shared by rtp_sender and rtp_receiver.
+
+static constexpr size_t rtp_header_size = 12;
+static constexpr uint32_t rtp_clock_rate = 90000; // video payloads all count in 90 kHz
+static constexpr uint8_t rtp_raw_payload_type = 96;  // dynamic, RFC 4175 raw video
+static constexpr uint8_t rtp_jpeg_payload_type = 26; // static, RFC 2435 JPEG
+
+// RFC 4175: a 2 byte extended sequence number, then 6 byte line segment headers
+static constexpr size_t rfc4175_header_size = 2;
+static constexpr size_t rfc4175_segment_size = 6;
+
+struct rtp_packet {
+    bool marker = false; // last packet of a frame
+    uint8_t payload_type = 0;
+    uint16_t sequence = 0;
+    uint32_t timestamp = 0;
+    uint32_t ssrc = 0;
+    const uint8_t *payload = nullptr;
+    size_t payload_size = 0; // without padding
+};
+
+inline void write_rtp_header(uint8_t *p, bool marker, bool padding, uint8_t payload_type, uint16_t sequence,
+                             uint32_t timestamp, uint32_t ssrc) {
+    p[0] = 0x80 | (padding ? 0x20 : 0);
+    p[1] = static_cast<uint8_t>((marker ? 0x80 : 0) | (payload_type & 0x7f));
+    p[2] = static_cast<uint8_t>(sequence >> 8);
+    p[3] = static_cast<uint8_t>(sequence);
+    p[4] = static_cast<uint8_t>(timestamp >> 24);
+    p[5] = static_cast<uint8_t>(timestamp >> 16);
+    p[6] = static_cast<uint8_t>(timestamp >> 8);
+    p[7] = static_cast<uint8_t>(timestamp);
+    p[8] = static_cast<uint8_t>(ssrc >> 24);
+    p[9] = static_cast<uint8_t>(ssrc >> 16);
+    p[10] = static_cast<uint8_t>(ssrc >> 8);
+    p[11] = static_cast<uint8_t>(ssrc);
+}
+
+// false for anything that isn't a well formed RTP version 2 packet
+inline bool parse_rtp(const uint8_t *p, size_t size, rtp_packet& packet) {
+    if (size < rtp_header_size || (p[0] >> 6) != 2) {
+        return false;
+    }
+    size_t header = rtp_header_size + 4 * (p[0] & 0x0f);
+    if (p[0] & 0x10) {
+        // header extension: 4 bytes of profile and length, then length words
+        if (size < header + 4) {
+            return false;
+        }
+        header += 4 + 4 * ((p[header + 2] << 8) | p[header + 3]);
+    }
+    size_t padding = (p[0] & 0x20) ? p[size - 1] : 0;
+    if (size < header + padding) {
+        return false;
+    }
+
+    packet.marker = (p[1] & 0x80) != 0;
+    packet.payload_type = p[1] & 0x7f;
+    packet.sequence = static_cast<uint16_t>((p[2] << 8) | p[3]);
+    packet.timestamp = (static_cast<uint32_t>(p[4]) << 24) | (p[5] << 16) | (p[6] << 8) | p[7];
+    packet.ssrc = (static_cast<uint32_t>(p[8]) << 24) | (p[9] << 16) | (p[10] << 8) | p[11];
+    packet.payload = p + header;
+    packet.payload_size = size - header - padding;
+    return true;
+}
+
+// Calls segment(line, offset, data, bytes) for each line segment of an RFC 4175 payload, offsets
+// in pixels. Stops at the first segment whose data isn't all there or isn't whole pixels.
+template<typename F>
+inline void for_each_rfc4175_segment(const uint8_t *payload, size_t size, F segment) {
+    if (size < rfc4175_header_size) {
+        return;
+    }
+    // segment headers up to the one without the continuation bit, then their data in order
+    const uint8_t *end = payload + size;
+    const uint8_t *h = payload + rfc4175_header_size;
+    const uint8_t *d = h;
+    while (d + rfc4175_segment_size <= end) {
+        const bool more = (d[4] & 0x80) != 0;
+        d += rfc4175_segment_size;
+        if (!more) {
+            break;
+        }
+    }
+    for (; h < d; h += rfc4175_segment_size) {
+        const uint32_t bytes = (h[0] << 8) | h[1];
+        if (bytes > static_cast<size_t>(end - d) || bytes % 2 != 0) {
+            return;
+        }
+        segment(static_cast<uint32_t>(((h[2] & 0x7f) << 8) | h[3]), static_cast<uint32_t>(((h[4] & 0x7f) << 8) | h[5]), d, bytes);
+        d += bytes;
+    }
+}
+
+// Resolves "host:port", or "[v6 address]:port", for a UDP socket. A bare port binds to all
+// interfaces when passive. False with a message printed when it can't.
+bool resolve_udp_address(const std::string& address, bool passive, sockaddr_storage& result, socklen_t& length);
+
+// Binds a UDP socket to address, joining it when it is a multicast group, with a receive buffer
+// that holds a few frames of raw video. -1 with a message printed when it can't.
+int open_udp_receiver(const std::string& address);
@@ -0,0 +1,213 @@
+#include <algorithm>
+#include <cstring>
+#include "rtp_jpeg.h"
+
+// RFC 2435 appendix A, in zigzag order
+static const uint8_t luma_quantizer[64] = {
+        16, 11, 12, 14, 12, 10, 16, 14, 13, 14, 18, 17, 16, 19, 24, 40,
+        26, 24, 22, 22, 24, 49, 35, 37, 29, 40, 58, 51, 61, 60, 57, 51,
+        56, 55, 64, 72, 92, 78, 64, 68, 87, 69, 55, 56, 80, 109, 81, 87,
+        95, 98, 103, 104, 103, 62, 77, 113, 121, 112, 100, 120, 92, 101, 103, 99};
+static const uint8_t chroma_quantizer[64] = {
+        17, 18, 18, 24, 21, 24, 47, 26, 26, 47, 99, 66, 56, 66, 99, 99,
+        99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99,
+        99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99,
+        99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99};
+
+// the standard Huffman tables of JPEG annex K.3, as RFC 2435 appendix B has them
+static const uint8_t luma_dc_lengths[16] = {0, 1, 5, 1, 1, 1, 1, 1, 1, 0, 0, 0, 0, 0, 0, 0};
+static const uint8_t luma_dc_symbols[12] = {0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11};
+static const uint8_t luma_ac_lengths[16] = {0, 2, 1, 3, 3, 2, 4, 3, 5, 5, 4, 4, 0, 0, 1, 0x7d};
+static const uint8_t luma_ac_symbols[162] = {
+        0x01, 0x02, 0x03, 0x00, 0x04, 0x11, 0x05, 0x12, 0x21, 0x31, 0x41, 0x06, 0x13, 0x51, 0x61, 0x07,
+        0x22, 0x71, 0x14, 0x32, 0x81, 0x91, 0xa1, 0x08, 0x23, 0x42, 0xb1, 0xc1, 0x15, 0x52, 0xd1, 0xf0,
+        0x24, 0x33, 0x62, 0x72, 0x82, 0x09, 0x0a, 0x16, 0x17, 0x18, 0x19, 0x1a, 0x25, 0x26, 0x27, 0x28,
+        0x29, 0x2a, 0x34, 0x35, 0x36, 0x37, 0x38, 0x39, 0x3a, 0x43, 0x44, 0x45, 0x46, 0x47, 0x48, 0x49,
+        0x4a, 0x53, 0x54, 0x55, 0x56, 0x57, 0x58, 0x59, 0x5a, 0x63, 0x64, 0x65, 0x66, 0x67, 0x68, 0x69,
+        0x6a, 0x73, 0x74, 0x75, 0x76, 0x77, 0x78, 0x79, 0x7a, 0x83, 0x84, 0x85, 0x86, 0x87, 0x88, 0x89,
+        0x8a, 0x92, 0x93, 0x94, 0x95, 0x96, 0x97, 0x98, 0x99, 0x9a, 0xa2, 0xa3, 0xa4, 0xa5, 0xa6, 0xa7,
+        0xa8, 0xa9, 0xaa, 0xb2, 0xb3, 0xb4, 0xb5, 0xb6, 0xb7, 0xb8, 0xb9, 0xba, 0xc2, 0xc3, 0xc4, 0xc5,
+        0xc6, 0xc7, 0xc8, 0xc9, 0xca, 0xd2, 0xd3, 0xd4, 0xd5, 0xd6, 0xd7, 0xd8, 0xd9, 0xda, 0xe1, 0xe2,
+        0xe3, 0xe4, 0xe5, 0xe6, 0xe7, 0xe8, 0xe9, 0xea, 0xf1, 0xf2, 0xf3, 0xf4, 0xf5, 0xf6, 0xf7, 0xf8,
+        0xf9, 0xfa};
+static const uint8_t chroma_dc_lengths[16] = {0, 3, 1, 1, 1, 1, 1, 1, 1, 1, 1, 0, 0, 0, 0, 0};
+static const uint8_t chroma_dc_symbols[12] = {0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11};
+static const uint8_t chroma_ac_lengths[16] = {0, 2, 1, 2, 4, 4, 3, 4, 7, 5, 4, 4, 0, 1, 2, 0x77};
+static const uint8_t chroma_ac_symbols[162] = {
+        0x00, 0x01, 0x02, 0x03, 0x11, 0x04, 0x05, 0x21, 0x31, 0x06, 0x12, 0x41, 0x51, 0x07, 0x61, 0x71,
+        0x13, 0x22, 0x32, 0x81, 0x08, 0x14, 0x42, 0x91, 0xa1, 0xb1, 0xc1, 0x09, 0x23, 0x33, 0x52, 0xf0,
+        0x15, 0x62, 0x72, 0xd1, 0x0a, 0x16, 0x24, 0x34, 0xe1, 0x25, 0xf1, 0x17, 0x18, 0x19, 0x1a, 0x26,
+        0x27, 0x28, 0x29, 0x2a, 0x35, 0x36, 0x37, 0x38, 0x39, 0x3a, 0x43, 0x44, 0x45, 0x46, 0x47, 0x48,
+        0x49, 0x4a, 0x53, 0x54, 0x55, 0x56, 0x57, 0x58, 0x59, 0x5a, 0x63, 0x64, 0x65, 0x66, 0x67, 0x68,
+        0x69, 0x6a, 0x73, 0x74, 0x75, 0x76, 0x77, 0x78, 0x79, 0x7a, 0x82, 0x83, 0x84, 0x85, 0x86, 0x87,
+        0x88, 0x89, 0x8a, 0x92, 0x93, 0x94, 0x95, 0x96, 0x97, 0x98, 0x99, 0x9a, 0xa2, 0xa3, 0xa4, 0xa5,
+        0xa6, 0xa7, 0xa8, 0xa9, 0xaa, 0xb2, 0xb3, 0xb4, 0xb5, 0xb6, 0xb7, 0xb8, 0xb9, 0xba, 0xc2, 0xc3,
+        0xc4, 0xc5, 0xc6, 0xc7, 0xc8, 0xc9, 0xca, 0xd2, 0xd3, 0xd4, 0xd5, 0xd6, 0xd7, 0xd8, 0xd9, 0xda,
+        0xe2, 0xe3, 0xe4, 0xe5, 0xe6, 0xe7, 0xe8, 0xe9, 0xea, 0xf2, 0xf3, 0xf4, 0xf5, 0xf6, 0xf7, 0xf8,
+        0xf9, 0xfa};
+
+static uint16_t read16(const uint8_t *p) {
+    return static_cast<uint16_t>((p[0] << 8) | p[1]);
+}
+
+bool parse_jpeg_for_rtp(const uint8_t *jpeg, size_t size, rtp_jpeg_scan& scan) {
+    if (size < 4 || jpeg[0] != 0xff || jpeg[1] != 0xd8) {
+        return false;
+    }
+    const uint8_t *tables[4] = {};
+    uint8_t luma_table = 0, chroma_table = 0;
+    bool have_frame = false;
+    scan.restart_interval = 0;
+
+    size_t at = 2;
+    while (at + 4 <= size) {
+        if (jpeg[at] != 0xff) {
+            return false;
+        }
+        const uint8_t marker = jpeg[at + 1];
+        if (marker == 0xff) {
+            at++; // fill byte
+            continue;
+        }
+        const size_t length = read16(jpeg + at + 2);
+        const uint8_t *segment = jpeg + at + 4;
+        if (length < 2 || at + 2 + length > size) {
+            return false;
+        }
+        const size_t segment_size = length - 2;
+
+        switch (marker) {
+            case 0xdb: // DQT
+                for (size_t i = 0; i + 65 <= segment_size; i += 65) {
+                    // 16 bit tables don't fit RFC 2435
+                    if ((segment[i] >> 4) != 0 || (segment[i] & 0x0f) > 3) {
+                        return false;
+                    }
+                    tables[segment[i] & 0x0f] = segment + i + 1;
+                }
+                break;
+            case 0xc0: // SOF0, baseline
+            case 0xc1: // extended sequential, still 8 bit Huffman
+                if (segment_size < 15 || segment[0] != 8 || segment[5] != 3) {
+                    return false;
+                }
+                scan.height = read16(segment + 1);
+                scan.width = read16(segment + 3);
+                if (segment[7] == 0x21) {
+                    scan.type = 0;
+                } else if (segment[7] == 0x22) {
+                    scan.type = 1;
+                } else {
+                    return false;
+                }
+                if (segment[10] != 0x11 || segment[13] != 0x11 || segment[11] != segment[14]) {
+                    return false;
+                }
+                luma_table = segment[8] & 3;
+                chroma_table = segment[11] & 3;
+                have_frame = true;
+                break;
+            case 0xdd: // DRI
+                if (segment_size >= 2) {
+                    scan.restart_interval = read16(segment);
+                }
+                break;
+            case 0xda: { // SOS, the scan runs from here to EOI
+                if (!have_frame || !tables[luma_table] || !tables[chroma_table] || segment_size < 1 || segment[0] != 3) {
+                    return false;
+                }
+                if (scan.width == 0 || scan.height == 0 || scan.width > 2040 || scan.height > 2040 ||
+                    scan.width % 8 || scan.height % 8) {
+                    return false;
+                }
+                size_t end = size;
+                while (end >= 2 && !(jpeg[end - 2] == 0xff && jpeg[end - 1] == 0xd9)) {
+                    end--;
+                }
+                const size_t start = at + 2 + length;
+                if (end < start + 2) {
+                    return false;
+                }
+                if (scan.restart_interval) {
+                    scan.type += 64;
+                }
+                memcpy(scan.tables, tables[luma_table], 64);
+                memcpy(scan.tables + 64, tables[chroma_table], 64);
+                scan.scan = jpeg + start;
+                scan.scan_size = end - 2 - start;
+                return true;
+            }
+            default:
+                if ((marker >= 0xc2 && marker <= 0xcf && marker != 0xc4 && marker != 0xc8 && marker != 0xcc)) {
+                    return false; // progressive, lossless or arithmetic coded
+                }
+                break;
+        }
+        at += 2 + length;
+    }
+    return false;
+}
+
+void make_rtp_jpeg_tables(int q, uint8_t *tables) {
+    const int factor = std::min(std::max(q, 1), 99);
+    const int scale = factor < 50 ? 5000 / factor : 200 - factor * 2;
+    for (int i = 0; i < 64; i++) {
+        tables[i] = static_cast<uint8_t>(std::min(std::max((luma_quantizer[i] * scale + 50) / 100, 1), 255));
+        tables[64 + i] = static_cast<uint8_t>(std::min(std::max((chroma_quantizer[i] * scale + 50) / 100, 1), 255));
+    }
+}
+
+static void put_marker(std::vector<uint8_t>& out, uint8_t marker, size_t length) {
+    out.push_back(0xff);
+    out.push_back(marker);
+    out.push_back(static_cast<uint8_t>(length >> 8));
+    out.push_back(static_cast<uint8_t>(length));
+}
+
+static void put_huffman_table(std::vector<uint8_t>& out, uint8_t table_class_id, const uint8_t *lengths,
+                              const uint8_t *symbols, size_t symbol_count) {
+    put_marker(out, 0xc4, 3 + 16 + symbol_count);
+    out.push_back(table_class_id);
+    out.insert(out.end(), lengths, lengths + 16);
+    out.insert(out.end(), symbols, symbols + symbol_count);
+}
+
+void write_jpeg_headers(uint8_t type, uint32_t width, uint32_t height, const uint8_t *tables,
+                        uint16_t restart_interval, std::vector<uint8_t>& jpeg) {
+    jpeg.push_back(0xff);
+    jpeg.push_back(0xd8);
+
+    for (uint8_t t = 0; t < 2; t++) {
+        put_marker(jpeg, 0xdb, 67);
+        jpeg.push_back(t);
+        jpeg.insert(jpeg.end(), tables + 64 * t, tables + 64 * (t + 1));
+    }
+
+    if (restart_interval) {
+        put_marker(jpeg, 0xdd, 4);
+        jpeg.push_back(static_cast<uint8_t>(restart_interval >> 8));
+        jpeg.push_back(static_cast<uint8_t>(restart_interval));
+    }
+
+    put_marker(jpeg, 0xc0, 17);
+    jpeg.push_back(8);
+    jpeg.push_back(static_cast<uint8_t>(height >> 8));
+    jpeg.push_back(static_cast<uint8_t>(height));
+    jpeg.push_back(static_cast<uint8_t>(width >> 8));
+    jpeg.push_back(static_cast<uint8_t>(width));
+    jpeg.push_back(3);
+    const uint8_t components[9] = {
+            0, static_cast<uint8_t>((type & 0x3f) == 0 ? 0x21 : 0x22), 0,
+            1, 0x11, 1,
+            2, 0x11, 1};
+    jpeg.insert(jpeg.end(), components, components + 9);
+
+    put_huffman_table(jpeg, 0x00, luma_dc_lengths, luma_dc_symbols, sizeof(luma_dc_symbols));
+    put_huffman_table(jpeg, 0x10, luma_ac_lengths, luma_ac_symbols, sizeof(luma_ac_symbols));
+    put_huffman_table(jpeg, 0x01, chroma_dc_lengths, chroma_dc_symbols, sizeof(chroma_dc_symbols));
+    put_huffman_table(jpeg, 0x11, chroma_ac_lengths, chroma_ac_symbols, sizeof(chroma_ac_symbols));
+
+    put_marker(jpeg, 0xda, 12);
+    const uint8_t scan[10] = {3, 0, 0x00, 1, 0x11, 2, 0x11, 0, 63, 0};
+    jpeg.insert(jpeg.end(), scan, scan + 10);
+}
@@ -0,0 +1,41 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// RFC 2435 JPEG over RTP. The packets carry only the entropy coded scan and a few parameters;
+// a receiver rebuilds the headers, with the standard Huffman tables, from those.
+
+// main JPEG header, then a restart marker header for types 64 to 127, and in the first packet
+// of a frame with Q 128 and up a quantization table header
+static constexpr size_t rfc2435_header_size = 8;
+static constexpr size_t rfc2435_restart_header_size = 4;
+static constexpr size_t rfc2435_table_header_size = 4;
+
+// Q values from 128 up carry the tables in band; we always send them like that
+static constexpr uint8_t rfc2435_inband_q = 255;
+
+// What of a JPEG goes into RTP packets.
+struct rtp_jpeg_scan {
+    uint8_t type = 0;              // 0 for 4:2:2, 1 for 4:2:0, plus 64 with restart markers
+    uint32_t width = 0, height = 0;
+    uint16_t restart_interval = 0;
+    uint8_t tables[128];           // luma then chroma quantization table, in zigzag order
+    const uint8_t *scan = nullptr; // entropy coded data, up to but without EOI
+    size_t scan_size = 0;
+};
+
+// Finds the parameters and the scan of a baseline JPEG. False for what RFC 2435 can't carry:
+// progressive or 12 bit JPEGs, anything but YCbCr 4:2:2 or 4:2:0, chroma components with tables
+// of their own, and sizes over 2040 pixels. The Huffman tables have to be the standard ones,
+// like most cameras and libjpeg without optimize_coding write; that isn't checked.
+bool parse_jpeg_for_rtp(const uint8_t *jpeg, size_t size, rtp_jpeg_scan& scan);
+
+// the quantization tables a Q of 1 to 99 stands for, as in RFC 2435 appendix A
+void make_rtp_jpeg_tables(int q, uint8_t *tables);
+
+// Writes the headers of a JPEG with these parameters, as in RFC 2435 appendix B. The scan and
+// an EOI marker go after them.
+void write_jpeg_headers(uint8_t type, uint32_t width, uint32_t height, const uint8_t *tables,
+                        uint16_t restart_interval, std::vector<uint8_t>& jpeg);
@@ -0,0 +1,195 @@
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <poll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include "rtp_receiver.h"
+
+static constexpr size_t receive_batch = 64;
+static constexpr size_t max_packet = 9216; // jumbo frames
+
+// a timestamp further than this from the last one is a new stream, not loss or reordering
+static constexpr int32_t max_timestamp_jump = 10 * rtp_clock_rate;
+
+rtp_receiver::rtp_receiver(const std::string& address, uint32_t width_, uint32_t height_)
+        : width(width_), height(height_), frame_size(static_cast<size_t>(width_) * height_ * 2) {
+    const int fd = open_udp_receiver(address);
+    if (fd < 0) {
+        return;
+    }
+    sock = fd;
+    receive_buffer.resize(receive_batch * max_packet);
+    assembling.resize(frame_size);
+    ready.resize(frame_size);
+    // black, for whatever the first frames are missing
+    for (size_t i = 0; i + 3 < frame_size; i += 4) {
+        assembling[i] = ready[i] = 128;
+        assembling[i + 1] = ready[i + 1] = 16;
+        assembling[i + 2] = ready[i + 2] = 128;
+        assembling[i + 3] = ready[i + 3] = 16;
+    }
+}
+
+rtp_receiver::~rtp_receiver() {
+    if (sock >= 0) {
+        close(sock);
+    }
+}
+
+bool rtp_receiver::next(rtp_frame& frame, std::chrono::milliseconds timeout) {
+    if (sock < 0) {
+        return false;
+    }
+    const auto deadline = std::chrono::steady_clock::now() + timeout;
+    while (!have_ready) {
+        const auto left = std::chrono::duration_cast<std::chrono::milliseconds>(deadline - std::chrono::steady_clock::now());
+        if (left.count() < 0 || !receive(static_cast<int>(left.count()))) {
+            return false;
+        }
+    }
+    have_ready = false;
+    frame = ready_frame;
+    return true;
+}
+
+// Reads everything that is waiting, after waiting up to timeout_ms for the first packet.
+bool rtp_receiver::receive(int timeout_ms) {
+    pollfd pfd = {sock, POLLIN, 0};
+    const int r = poll(&pfd, 1, timeout_ms);
+    if (r <= 0) {
+        if (r < 0 && errno != EINTR) {
+            perror("poll");
+        }
+        return r == 0 || errno == EINTR;
+    }
+
+    mmsghdr messages[receive_batch];
+    iovec iovs[receive_batch];
+    while (true) {
+        memset(messages, 0, sizeof(messages));
+        for (size_t i = 0; i < receive_batch; i++) {
+            iovs[i] = {receive_buffer.data() + i * max_packet, max_packet};
+            messages[i].msg_hdr.msg_iov = &iovs[i];
+            messages[i].msg_hdr.msg_iovlen = 1;
+        }
+        const int n = recvmmsg(sock, messages, receive_batch, MSG_DONTWAIT, nullptr);
+        if (n <= 0) {
+            if (n < 0 && errno != EAGAIN && errno != EINTR) {
+                perror("recvmmsg");
+                return false;
+            }
+            return true;
+        }
+        for (int i = 0; i < n; i++) {
+            rtp_packet packet;
+            if (parse_rtp(static_cast<const uint8_t *>(iovs[i].iov_base), messages[i].msg_len, packet) &&
+                packet.payload_type == rtp_raw_payload_type) {
+                add(packet);
+            }
+        }
+        if (n < static_cast<int>(receive_batch)) {
+            return true;
+        }
+    }
+}
+
+void rtp_receiver::add(const rtp_packet& packet) {
+    if (packet.payload_size < rfc4175_header_size) {
+        return;
+    }
+    // a restarted sender comes back with new SSRC, sequence numbers and timestamps
+    const int32_t jump = static_cast<int32_t>(packet.timestamp - last_timestamp);
+    if (have_ssrc && (packet.ssrc != ssrc || jump > max_timestamp_jump || jump < -max_timestamp_jump)) {
+        restart_stream();
+    }
+    ssrc = packet.ssrc;
+    last_timestamp = packet.timestamp;
+    have_ssrc = true;
+
+    const uint8_t *p = packet.payload;
+    const uint32_t sequence = (static_cast<uint32_t>(p[0]) << 24) | (p[1] << 16) | packet.sequence;
+
+    if (have_sequence) {
+        const auto gap = static_cast<int32_t>(sequence - next_sequence);
+        if (gap > 0) {
+            lost_packets += gap;
+        } else if (gap < 0 && lost_packets > 0) {
+            lost_packets--; // reordered, counted as lost when it was skipped over
+        }
+        if (gap >= 0) {
+            next_sequence = sequence + 1;
+        }
+    } else {
+        next_sequence = sequence + 1;
+        have_sequence = true;
+    }
+
+    if (have_finished && static_cast<int32_t>(packet.timestamp - finished_timestamp) <= 0) {
+        late_packets++;
+        return;
+    }
+    if (assembling_any && packet.timestamp != assembling_timestamp) {
+        if (static_cast<int32_t>(packet.timestamp - assembling_timestamp) < 0) {
+            late_packets++;
+            return;
+        }
+        finish();
+    }
+    assembling_timestamp = packet.timestamp;
+    assembling_any = true;
+
+    for_each_rfc4175_segment(p, packet.payload_size, [this](uint32_t line, uint32_t offset, const uint8_t *data, uint32_t bytes) {
+        if (line < height && offset * 2 + bytes <= width * 2) {
+            memcpy(assembling.data() + (static_cast<size_t>(line) * width + offset) * 2, data, bytes);
+            assembled_bytes += bytes;
+        }
+    });
+
+    if (packet.marker) {
+        assembling_marker = true;
+        finish();
+    }
+}
+
+void rtp_receiver::finish() {
+    if (have_ready) {
+        dropped_frames++;
+    }
+    const bool complete = assembling_marker && assembled_bytes >= frame_size;
+    frames_received++;
+    if (!complete) {
+        incomplete_frames++;
+    }
+
+    swap(assembling, ready);
+    // the buffer assembled next has the frame before last in it, what is lost shows that
+    ready_frame = {};
+    ready_frame.frame.data = ready.data();
+    ready_frame.frame.size = frame_size;
+    ready_frame.frame.sequence = frames_received;
+    ready_frame.frame.width = width;
+    ready_frame.frame.height = height;
+    ready_frame.frame.pixel_format = V4L2_PIX_FMT_UYVY;
+    set_plane_layout(ready_frame.frame, width * 2);
+    ready_frame.frame.timestamp = std::chrono::steady_clock::now();
+    ready_frame.rtp_timestamp = assembling_timestamp;
+    ready_frame.complete = complete;
+    have_ready = true;
+
+    have_finished = true;
+    finished_timestamp = assembling_timestamp;
+    assembling_any = false;
+    assembling_marker = false;
+    assembled_bytes = 0;
+}
+
+// Forgets the stream, the next packet starts a new one. A frame next() hasn't taken stays.
+void rtp_receiver::restart_stream() {
+    have_ssrc = have_sequence = have_finished = false;
+    assembling_any = assembling_marker = false;
+    assembled_bytes = 0;
+    stream_restarts++;
+}
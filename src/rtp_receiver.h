@@ -0,0 +1,77 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <string>
+#include <vector>
+#include "rtp.h"
+#include "video_frame.h"
+
+// A frame put back together from RFC 4175 packets.
+struct rtp_frame {
+    video_frame frame;      // UYVY; data stays valid until the next call on the receiver
+    uint32_t rtp_timestamp = 0;
+    bool complete = false;  // false when packets went missing, those lines keep older content
+};
+
+// Receives what rtp_sender sends: binds a UDP port, or joins a multicast group, reads packets
+// in recvmmsg batches and reassembles RFC 4175 8 bit 4:2:2 frames of a size known up front, the
+// way a receiver learns it from the SDP. Segments are written where their line and offset say,
+// so packets reordered within a frame are fine; ones that come after their frame was handed
+// out are dropped. A sender that restarts, with a new SSRC or timestamps far from the old ones,
+// is taken as a new stream.
+class rtp_receiver {
+public:
+    rtp_receiver(const std::string& address, uint32_t width, uint32_t height);
+    ~rtp_receiver();
+
+    bool is_open() const { return sock >= 0; }
+
+    // Waits up to timeout for the next frame. A frame is done at its marker packet, or when
+    // packets of a later one come in first.
+    bool next(rtp_frame& frame, std::chrono::milliseconds timeout);
+
+    uint64_t frames() const { return frames_received; }
+    uint64_t incomplete() const { return incomplete_frames; }
+    uint64_t lost() const { return lost_packets; }   // sequence numbers never seen
+    uint64_t late() const { return late_packets; }   // came after their frame was done
+    uint64_t dropped() const { return dropped_frames; } // replaced before next() took them
+    uint64_t restarts() const { return stream_restarts; } // the sender came back as a new stream
+
+private:
+    bool receive(int timeout_ms);
+    void add(const rtp_packet& packet);
+    void finish();
+    void restart_stream();
+
+    int sock = -1;
+    uint32_t width, height;
+    size_t frame_size;
+
+    std::vector<uint8_t> receive_buffer;
+
+    std::vector<uint8_t> assembling;
+    uint32_t assembling_timestamp = 0;
+    size_t assembled_bytes = 0;
+    bool assembling_any = false;
+    bool assembling_marker = false;
+
+    std::vector<uint8_t> ready;
+    rtp_frame ready_frame;
+    bool have_ready = false;
+
+    bool have_ssrc = false;
+    uint32_t ssrc = 0;
+    uint32_t last_timestamp = 0;
+    bool have_sequence = false;
+    uint32_t next_sequence = 0; // extended, RFC 4175's 32 bits
+    bool have_finished = false;
+    uint32_t finished_timestamp = 0;
+
+    uint64_t frames_received = 0;
+    uint64_t incomplete_frames = 0;
+    uint64_t lost_packets = 0;
+    uint64_t late_packets = 0;
+    uint64_t dropped_frames = 0;
+    uint64_t stream_restarts = 0;
+};
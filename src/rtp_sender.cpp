@@ -0,0 +1,438 @@
+#include <algorithm>
+#include <cerrno>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <numeric>
+#include <random>
+#include <string>
+#include <netinet/in.h>
+#include <netinet/udp.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include "jpeg_encoder.h"
+#include "pixel_convert.h"
+#include "rtp.h"
+#include "rtp_sender.h"
+
+#ifndef UDP_SEGMENT
+#define UDP_SEGMENT 103
+#endif
+
+// UDP_MAX_SEGMENTS of older kernels, and what fits into one 64 KB super packet
+static constexpr size_t max_gso_segments = 64;
+static constexpr size_t max_gso_bytes = 65000;
+
+rtp_sender::rtp_sender(const rtp_options& options_, float frame_rate_)
+        : options(options_), frame_rate(frame_rate_ > 0 ? frame_rate_ : 60) {
+    options.burst = std::min<uint32_t>(std::max<uint32_t>(options.burst, 1), max_gso_segments);
+
+    sockaddr_storage address;
+    socklen_t length;
+    if (!resolve_udp_address(options.destination, false, address, length)) {
+        return;
+    }
+    const int fd = socket(address.ss_family, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+    if (fd < 0) {
+        perror("socket");
+        return;
+    }
+    // connected, so the route is looked up once and bursts need no addresses
+    if (connect(fd, reinterpret_cast<sockaddr *>(&address), length) != 0) {
+        perror(("Cannot send to " + options.destination).c_str());
+        close(fd);
+        return;
+    }
+    const int send_buffer = 8 << 20;
+    setsockopt(fd, SOL_SOCKET, SO_SNDBUF, &send_buffer, sizeof(send_buffer));
+
+    // IP and UDP headers
+    const uint32_t overhead = address.ss_family == AF_INET6 ? 48 : 28;
+    packet_size = std::max<uint32_t>(options.mtu, 256) - overhead;
+    sock = fd;
+
+    std::random_device seed;
+    sequence = seed();
+    ssrc = seed();
+    timestamp_offset = seed();
+    random.seed(seed());
+
+    std::thread th(&rtp_sender::send_loop, this);
+    swap(th, send_thread);
+    std::cout << "Streaming RTP to " << options.destination << ", " << packet_size << " byte packets" << std::endl;
+}
+
+rtp_sender::~rtp_sender() {
+    {
+        std::lock_guard<std::mutex> lock(pending_mutex);
+        stopping = true;
+    }
+    pending_cv.notify_one();
+    if (send_thread.joinable()) {
+        send_thread.join();
+    }
+    if (sock >= 0) {
+        close(sock);
+    }
+}
+
+void rtp_sender::push(const video_frame& frame) {
+    if (sock < 0 || !frame.data) {
+        return;
+    }
+    std::lock_guard<std::mutex> lock(pending_mutex);
+    if (have_pending) {
+        frames_skipped++;
+    }
+    pending_data.assign(frame.data, frame.data + frame.size);
+    pending = frame;
+    pending.data = pending_data.data();
+    have_pending = true;
+    pending_cv.notify_one();
+}
+
+void rtp_sender::send_loop() {
+    std::vector<uint8_t> data;
+    std::vector<uint8_t> encoded;
+    jpeg_encoder *encoder = options.jpeg ? new jpeg_encoder(options.jpeg_quality) : nullptr;
+    bool warned = false;
+    const auto interval = std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+            std::chrono::duration<float>(1.0f / frame_rate));
+    const auto span = std::chrono::duration_cast<std::chrono::steady_clock::duration>(interval * options.pacing);
+
+    while (true) {
+        video_frame frame;
+        {
+            std::unique_lock<std::mutex> lock(pending_mutex);
+            pending_cv.wait(lock, [this]() { return have_pending || stopping; });
+            if (stopping) {
+                break;
+            }
+            swap(data, pending_data);
+            frame = pending;
+            frame.data = data.data();
+            have_pending = false;
+        }
+
+        // the receiver schedules by these, so they follow the capture clock rather than the send time
+        const auto capture_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(frame.timestamp.time_since_epoch()).count();
+        const uint32_t timestamp = timestamp_offset + static_cast<uint32_t>(static_cast<uint64_t>(capture_ns) * 9 / 100000);
+
+        size_t count = 0;
+        uint8_t payload_type;
+        rtp_jpeg_scan scan;
+        const bool compressed = bytes_per_pixel(frame.pixel_format) == 0;
+        if (compressed || encoder) {
+            payload_type = rtp_jpeg_payload_type;
+            const bool ok = compressed ? parse_jpeg_for_rtp(frame.data, frame.size, scan)
+                                       : encoder->encode(frame, encoded) && parse_jpeg_for_rtp(encoded.data(), encoded.size(), scan);
+            if (ok) {
+                count = packetize_jpeg(scan, timestamp);
+            }
+        } else {
+            payload_type = rtp_raw_payload_type;
+            if (convert_to_uyvy(frame, uyvy)) {
+                count = packetize(frame.width, frame.height, timestamp);
+            }
+        }
+        if (count == 0) {
+            if (!warned) {
+                std::cerr << "RTP: can't send " << fourcc_to_string(frame.pixel_format) << " frames of " << frame.width
+                          << "x" << frame.height << (payload_type == rtp_jpeg_payload_type ? " as RFC 2435 JPEG" : " as 4:2:2")
+                          << std::endl;
+                warned = true;
+            }
+            continue;
+        }
+
+        if (payload_type != sdp_payload_type || frame.width != sdp_width || frame.height != sdp_height) {
+            sdp_payload_type = payload_type;
+            sdp_width = frame.width;
+            sdp_height = frame.height;
+            print_sdp(payload_type, frame.width, frame.height);
+
+            // The fq qdisc paces between the packets it gets: with --rtp-no-gso that smooths each
+            // burst too, a GSO super packet still leaves back to back at line rate. JPEG frames
+            // vary too much for a fixed rate.
+            uint32_t rate = ~0u;
+            if (payload_type == rtp_raw_payload_type) {
+                const double bytes_per_second = static_cast<double>(uyvy.size()) * frame_rate / options.pacing * 1.1;
+                rate = static_cast<uint32_t>(std::min(bytes_per_second, 4e9));
+            }
+            setsockopt(sock, SOL_SOCKET, SO_MAX_PACING_RATE, &rate, sizeof(rate));
+        }
+
+        if (options.loss > 0 || options.jitter.count() > 0) {
+            count = impair(count);
+        }
+        send_paced(count, span);
+        frames_sent++;
+    }
+    delete encoder;
+}
+
+// Cuts the frame into packets of exactly packet_size bytes, only the last may be shorter, which
+// is what UDP GSO needs. A packet carries as many line segments as fit, the few bytes short
+// of packet_size are RTP padding.
+size_t rtp_sender::packetize(uint32_t width, uint32_t height, uint32_t timestamp) {
+    struct segment {
+        uint32_t bytes, line, offset;
+    };
+
+    const size_t line_bytes = static_cast<size_t>(width) * 2;
+    uint32_t line = 0, offset = 0; // offset in pixels
+    size_t count = 0;
+    std::vector<segment> segments;
+    lengths.clear();
+
+    while (line < height) {
+        if (packets.size() < (count + 1) * packet_size) {
+            packets.resize((count + 1) * packet_size + 64 * packet_size);
+        }
+        uint8_t *p = packets.data() + count * packet_size;
+
+        // as many segments as fit, each at least one 4 byte pgroup of two pixels
+        // padding is what's left, less than a segment header and a pgroup
+        segments.clear();
+        size_t room = packet_size - rtp_header_size - rfc4175_header_size;
+        while (line < height && room >= rfc4175_segment_size + 4) {
+            room -= rfc4175_segment_size;
+            const uint32_t pixels = std::min<uint32_t>(width - offset, static_cast<uint32_t>(room / 4 * 2));
+            segments.push_back({pixels * 2, line, offset});
+            room -= pixels * 2;
+            offset += pixels;
+            if (offset == width) {
+                line++;
+                offset = 0;
+            }
+        }
+
+        const bool last = line == height;
+        const size_t used = packet_size - room;
+        const size_t padding = last ? 0 : room;
+        const uint32_t seq = sequence++;
+        write_rtp_header(p, last, padding > 0, rtp_raw_payload_type, static_cast<uint16_t>(seq), timestamp, ssrc);
+
+        uint8_t *h = p + rtp_header_size;
+        h[0] = static_cast<uint8_t>(seq >> 24);
+        h[1] = static_cast<uint8_t>(seq >> 16);
+        h += rfc4175_header_size;
+        uint8_t *d = h + rfc4175_segment_size * segments.size();
+        for (size_t i = 0; i < segments.size(); i++, h += rfc4175_segment_size) {
+            const auto& s = segments[i];
+            const bool more = i + 1 < segments.size();
+            h[0] = static_cast<uint8_t>(s.bytes >> 8);
+            h[1] = static_cast<uint8_t>(s.bytes);
+            h[2] = static_cast<uint8_t>((s.line >> 8) & 0x7f); // field bit 0, progressive
+            h[3] = static_cast<uint8_t>(s.line);
+            h[4] = static_cast<uint8_t>(((s.offset >> 8) & 0x7f) | (more ? 0x80 : 0));
+            h[5] = static_cast<uint8_t>(s.offset);
+            memcpy(d, uyvy.data() + s.line * line_bytes + static_cast<size_t>(s.offset) * 2, s.bytes);
+            d += s.bytes;
+        }
+        if (padding) {
+            memset(d, 0, padding - 1);
+            d[padding - 1] = static_cast<uint8_t>(padding);
+        }
+
+        lengths.push_back(static_cast<uint16_t>(used + padding));
+        count++;
+    }
+    return count;
+}
+
+// Cuts the scan into fragments that fill packets to exactly packet_size, like packetize(). The
+// first packet carries the quantization tables, all carry the frame's parameters.
+size_t rtp_sender::packetize_jpeg(const rtp_jpeg_scan& scan, uint32_t timestamp) {
+    const bool restarts = scan.type >= 64;
+    size_t offset = 0, count = 0;
+    lengths.clear();
+
+    while (offset < scan.scan_size) {
+        if (packets.size() < (count + 1) * packet_size) {
+            packets.resize((count + 1) * packet_size + 64 * packet_size);
+        }
+        uint8_t *p = packets.data() + count * packet_size;
+        uint8_t *h = p + rtp_header_size;
+
+        h[0] = 0; // progressive
+        h[1] = static_cast<uint8_t>(offset >> 16);
+        h[2] = static_cast<uint8_t>(offset >> 8);
+        h[3] = static_cast<uint8_t>(offset);
+        h[4] = scan.type;
+        h[5] = rfc2435_inband_q;
+        h[6] = static_cast<uint8_t>(scan.width / 8);
+        h[7] = static_cast<uint8_t>(scan.height / 8);
+        h += rfc2435_header_size;
+        if (restarts) {
+            // restart intervals aren't aligned to packets: first and last bits set, count unknown
+            h[0] = static_cast<uint8_t>(scan.restart_interval >> 8);
+            h[1] = static_cast<uint8_t>(scan.restart_interval);
+            h[2] = 0xff;
+            h[3] = 0xff;
+            h += rfc2435_restart_header_size;
+        }
+        if (offset == 0) {
+            h[0] = 0;
+            h[1] = 0; // 8 bit precision for both tables
+            h[2] = 0;
+            h[3] = sizeof(scan.tables);
+            memcpy(h + rfc2435_table_header_size, scan.tables, sizeof(scan.tables));
+            h += rfc2435_table_header_size + sizeof(scan.tables);
+        }
+
+        const size_t fragment = std::min(scan.scan_size - offset, packet_size - static_cast<size_t>(h - p));
+        memcpy(h, scan.scan + offset, fragment);
+        offset += fragment;
+        write_rtp_header(p, offset == scan.scan_size, false, rtp_jpeg_payload_type, static_cast<uint16_t>(sequence++),
+                         timestamp, ssrc);
+        lengths.push_back(static_cast<uint16_t>(h - p + fragment));
+        count++;
+    }
+    return count;
+}
+
+// Drops and reorders packets in place and sleeps, the way a bad network would. Packets keep
+// their packet_size spacing, so bursts still go out as GSO super packets.
+size_t rtp_sender::impair(size_t packet_count) {
+    std::uniform_real_distribution<float> chance(0, 1);
+    size_t kept = 0;
+    for (size_t i = 0; i < packet_count; i++) {
+        if (chance(random) < options.loss) {
+            continue;
+        }
+        if (kept != i) {
+            memcpy(packets.data() + kept * packet_size, packets.data() + i * packet_size, lengths[i]);
+            lengths[kept] = lengths[i];
+        }
+        kept++;
+    }
+    if (options.jitter.count() > 0) {
+        // only full sized packets trade places, the last may be shorter
+        std::vector<uint8_t> swap_space(packet_size);
+        for (size_t i = 0; i + 2 < kept; i++) {
+            if (chance(random) < 0.01f) {
+                uint8_t *a = packets.data() + i * packet_size;
+                memcpy(swap_space.data(), a, packet_size);
+                memcpy(a, a + packet_size, packet_size);
+                memcpy(a + packet_size, swap_space.data(), packet_size);
+            }
+        }
+        std::uniform_int_distribution<int64_t> delay(0, std::chrono::duration_cast<std::chrono::microseconds>(options.jitter).count());
+        std::this_thread::sleep_for(std::chrono::microseconds(delay(random)));
+    }
+    return kept;
+}
+
+// Spreads the bursts of a frame evenly over span; a burst that is late goes out right away.
+void rtp_sender::send_paced(size_t packet_count, std::chrono::steady_clock::duration span) {
+    const size_t bursts = (packet_count + options.burst - 1) / options.burst;
+    const auto start = std::chrono::steady_clock::now();
+    for (size_t b = 0; b < bursts; b++) {
+        const auto due = start + span * b / bursts;
+        const auto now = std::chrono::steady_clock::now();
+        if (now < due) {
+            std::this_thread::sleep_until(due);
+        } else if (now - due > span / bursts) {
+            late_bursts++;
+        }
+
+        const size_t first = b * options.burst;
+        if (!send_burst(first, std::min<size_t>(options.burst, packet_count - first))) {
+            return;
+        }
+    }
+}
+
+// One system call for the whole burst: a sendmmsg of GSO super packets, or of single packets
+// without GSO. False when the frame should be given up.
+bool rtp_sender::send_burst(size_t first, size_t count) {
+    const size_t per_message = options.gso ? std::min(max_gso_segments, max_gso_bytes / packet_size) : 1;
+
+    mmsghdr messages[max_gso_segments];
+    iovec iovs[max_gso_segments];
+    alignas(cmsghdr) uint8_t controls[max_gso_segments][CMSG_SPACE(sizeof(uint16_t))];
+    size_t message_count = 0;
+    for (size_t i = 0; i < count; i += per_message) {
+        const size_t n = std::min(per_message, count - i);
+        const size_t last = first + i + n - 1;
+
+        auto& m = messages[message_count];
+        memset(&m, 0, sizeof(m));
+        iovs[message_count] = {packets.data() + (first + i) * packet_size, (n - 1) * packet_size + lengths[last]};
+        m.msg_hdr.msg_iov = &iovs[message_count];
+        m.msg_hdr.msg_iovlen = 1;
+        if (n > 1) {
+            m.msg_hdr.msg_control = controls[message_count];
+            m.msg_hdr.msg_controllen = CMSG_SPACE(sizeof(uint16_t));
+            cmsghdr *cmsg = CMSG_FIRSTHDR(&m.msg_hdr);
+            cmsg->cmsg_level = SOL_UDP;
+            cmsg->cmsg_type = UDP_SEGMENT;
+            cmsg->cmsg_len = CMSG_LEN(sizeof(uint16_t));
+            const uint16_t segment = static_cast<uint16_t>(packet_size);
+            memcpy(CMSG_DATA(cmsg), &segment, sizeof(segment));
+        }
+        message_count++;
+    }
+
+    size_t sent = 0;
+    while (sent < message_count) {
+        const int r = sendmmsg(sock, messages + sent, static_cast<unsigned>(message_count - sent), 0);
+        if (r > 0) {
+            sent += static_cast<size_t>(r);
+            continue;
+        }
+        if (errno == EINTR) {
+            continue;
+        }
+        if (options.gso && sent == 0 && (errno == EIO || errno == EINVAL || errno == ENOPROTOOPT || errno == EOPNOTSUPP)) {
+            // a kernel or device without UDP segmentation offload
+            std::cerr << "RTP: UDP GSO unavailable (" << strerror(errno) << "), sending packet batches" << std::endl;
+            options.gso = false;
+            return send_burst(first, count);
+        }
+        // nobody listening yet shows up as ECONNREFUSED on a connected socket
+        send_errors++;
+        return errno == ECONNREFUSED;
+    }
+    packets_sent += count;
+    return true;
+}
+
+// what a receiver needs to know that RTP doesn't carry
+// SDP's exactframerate: an integer, or a ratio like 30000/1001 for the NTSC rates
+static std::string sdp_frame_rate(float rate) {
+    const long whole = std::lround(rate);
+    if (std::fabs(rate - whole) < 0.001) {
+        return std::to_string(whole);
+    }
+    const long ntsc = std::lround(rate * 1.001);
+    if (std::fabs(rate - ntsc / 1.001) < 0.001) {
+        return std::to_string(ntsc * 1000) + "/1001";
+    }
+    const long thousandths = std::lround(rate * 1000);
+    const long divisor = std::gcd(thousandths, 1000L);
+    return std::to_string(thousandths / divisor) + "/" + std::to_string(1000 / divisor);
+}
+
+void rtp_sender::print_sdp(uint8_t payload_type, uint32_t width, uint32_t height) const {
+    std::cout << "RTP SDP:\n"
+              << "m=video " << options.destination.substr(options.destination.rfind(':') + 1) << " RTP/AVP "
+              << static_cast<int>(payload_type) << std::endl;
+    if (payload_type == rtp_jpeg_payload_type) {
+        // static payload type, JPEG carries its own size
+        return;
+    }
+    std::cout << "a=rtpmap:" << static_cast<int>(rtp_raw_payload_type) << " raw/" << rtp_clock_rate << "\n"
+              << "a=fmtp:" << static_cast<int>(rtp_raw_payload_type) << " sampling=YCbCr-4:2:2; width=" << width
+              << "; height=" << height << "; exactframerate=" << sdp_frame_rate(frame_rate) << "; depth=8; colorimetry=BT601-5; PM=2110GPM"
+              << std::endl;
+}
+
+void rtp_sender::report() {
+    const uint64_t frames = frames_sent.exchange(0), sent = packets_sent.exchange(0);
+    std::cout << "RTP: " << frames << " frames in " << sent << " packets, " << sent * packet_size * 8 / 1e6
+              << " Mbit/s, " << frames_skipped.exchange(0) << " skipped, " << late_bursts.exchange(0)
+              << " late bursts, " << send_errors.exchange(0) << " send errors" << std::endl;
+}
@@ -0,0 +1,90 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+#include "rtp_jpeg.h"
+#include "video_frame.h"
+
+struct rtp_options {
+    std::string destination;  // host:port, unicast or multicast
+    uint32_t mtu = 1500;      // IP packet size; 9000 on jumbo frame networks
+    uint32_t burst = 32;      // packets sent back to back at line rate with GSO, at most 64
+    float pacing = 0.8f;      // share of the frame interval a frame is spread over
+    bool gso = true;          // let the kernel split each burst (UDP_SEGMENT)
+    bool jpeg = false;        // compress uncompressed frames to RFC 2435 JPEG instead
+    int jpeg_quality = 80;
+
+    // for testing receivers: drop this share of packets, delay each frame by up to jitter and
+    // swap a few neighbouring packets meanwhile
+    float loss = 0;
+    std::chrono::milliseconds jitter{0};
+};
+
+// Streams video as RTP. Uncompressed frames go out as RFC 4175 8 bit YCbCr 4:2:2, lines cut
+// into equally sized packets, or as RFC 2435 JPEG when asked to; MJPEG captures pass through as
+// RFC 2435. Each frame is spread evenly over most of its frame interval in bursts of a few dozen
+// packets, so a 2 Gbit/s 1080p60 stream doesn't overrun switch buffers; a burst goes out in one
+// system call, as a UDP GSO super packet or a sendmmsg batch. The RTP timestamp is the capture
+// time on a 90 kHz clock.
+//
+// push() only copies; conversion, packetizing and pacing run on a thread of its own. Frames that
+// come in while one is still going out replace each other, only the newest is sent next.
+class rtp_sender {
+public:
+    rtp_sender(const rtp_options& options, float frame_rate);
+    ~rtp_sender();
+
+    bool is_open() const { return sock >= 0; }
+
+    // call on the producer thread, e.g. from a frame sink
+    void push(const video_frame& frame);
+
+    // prints what happened since the last report
+    void report();
+
+private:
+    void send_loop();
+    size_t packetize(uint32_t width, uint32_t height, uint32_t timestamp);
+    size_t packetize_jpeg(const rtp_jpeg_scan& scan, uint32_t timestamp);
+    size_t impair(size_t packet_count);
+    void send_paced(size_t packet_count, std::chrono::steady_clock::duration span);
+    bool send_burst(size_t first, size_t count);
+    void print_sdp(uint8_t payload_type, uint32_t width, uint32_t height) const;
+
+    rtp_options options;
+    float frame_rate;
+    int sock = -1;
+    size_t packet_size; // UDP payload of every packet but a frame's last
+
+    std::mutex pending_mutex;
+    std::condition_variable pending_cv;
+    std::vector<uint8_t> pending_data;
+    video_frame pending;
+    bool have_pending = false;
+    bool stopping = false;
+    std::thread send_thread;
+
+    // owned by the send thread
+    std::vector<uint8_t> uyvy;
+    std::vector<uint8_t> packets; // packet_size apart
+    std::vector<uint16_t> lengths;
+    uint32_t sequence;
+    uint32_t ssrc;
+    uint32_t timestamp_offset;
+    std::mt19937 random; // for impairments
+    uint8_t sdp_payload_type = 0;
+    uint32_t sdp_width = 0, sdp_height = 0;
+
+    std::atomic<uint64_t> frames_sent{0};
+    std::atomic<uint64_t> packets_sent{0};
+    std::atomic<uint64_t> frames_skipped{0};
+    std::atomic<uint64_t> late_bursts{0};
+    std::atomic<uint64_t> send_errors{0};
+};
@@ -0,0 +1,578 @@
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <stdexcept>
+#include <poll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include "rtp_jpeg.h"
+#include "rtp_source.h"
+
+static constexpr size_t receive_batch = 64;
+static constexpr size_t max_packet = 9216; // jumbo frames
+
+// frames coming in at once; a new one replaces the oldest beyond that
+static constexpr size_t max_assemblies = 4;
+
+// Output slots: the published frame, the one the renderer may still be uploading and the
+// jitter buffer; it holds at most what the others leave.
+static constexpr size_t output_slots = 12;
+static constexpr size_t max_waiting = output_slots - 3;
+
+// how far back the fastest transit and the spread of arrivals are taken from
+static constexpr auto transit_window = std::chrono::seconds(5);
+static constexpr auto jitter_window = std::chrono::seconds(2);
+static constexpr auto delay_margin = std::chrono::milliseconds(2);
+// how fast the delay comes down once arrivals settle, per frame
+static constexpr auto delay_decay = std::chrono::microseconds(500);
+
+static constexpr auto stall_timeout = std::chrono::seconds(1);
+
+// a timestamp further than this from the last one is a new stream, not loss or reordering
+static constexpr int32_t max_timestamp_jump = 10 * rtp_clock_rate;
+
+rtp_source::rtp_source(const std::string& address, int w, int h, std::chrono::milliseconds min_delay_,
+                       std::chrono::milliseconds max_delay_)
+        : width(w), height(h), min_delay(min_delay_),
+          max_delay(std::max(max_delay_, min_delay_)), assemblies(max_assemblies), slots(output_slots), delay(min_delay) {
+    sock = open_udp_receiver(address);
+    if (sock < 0) {
+        throw std::runtime_error("Cannot receive RTP on " + address);
+    }
+    receive_buffer.resize(receive_batch * max_packet);
+
+    std::cout << "RTP video source: " << address << ", raw video " << width << "x" << height << ", playout delay "
+              << std::chrono::duration_cast<std::chrono::milliseconds>(min_delay).count() << " to "
+              << std::chrono::duration_cast<std::chrono::milliseconds>(max_delay).count() << " ms" << std::endl;
+
+    std::thread th(&rtp_source::receive_fun, this);
+    swap(th, receive_thread);
+}
+
+rtp_source::~rtp_source() {
+    do_work = false;
+    if (receive_thread.joinable()) {
+        receive_thread.join();
+    }
+    close(sock);
+}
+
+capture_health rtp_source::health() const {
+    std::lock_guard<std::mutex> lock(health_mutex);
+    return stats;
+}
+
+void rtp_source::receive_fun() {
+    mmsghdr messages[receive_batch];
+    iovec iovs[receive_batch];
+    fps.start();
+    last_frame = clock::now();
+
+    while (do_work) {
+        // sleep until a packet comes in or the next frame is due
+        auto now = clock::now();
+        auto wake = now + std::chrono::milliseconds(50);
+        if (!waiting.empty()) {
+            wake = std::min(wake, due(waiting.front().rtp_ns));
+        }
+        for (const auto& a: assemblies) {
+            if (!a.active || transits.empty()) {
+                continue;
+            }
+            // when due only if conceal_overdue() can do something then, else when it is dropped
+            const bool concealable = !a.concealed && a.rtp_ns > shown_rtp_ns && shown.data;
+            wake = std::min(wake, concealable ? due(a.rtp_ns) : due(a.rtp_ns) + max_delay);
+        }
+        const auto timeout = std::chrono::duration_cast<std::chrono::nanoseconds>(std::max(wake - now, clock::duration(0)));
+        const timespec ts = {static_cast<time_t>(timeout.count() / 1000000000), static_cast<long>(timeout.count() % 1000000000)};
+        pollfd pfd = {sock, POLLIN, 0};
+        const int r = ppoll(&pfd, 1, &ts, nullptr);
+        if (r < 0 && errno != EINTR) {
+            perror("ppoll");
+            break;
+        }
+
+        // a bounded number of batches, so due frames don't wait for a busy socket
+        for (int batch = 0; r > 0 && batch < 16; batch++) {
+            memset(messages, 0, sizeof(messages));
+            for (size_t i = 0; i < receive_batch; i++) {
+                iovs[i] = {receive_buffer.data() + i * max_packet, max_packet};
+                messages[i].msg_hdr.msg_iov = &iovs[i];
+                messages[i].msg_hdr.msg_iovlen = 1;
+            }
+            const int n = recvmmsg(sock, messages, receive_batch, MSG_DONTWAIT, nullptr);
+            if (n <= 0) {
+                break;
+            }
+            now = clock::now();
+            for (int i = 0; i < n; i++) {
+                rtp_packet packet;
+                if (parse_rtp(static_cast<const uint8_t *>(iovs[i].iov_base), messages[i].msg_len, packet)) {
+                    add_packet(packet, now);
+                }
+            }
+            if (n < static_cast<int>(receive_batch)) {
+                break;
+            }
+        }
+
+        now = clock::now();
+        publish_due(now);
+        conceal_overdue(now);
+
+        if (now - last_frame > stall_timeout) {
+            bool new_stall;
+            {
+                std::lock_guard<std::mutex> lock(health_mutex);
+                new_stall = !stats.stalled;
+                if (new_stall) {
+                    stats.stalled = true;
+                    stats.stalls++;
+                }
+            }
+            if (new_stall) {
+                std::cout << "RTP stream stalled, no frame for "
+                          << std::chrono::duration<float, std::milli>(now - last_frame).count() << " ms" << std::endl;
+            }
+        }
+        if (fps.updated()) {
+            report();
+        }
+    }
+}
+
+void rtp_source::add_packet(const rtp_packet& packet, clock::time_point now) {
+    const bool jpeg = packet.payload_type == rtp_jpeg_payload_type;
+    if (!jpeg && packet.payload_type < 96) {
+        return;
+    }
+
+    // a restarted sender comes back with new SSRC, sequence numbers and timestamps
+    const int32_t jump = static_cast<int32_t>(packet.timestamp - last_timestamp);
+    if (have_ssrc && packet.ssrc != ssrc) {
+        restart_stream("new SSRC");
+    } else if (have_timestamp && (jump > max_timestamp_jump || jump < -max_timestamp_jump)) {
+        restart_stream("timestamp jump");
+    }
+    ssrc = packet.ssrc;
+    have_ssrc = true;
+
+    // 16 bit sequence numbers and 32 bit timestamps unwrapped; reordered packets don't move them back
+    uint32_t sequence;
+    if (!have_sequence) {
+        sequence = first_sequence = highest_sequence = 0x10000u + packet.sequence;
+        have_sequence = true;
+    } else {
+        sequence = highest_sequence + static_cast<int16_t>(packet.sequence - static_cast<uint16_t>(highest_sequence));
+        highest_sequence = std::max(highest_sequence, sequence);
+    }
+    received_packets++;
+
+    int64_t timestamp = 0;
+    if (have_timestamp) {
+        timestamp = unwrapped_timestamp + static_cast<int32_t>(packet.timestamp - last_timestamp);
+        if (timestamp > unwrapped_timestamp) {
+            unwrapped_timestamp = timestamp;
+            last_timestamp = packet.timestamp;
+        }
+    } else {
+        last_timestamp = packet.timestamp;
+        have_timestamp = true;
+    }
+    const int64_t rtp_ns = timestamp * 100000 / 9;
+
+    // a frame's last packet tells how late it came, whether or not it is too late to show
+    if (packet.marker) {
+        update_delay(rtp_ns, now);
+    }
+
+    assembly *a = find_assembly(packet.timestamp, rtp_ns);
+    if (!a && now - last_frame > stall_timeout) {
+        // nothing shown for a while and everything late: the sender went back in time
+        restart_stream("timestamps went back");
+        add_packet(packet, now);
+        return;
+    }
+    if (!a) {
+        late_packets++;
+        return;
+    }
+    if (!a->active) {
+        // the buffers are kept, a raw frame overwrites all of its predecessor
+        std::vector<uint8_t> data;
+        std::vector<uint32_t> sequences, line_bytes;
+        swap(data, a->data);
+        swap(sequences, a->sequences);
+        swap(line_bytes, a->line_bytes);
+        *a = {};
+        swap(data, a->data);
+        swap(sequences, a->sequences);
+        swap(line_bytes, a->line_bytes);
+        a->sequences.clear();
+        std::fill(a->line_bytes.begin(), a->line_bytes.end(), 0);
+        a->active = true;
+        a->timestamp = packet.timestamp;
+        a->rtp_ns = rtp_ns;
+        a->jpeg = jpeg;
+
+        // frames are hardly ever lost whole, the step to the previous one is mostly an interval
+        if (previous_start_ns >= 0 && rtp_ns > previous_start_ns) {
+            const float rate = 1e9f / static_cast<float>(rtp_ns - previous_start_ns);
+            if (rate > 1 && rate < 1000) {
+                const float measured = measured_rate;
+                measured_rate = measured > 0 ? measured * 0.95f + rate * 0.05f : rate;
+            }
+        }
+        previous_start_ns = std::max(previous_start_ns, rtp_ns);
+    } else if (a->jpeg != jpeg) {
+        return;
+    }
+
+    const bool first = jpeg ? add_jpeg(*a, packet) : add_raw(*a, packet);
+    a->sequences.push_back(sequence);
+    if (first) {
+        a->have_first = true;
+        a->first = sequence;
+    }
+    if (packet.marker) {
+        a->have_last = true;
+        a->last = sequence;
+    }
+    try_complete(*a, now);
+}
+
+// The assembly packets of this timestamp go to, a new one for a new timestamp. Null for
+// packets of frames that were shown or given up already.
+rtp_source::assembly *rtp_source::find_assembly(uint32_t timestamp, int64_t rtp_ns) {
+    assembly *free_slot = nullptr;
+    assembly *oldest = nullptr;
+    for (auto& a: assemblies) {
+        if (a.active && a.timestamp == timestamp) {
+            return &a;
+        }
+        if (!a.active) {
+            free_slot = &a;
+        } else if (!oldest || a.rtp_ns < oldest->rtp_ns) {
+            oldest = &a;
+        }
+    }
+    if (rtp_ns <= shown_rtp_ns) {
+        return nullptr;
+    }
+    if (!free_slot) {
+        // packets of several frames ahead: the oldest one isn't going to make it
+        oldest->active = false;
+        dropped_frames++;
+        free_slot = oldest;
+    }
+    return free_slot;
+}
+
+// Writes the packet's line segments into the frame; true for the frame's first packet.
+bool rtp_source::add_raw(assembly& a, const rtp_packet& packet) {
+    const size_t frame_size = static_cast<size_t>(width) * height * 2;
+    if (a.data.size() != frame_size) {
+        a.data.resize(frame_size);
+    }
+    if (a.line_bytes.size() != height) {
+        a.line_bytes.assign(height, 0);
+    }
+    bool first = false, outside = false;
+    for_each_rfc4175_segment(packet.payload, packet.payload_size,
+                             [&](uint32_t line, uint32_t offset, const uint8_t *data, uint32_t bytes) {
+        if (line == 0 && offset == 0) {
+            first = true;
+        }
+        if (line >= height || offset * 2 + bytes > width * 2) {
+            outside = true;
+            return;
+        }
+        memcpy(a.data.data() + (static_cast<size_t>(line) * width + offset) * 2, data, bytes);
+        a.line_bytes[line] += bytes;
+    });
+    if (outside && !warned_format) {
+        std::cerr << "RTP: raw video is larger than " << width << "x" << height << ", set the geometry to what the sender's SDP says" << std::endl;
+        warned_format = true;
+    }
+    return first;
+}
+
+// Puts the fragment at its offset in the scan; true for the frame's first packet.
+bool rtp_source::add_jpeg(assembly& a, const rtp_packet& packet) {
+    const uint8_t *p = packet.payload;
+    const uint8_t *end = p + packet.payload_size;
+    if (packet.payload_size < rfc2435_header_size) {
+        return false;
+    }
+    const size_t offset = (p[1] << 16) | (p[2] << 8) | p[3];
+    const uint8_t type = p[4], q = p[5];
+    if ((type & 0x3f) > 1 || type >= 128 || q == 0) {
+        if (!warned_format) {
+            std::cerr << "RTP: can't play JPEG of type " << static_cast<int>(type) << " with Q " << static_cast<int>(q) << std::endl;
+            warned_format = true;
+        }
+        return false;
+    }
+    a.type = type;
+    a.width = p[6] * 8u;
+    a.height = p[7] * 8u;
+    p += rfc2435_header_size;
+
+    if (type >= 64) {
+        if (end - p < static_cast<ptrdiff_t>(rfc2435_restart_header_size)) {
+            return false;
+        }
+        a.restart_interval = static_cast<uint16_t>((p[0] << 8) | p[1]);
+        p += rfc2435_restart_header_size;
+    }
+    if (offset == 0) {
+        if (q >= 128) {
+            if (end - p < static_cast<ptrdiff_t>(rfc2435_table_header_size)) {
+                return false;
+            }
+            const uint8_t precision = p[1];
+            const size_t length = (p[2] << 8) | p[3];
+            p += rfc2435_table_header_size;
+            // only 8 bit tables, luma then chroma
+            if (precision == 0 && length >= sizeof(a.tables) && end - p >= static_cast<ptrdiff_t>(length)) {
+                memcpy(a.tables, p, sizeof(a.tables));
+                a.have_tables = true;
+            }
+            p += std::min<size_t>(length, end - p);
+        } else {
+            make_rtp_jpeg_tables(q, a.tables);
+            a.have_tables = true;
+        }
+    }
+
+    const size_t fragment = end - p;
+    if (a.data.size() < offset + fragment) {
+        a.data.resize(offset + fragment);
+    }
+    memcpy(a.data.data() + offset, p, fragment);
+    if (packet.marker) {
+        a.scan_size = offset + fragment;
+    }
+    return offset == 0;
+}
+
+// A frame is complete with its first and marked packets and every sequence number in between.
+void rtp_source::try_complete(assembly& a, clock::time_point now) {
+    if (!a.have_first || !a.have_last || a.last < a.first) {
+        return;
+    }
+    const size_t expected = a.last - a.first + 1;
+    if (a.sequences.size() < expected) {
+        return;
+    }
+    std::sort(a.sequences.begin(), a.sequences.end());
+    a.sequences.erase(std::unique(a.sequences.begin(), a.sequences.end()), a.sequences.end());
+    if (a.sequences.size() != expected || a.sequences.front() != a.first || a.sequences.back() != a.last) {
+        return;
+    }
+    if (a.jpeg && (!a.have_tables || a.scan_size == 0 || a.width == 0 || a.height == 0)) {
+        return;
+    }
+    complete(a, now);
+}
+
+void rtp_source::complete(assembly& a, clock::time_point now) {
+    a.active = false;
+    // a concealed frame may still go out, until one after it has
+    if (a.rtp_ns < shown_rtp_ns || (a.rtp_ns == shown_rtp_ns && !a.concealed)) {
+        dropped_frames++;
+        return;
+    }
+
+    video_frame frame = output(a);
+    frame.timestamp = now;
+
+    if (a.concealed) {
+        // the previous frame stood in for it, the real one goes out right away
+        late_frames++;
+        show(frame, a.rtp_ns, now);
+        return;
+    }
+    if (due(a.rtp_ns) < now) {
+        late_frames++;
+    }
+
+    auto at = std::upper_bound(waiting.begin(), waiting.end(), a.rtp_ns,
+                               [](int64_t ns, const ready_frame& f) { return ns < f.rtp_ns; });
+    waiting.insert(at, {a.rtp_ns, frame});
+    if (waiting.size() > max_waiting) {
+        // out of slots, the oldest goes out early
+        show(waiting.front().frame, waiting.front().rtp_ns, now);
+        waiting.pop_front();
+    }
+}
+
+// Moves a frame into the next output slot, the returned frame points there.
+video_frame rtp_source::output(assembly& a) {
+    auto& out = slots[next_slot];
+    next_slot = (next_slot + 1) % slots.size();
+
+    video_frame frame;
+    if (a.jpeg) {
+        out.clear();
+        write_jpeg_headers(a.type, a.width, a.height, a.tables, a.restart_interval, out);
+        out.insert(out.end(), a.data.begin(), a.data.begin() + static_cast<ptrdiff_t>(std::min(a.scan_size, a.data.size())));
+        out.push_back(0xff);
+        out.push_back(0xd9);
+        frame.width = a.width;
+        frame.height = a.height;
+        frame.pixel_format = V4L2_PIX_FMT_MJPEG;
+        set_plane_layout(frame, 0);
+    } else {
+        // the frame is published as it came, the display converts what it shows
+        swap(out, a.data);
+        frame.width = width;
+        frame.height = height;
+        frame.pixel_format = V4L2_PIX_FMT_UYVY;
+        set_plane_layout(frame, width * 2);
+    }
+    frame.data = out.data();
+    frame.size = out.size();
+    return frame;
+}
+
+// Adapts the playout delay to how much later than the fastest recent frame this one came in.
+// Takes the arrival of a frame's marker packet.
+void rtp_source::update_delay(int64_t rtp_ns, clock::time_point now) {
+    const int64_t transit = std::chrono::duration_cast<std::chrono::nanoseconds>(now.time_since_epoch()).count() - rtp_ns;
+    transits.emplace_back(now, transit);
+    while (now - transits.front().first > transit_window) {
+        transits.pop_front();
+    }
+
+    int64_t fastest = transit, slowest = transit;
+    for (const auto& t: transits) {
+        fastest = std::min(fastest, t.second);
+        if (now - t.first <= jitter_window) {
+            slowest = std::max(slowest, t.second);
+        }
+    }
+    base_transit = fastest;
+
+    const auto spread = std::chrono::nanoseconds(slowest - fastest) + delay_margin;
+    const auto target = std::min(std::max<clock::duration>(spread, min_delay), max_delay);
+    delay = target > delay ? target : std::max(target, delay - delay_decay);
+}
+
+// Forgets the stream to take the next packet as the first of a new one. The frame on screen
+// stays for concealment.
+void rtp_source::restart_stream(const char *reason) {
+    if (have_sequence) {
+        std::cout << "RTP stream restarted, " << reason << std::endl;
+    }
+    have_ssrc = have_sequence = have_timestamp = false;
+    unwrapped_timestamp = 0;
+    received_packets = reported_lost = 0;
+    transits.clear();
+    base_transit = 0;
+    delay = min_delay;
+    previous_start_ns = shown_rtp_ns = -1;
+    for (auto& a: assemblies) {
+        a.active = false;
+    }
+    waiting.clear();
+}
+
+rtp_source::clock::time_point rtp_source::due(int64_t rtp_ns) const {
+    return clock::time_point(std::chrono::nanoseconds(rtp_ns + base_transit)) + delay;
+}
+
+void rtp_source::publish_due(clock::time_point now) {
+    while (!waiting.empty() && due(waiting.front().rtp_ns) <= now) {
+        show(waiting.front().frame, waiting.front().rtp_ns, now);
+        waiting.pop_front();
+    }
+}
+
+// Frames still missing packets when due: raw ones go out with the missing lines from the frame
+// on screen, for JPEG the previous frame goes out again; those are given up once even the
+// longest delay has passed.
+void rtp_source::conceal_overdue(clock::time_point now) {
+    if (transits.empty()) {
+        return;
+    }
+    // oldest first, frames go out in order
+    assembly *order[max_assemblies];
+    size_t count = 0;
+    for (auto& a: assemblies) {
+        if (a.active) {
+            order[count++] = &a;
+        }
+    }
+    std::sort(order, order + count, [](const assembly *x, const assembly *y) { return x->rtp_ns < y->rtp_ns; });
+
+    for (size_t i = 0; i < count; i++) {
+        assembly& a = *order[i];
+        const auto frame_due = due(a.rtp_ns);
+        if (!a.concealed && frame_due <= now && a.rtp_ns > shown_rtp_ns && shown.data) {
+            concealed_frames++;
+            if (!a.jpeg && shown.pixel_format == V4L2_PIX_FMT_UYVY && shown.width == width && shown.height == height) {
+                // raw lines that didn't come are taken from the frame on screen
+                const size_t line_size = static_cast<size_t>(width) * 2;
+                for (uint32_t line = 0; line < height; line++) {
+                    if (a.line_bytes[line] < line_size) {
+                        memcpy(a.data.data() + line * line_size, shown.data + line * line_size, line_size);
+                    }
+                }
+                a.active = false;
+                video_frame frame = output(a);
+                frame.timestamp = now;
+                show(frame, a.rtp_ns, now);
+                continue;
+            }
+            // the previous frame once more, while this one may still complete
+            a.concealed = true;
+            video_frame repeat = shown;
+            repeat.timestamp = now;
+            show(repeat, a.rtp_ns, now);
+        }
+        if (now - frame_due >= max_delay) {
+            a.active = false;
+            dropped_frames++;
+        }
+    }
+}
+
+void rtp_source::show(const video_frame& frame, int64_t rtp_ns, clock::time_point now) {
+    publish(frame);
+    shown = frame;
+    shown_rtp_ns = rtp_ns;
+    fps.add_frame();
+
+    float outage_ms = std::chrono::duration<float, std::milli>(now - last_frame).count();
+    bool was_stalled;
+    {
+        std::lock_guard<std::mutex> lock(health_mutex);
+        was_stalled = stats.stalled;
+        if (was_stalled) {
+            stats.stalled = false;
+            stats.recoveries++;
+            stats.last_recovery_ms = outage_ms;
+            stats.max_recovery_ms = std::max(stats.max_recovery_ms, outage_ms);
+        }
+    }
+    last_frame = now;
+    if (was_stalled) {
+        std::cout << "RTP stream back after " << outage_ms << " ms without frames" << std::endl;
+    }
+}
+
+void rtp_source::report() {
+    // what RFC 3550 calls cumulative lost: expected by sequence numbers less received
+    const uint64_t expected = have_sequence ? highest_sequence - first_sequence + 1 : 0;
+    const uint64_t lost = expected > received_packets ? expected - received_packets : 0;
+    std::cout << "RTP source fps: " << fps.count() << ", delay "
+              << std::chrono::duration<float, std::milli>(delay).count() << " ms, " << lost - std::min(lost, reported_lost)
+              << " packets lost, " << concealed_frames << " frames concealed, " << late_frames << " late, "
+              << dropped_frames << " dropped, " << late_packets << " late packets" << std::endl;
+    reported_lost = lost;
+    concealed_frames = late_frames = dropped_frames = late_packets = 0;
+    fps.reset();
+}
@@ -0,0 +1,127 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include "fps_counter.h"
+#include "frame_source.h"
+#include "rtp.h"
+
+// Plays an RTP stream, RFC 4175 raw 4:2:2 as rtp_sender sends it or RFC 2435 JPEG, as a video
+// source. Frames are published as UYVY or MJPEG, the display converts or decodes what it shows,
+// and recording and replay keep them as they came.
+//
+// Packets are placed by their line and offset or fragment offset, so they may come in any order;
+// sequence numbers tell when a frame has them all. Complete frames wait in a jitter buffer and
+// are published at their RTP timestamp plus a playout delay: the delay follows the spread of
+// recent frame arrivals, growing right away when a frame comes late and shrinking slowly. A
+// frame still missing packets when it is due is concealed by publishing the previous frame
+// again; should it complete before a later one is out, it is shown late.
+class rtp_source : public frame_source {
+public:
+    // address: [host]:port to listen on, or a multicast group to join
+    // width, height: of raw video, as the sender's SDP has them; JPEG carries its size
+    // min_delay, max_delay: bounds of the playout delay
+    rtp_source(const std::string& address, int width, int height, std::chrono::milliseconds min_delay,
+               std::chrono::milliseconds max_delay);
+    ~rtp_source() override;
+
+    capture_health health() const override;
+
+    // measured from RTP timestamps, 0 until a few frames came in
+    float frame_rate() const override { return measured_rate; }
+
+private:
+    using clock = std::chrono::steady_clock;
+
+    // a frame whose packets are coming in
+    struct assembly {
+        bool active = false;
+        uint32_t timestamp = 0;
+        int64_t rtp_ns = 0;       // the timestamp unwrapped, in ns since the first one
+        bool jpeg = false;
+        std::vector<uint8_t> data; // UYVY, or the JPEG scan at fragment offsets
+        size_t scan_size = 0;
+        std::vector<uint32_t> sequences;
+        bool have_first = false, have_last = false;
+        uint32_t first = 0, last = 0;
+        std::vector<uint32_t> line_bytes; // raw bytes received per line
+        bool concealed = false;   // the previous frame went out in its place
+
+        // RFC 2435 parameters
+        uint8_t type = 0;
+        uint32_t width = 0, height = 0;
+        uint16_t restart_interval = 0;
+        uint8_t tables[128];
+        bool have_tables = false;
+    };
+
+    // a frame in the jitter buffer, in its output slot
+    struct ready_frame {
+        int64_t rtp_ns;
+        video_frame frame;
+    };
+
+    void receive_fun();
+    void add_packet(const rtp_packet& packet, clock::time_point now);
+    assembly *find_assembly(uint32_t timestamp, int64_t rtp_ns);
+    bool add_raw(assembly& a, const rtp_packet& packet);
+    bool add_jpeg(assembly& a, const rtp_packet& packet);
+    void try_complete(assembly& a, clock::time_point now);
+    void complete(assembly& a, clock::time_point now);
+    video_frame output(assembly& a);
+    void update_delay(int64_t rtp_ns, clock::time_point now);
+    clock::time_point due(int64_t rtp_ns) const;
+    void conceal_overdue(clock::time_point now);
+    void publish_due(clock::time_point now);
+    void show(const video_frame& frame, int64_t rtp_ns, clock::time_point now);
+    void restart_stream(const char *reason);
+    void report();
+
+    int sock = -1;
+    uint32_t width, height;
+    clock::duration min_delay, max_delay;
+    std::thread receive_thread;
+    std::atomic<bool> do_work{true};
+
+    // owned by the receive thread
+    std::vector<uint8_t> receive_buffer;
+    std::vector<assembly> assemblies;
+    std::vector<std::vector<uint8_t>> slots; // published and waiting frames, reused in turn
+    size_t next_slot = 0;
+    std::deque<ready_frame> waiting;         // by RTP timestamp
+    video_frame shown;                       // the last published frame, for concealment
+    int64_t shown_rtp_ns = -1;
+
+    bool have_ssrc = false;
+    uint32_t ssrc = 0;
+    bool have_timestamp = false;
+    uint32_t last_timestamp = 0;
+    int64_t unwrapped_timestamp = 0;
+    bool have_sequence = false;
+    uint32_t highest_sequence = 0, first_sequence = 0;
+
+    // playout: transit is arrival less RTP time, its minimum the fastest a frame got here
+    std::deque<std::pair<clock::time_point, int64_t>> transits;
+    int64_t base_transit = 0;
+    clock::duration delay;
+    int64_t previous_start_ns = -1;
+    std::atomic<float> measured_rate{0};
+
+    fps_counter fps;
+    uint64_t received_packets = 0;
+    uint64_t reported_lost = 0;
+    uint64_t late_packets = 0;
+    uint64_t concealed_frames = 0;
+    uint64_t late_frames = 0;
+    uint64_t dropped_frames = 0;
+    bool warned_format = false;
+
+    clock::time_point last_frame;
+    mutable std::mutex health_mutex;
+    capture_health stats;
+};
@@ -0,0 +1,155 @@
+#include <algorithm>
+#include <cerrno>
+#include <climits>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <csignal>
+#include <fcntl.h>
+#include <linux/futex.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include "shm_publisher.h"
+
+shm_publisher::shm_publisher(const std::string& name_, uint32_t slot_count_)
+        : name(name_[0] == '/' ? name_ : "/" + name_), slot_count(std::max<uint32_t>(slot_count_, 2)) {
+}
+
+shm_publisher::~shm_publisher() {
+    close();
+}
+
+// True when the ring under name is published by a process that is still running.
+static bool ring_in_use(const std::string& name) {
+    const int fd = shm_open(name.c_str(), O_RDONLY | O_CLOEXEC, 0);
+    if (fd < 0) {
+        return false;
+    }
+    struct stat st;
+    void *memory = MAP_FAILED;
+    if (fstat(fd, &st) == 0 && static_cast<size_t>(st.st_size) >= sizeof(shm_ring_header)) {
+        memory = mmap(nullptr, sizeof(shm_ring_header), PROT_READ, MAP_SHARED, fd, 0);
+    }
+    ::close(fd);
+    if (memory == MAP_FAILED) {
+        return false;
+    }
+
+    const auto header = static_cast<const shm_ring_header *>(memory);
+    const pid_t pid = static_cast<pid_t>(header->publisher_pid);
+    const bool in_use = header->magic.load(std::memory_order_acquire) == shm_ring_magic
+                        && header->closed.load(std::memory_order_acquire) == 0 && pid > 0
+                        && (kill(pid, 0) == 0 || errno == EPERM);
+    munmap(memory, sizeof(shm_ring_header));
+    return in_use;
+}
+
+bool shm_publisher::create(size_t frame_size) {
+    close();
+
+    const size_t page = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+    // some headroom, so a slightly bigger compressed frame doesn't replace the ring right away
+    const size_t slot_size = (frame_size + frame_size / 4 + page - 1) / page * page;
+    const size_t data_offset = (sizeof(shm_ring_header) + sizeof(shm_slot) * slot_count + page - 1) / page * page;
+    const size_t size = data_offset + slot_size * slot_count;
+
+    int fd = shm_open(name.c_str(), O_RDWR | O_CREAT | O_EXCL | O_CLOEXEC, 0644);
+    if (fd < 0 && errno == EEXIST) {
+        if (ring_in_use(name)) {
+            std::cerr << "Shared memory " << name << " is published by another running instance, pick another name" << std::endl;
+            return false;
+        }
+        // left behind by a run that didn't get to clean up
+        shm_unlink(name.c_str());
+        fd = shm_open(name.c_str(), O_RDWR | O_CREAT | O_EXCL | O_CLOEXEC, 0644);
+    }
+    if (fd < 0) {
+        perror(("Cannot create shared memory " + name).c_str());
+        return false;
+    }
+
+    if (ftruncate(fd, static_cast<off_t>(size)) != 0) {
+        perror("ftruncate");
+        ::close(fd);
+        shm_unlink(name.c_str());
+        return false;
+    }
+
+    void *memory = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, 0);
+    ::close(fd);
+    if (memory == MAP_FAILED) {
+        perror("mmap");
+        shm_unlink(name.c_str());
+        return false;
+    }
+
+    // a fresh shared memory object reads as zeros, which is an empty ring already
+    header = static_cast<shm_ring_header *>(memory);
+    mapped_size = size;
+    header->version = shm_ring_version;
+    header->slot_count = slot_count;
+    header->slot_size = slot_size;
+    header->data_offset = data_offset;
+    header->publisher_pid = static_cast<uint32_t>(getpid());
+    header->published.store(frame_number, std::memory_order_relaxed);
+    header->magic.store(shm_ring_magic, std::memory_order_release);
+
+    std::cout << "Publishing frames in shared memory " << name << ": " << slot_count << " slots of "
+              << slot_size / 1024 << " KB" << std::endl;
+    return true;
+}
+
+void shm_publisher::close() {
+    if (!header) {
+        return;
+    }
+
+    // readers still holding the old mapping see it closed and reopen the name
+    header->closed.store(1, std::memory_order_release);
+    wake_readers();
+    munmap(header, mapped_size);
+    shm_unlink(name.c_str());
+    header = nullptr;
+}
+
+void shm_publisher::wake_readers() {
+    header->futex.fetch_add(1, std::memory_order_release);
+    syscall(SYS_futex, &header->futex, FUTEX_WAKE, INT_MAX, nullptr, nullptr, 0);
+}
+
+void shm_publisher::publish(const video_frame& frame) {
+    if (!frame.data || failed) {
+        return;
+    }
+    if (!header || frame.size > header->slot_size) {
+        if (!create(frame.size)) {
+            failed = true;
+            return;
+        }
+    }
+
+    const uint64_t number = ++frame_number;
+    const uint32_t index = static_cast<uint32_t>((number - 1) % slot_count);
+    auto& slot = shm_slots(header)[index];
+
+    const uint64_t lock = slot.lock.load(std::memory_order_relaxed);
+    slot.lock.store(lock + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+
+    memcpy(shm_slot_data(header, index), frame.data, frame.size);
+    slot.number = number;
+    slot.sequence = frame.sequence;
+    slot.timestamp_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(frame.timestamp.time_since_epoch()).count();
+    slot.size = frame.size;
+    slot.width = frame.width;
+    slot.height = frame.height;
+    slot.pixel_format = frame.pixel_format;
+    slot.plane_count = frame.plane_count;
+    memcpy(slot.planes, frame.planes, sizeof(slot.planes));
+
+    slot.lock.store(lock + 2, std::memory_order_release);
+    header->published.store(number, std::memory_order_release);
+    wake_readers();
+}
@@ -0,0 +1,31 @@
+#pragma once
+
+#include <string>
+#include "shm_ring.h"
+
+// Publishes frames to other processes on the host through a POSIX shared memory ring, for
+// consumers that can't open the camera while we hold it. Each frame is copied into the next
+// slot of the ring and readers are woken through a futex. Readers only map the ring read only
+// and are never waited for: one too slow to keep up finds its slot rewritten and skips ahead.
+// The ring is sized by the first frame and replaced when a larger one comes along.
+class shm_publisher {
+public:
+    shm_publisher(const std::string& name, uint32_t slot_count = 4);
+    ~shm_publisher();
+
+    // call on the producer thread, e.g. from a frame sink
+    void publish(const video_frame& frame);
+
+private:
+    bool create(size_t frame_size);
+    void close();
+    void wake_readers();
+
+    std::string name;
+    uint32_t slot_count;
+
+    shm_ring_header *header = nullptr;
+    size_t mapped_size = 0;
+    uint64_t frame_number = 0;
+    bool failed = false;
+};
@@ -0,0 +1,186 @@
+#include <algorithm>
+#include <cerrno>
+#include <ctime>
+#include <fcntl.h>
+#include <linux/futex.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include "shm_reader.h"
+
+shm_reader::shm_reader(const std::string& name_) : name(name_[0] == '/' ? name_ : "/" + name_) {
+    open();
+}
+
+shm_reader::~shm_reader() {
+    unmap();
+}
+
+bool shm_reader::open() {
+    const int fd = shm_open(name.c_str(), O_RDONLY | O_CLOEXEC, 0);
+    if (fd < 0) {
+        return false;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) != 0 || static_cast<size_t>(st.st_size) < sizeof(shm_ring_header)) {
+        ::close(fd);
+        return false;
+    }
+
+    void *memory = mmap(nullptr, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    ::close(fd);
+    if (memory == MAP_FAILED) {
+        return false;
+    }
+
+    // the publisher sets the magic last; until then, or for a ring of another version, try later
+    auto ring = static_cast<shm_ring_header *>(memory);
+    const size_t size = static_cast<size_t>(st.st_size);
+    if (ring->magic.load(std::memory_order_acquire) != shm_ring_magic || ring->version != shm_ring_version
+        || ring->data_offset + ring->slot_size * ring->slot_count > size) {
+        munmap(memory, size);
+        return false;
+    }
+
+    header = ring;
+    mapped_size = size;
+    return true;
+}
+
+void shm_reader::unmap() {
+    if (header) {
+        munmap(header, mapped_size);
+        header = nullptr;
+    }
+}
+
+bool shm_reader::ensure_open() {
+    if (header && header->closed.load(std::memory_order_acquire)) {
+        unmap();
+    }
+    return header || open();
+}
+
+bool shm_reader::wait(std::chrono::milliseconds timeout) {
+    const auto deadline = std::chrono::steady_clock::now() + timeout;
+    while (true) {
+        const auto left = deadline - std::chrono::steady_clock::now();
+        if (!ensure_open()) {
+            // nobody publishing yet, poll for the ring to appear
+            if (left <= std::chrono::steady_clock::duration::zero()) {
+                return false;
+            }
+            usleep(static_cast<useconds_t>(std::min<int64_t>(
+                    std::chrono::duration_cast<std::chrono::microseconds>(left).count(), 10000)));
+            continue;
+        }
+
+        // the futex value is read before checking, so a frame published in between changes it
+        const uint32_t value = header->futex.load(std::memory_order_acquire);
+        if (header->closed.load(std::memory_order_acquire)) {
+            continue;
+        }
+        if (header->published.load(std::memory_order_acquire) > last_number) {
+            return true;
+        }
+        if (left <= std::chrono::steady_clock::duration::zero()) {
+            return false;
+        }
+
+        const auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(left).count();
+        timespec relative{static_cast<time_t>(ns / 1000000000), static_cast<long>(ns % 1000000000)};
+        syscall(SYS_futex, &header->futex, FUTEX_WAIT, value, &relative, nullptr, 0);
+    }
+}
+
+bool shm_reader::read_slot(uint64_t number, shm_frame& frame) {
+    const uint32_t index = static_cast<uint32_t>((number - 1) % header->slot_count);
+    const auto& slot = shm_slots(header)[index];
+
+    const uint64_t lock = slot.lock.load(std::memory_order_acquire);
+    if ((lock & 1) || slot.number != number) {
+        return false;
+    }
+
+    video_frame& f = frame.frame;
+    f = video_frame();
+    f.data = shm_slot_data(header, index);
+    f.size = slot.size;
+    f.sequence = slot.sequence;
+    f.width = slot.width;
+    f.height = slot.height;
+    f.pixel_format = slot.pixel_format;
+    f.plane_count = slot.plane_count;
+    for (size_t p = 0; p < video_frame::max_planes; p++) {
+        f.planes[p] = slot.planes[p];
+    }
+    f.timestamp = std::chrono::steady_clock::time_point(
+            std::chrono::duration_cast<std::chrono::steady_clock::duration>(std::chrono::nanoseconds(slot.timestamp_ns)));
+
+    frame.number = number;
+    frame.slot = index;
+    frame.lock = lock;
+
+    // the metadata was only consistent if the publisher didn't touch the slot meanwhile
+    if (!still_valid(frame) || f.size > header->slot_size) {
+        return false;
+    }
+    last_number = number;
+    return true;
+}
+
+bool shm_reader::latest(shm_frame& frame) {
+    if (!ensure_open()) {
+        return false;
+    }
+
+    // a slot rewritten under us just means a newer frame is there to take instead
+    for (int attempt = 0; attempt < 4; attempt++) {
+        const uint64_t newest = header->published.load(std::memory_order_acquire);
+        if (newest == 0 || newest <= last_number) {
+            return false;
+        }
+        if (read_slot(newest, frame)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+bool shm_reader::next(shm_frame& frame) {
+    if (!ensure_open()) {
+        return false;
+    }
+
+    const uint64_t newest = header->published.load(std::memory_order_acquire);
+    if (newest <= last_number) {
+        return false;
+    }
+
+    // the oldest frame still in the ring, one slot is left as margin for the one being written
+    const uint64_t oldest = newest >= header->slot_count ? newest - header->slot_count + 2 : 1;
+    if (last_number + 1 < oldest) {
+        missed_frames += oldest - last_number - 1;
+        last_number = oldest - 1;
+    }
+
+    // a slot rewritten under us, or gone with a replaced ring, is a frame missed
+    for (uint64_t wanted = last_number + 1; wanted <= newest; wanted++) {
+        if (read_slot(wanted, frame)) {
+            return true;
+        }
+        missed_frames++;
+        last_number = wanted;
+    }
+    return false;
+}
+
+bool shm_reader::still_valid(const shm_frame& frame) const {
+    if (!header) {
+        return false;
+    }
+    std::atomic_thread_fence(std::memory_order_acquire);
+    return shm_slots(header)[frame.slot].lock.load(std::memory_order_relaxed) == frame.lock;
+}
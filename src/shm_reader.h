@@ -0,0 +1,55 @@
+#pragma once
+
+#include <chrono>
+#include <string>
+#include "shm_ring.h"
+
+// A frame mapped straight from the ring. Its data stays mapped until the next call on the
+// reader, which may remap a replaced ring, but the publisher starts rewriting the slot once it
+// has gone around the ring; check still_valid() after using it.
+struct shm_frame {
+    video_frame frame; // data points into the shared mapping
+    uint64_t number = 0;
+    uint32_t slot = 0;
+    uint64_t lock = 0;
+};
+
+// Reads frames another process publishes with shm_publisher, without copying them. The ring is
+// mapped read only, so a reader can neither corrupt it nor hold the publisher up. Reopens the
+// ring by name when the publisher replaces it or restarts.
+class shm_reader {
+public:
+    explicit shm_reader(const std::string& name);
+    ~shm_reader();
+
+    // whether the ring is mapped; reading tries to open it again when it isn't
+    bool connected() const { return header != nullptr; }
+
+    // Waits until a frame newer than the last one returned is published, up to timeout.
+    bool wait(std::chrono::milliseconds timeout);
+
+    // The newest frame, skipping anything in between: for viewers and analytics that only care
+    // about now. False when there is nothing newer than the last frame returned.
+    bool latest(shm_frame& frame);
+
+    // The frame after the last one returned: for recorders that want them all. Frames the
+    // publisher overwrote before they were read are skipped and counted in missed().
+    bool next(shm_frame& frame);
+
+    // true while the publisher hasn't started rewriting the frame's slot
+    bool still_valid(const shm_frame& frame) const;
+
+    uint64_t missed() const { return missed_frames; }
+
+private:
+    bool open();
+    void unmap();
+    bool ensure_open();
+    bool read_slot(uint64_t number, shm_frame& frame);
+
+    std::string name;
+    shm_ring_header *header = nullptr;
+    size_t mapped_size = 0;
+    uint64_t last_number = 0;
+    uint64_t missed_frames = 0;
+};
@@ -0,0 +1,53 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include "video_frame.h"
+
+// The layout of the shared memory frame ring that shm_publisher writes and shm_reader maps,
+// under /dev/shm/<name>: this header, then slot_count slot headers, then the frame data of each
+// slot starting at data_offset.
+
+static constexpr uint32_t shm_ring_magic = 0x52465453; // "STFR"
+static constexpr uint32_t shm_ring_version = 1;
+
+// The counters are shared between processes, which needs them lock free.
+static_assert(std::atomic<uint64_t>::is_always_lock_free, "shared memory counters need lock free atomics");
+static_assert(std::atomic<uint32_t>::is_always_lock_free, "shared memory counters need lock free atomics");
+
+struct shm_slot {
+    // Seqlock: odd while the publisher rewrites the slot, even once the frame in it is complete.
+    // A reader that sees the same even value before and after reading had a consistent frame.
+    std::atomic<uint64_t> lock;
+
+    uint64_t number;       // frame number, counting from 1
+    uint64_t sequence;     // capture sequence of the frame
+    int64_t timestamp_ns;  // capture time on CLOCK_MONOTONIC
+    uint64_t size;
+    uint32_t width;
+    uint32_t height;
+    uint32_t pixel_format;
+    uint32_t plane_count;
+    video_plane planes[video_frame::max_planes];
+};
+
+struct shm_ring_header {
+    std::atomic<uint32_t> magic; // set last, once the ring is ready
+    uint32_t version;
+    uint32_t slot_count;
+    uint32_t publisher_pid; // tells a ring left behind by a crash from one in use
+    uint64_t slot_size;   // frame bytes per slot
+    uint64_t data_offset; // from the start of the mapping to the data of slot 0, page aligned
+
+    std::atomic<uint64_t> published; // number of the newest complete frame
+    std::atomic<uint32_t> futex;     // changes with every frame and on close, readers wait on it
+    std::atomic<uint32_t> closed;    // the publisher replaced or removed this ring, reopen by name
+};
+
+inline shm_slot *shm_slots(shm_ring_header *header) {
+    return reinterpret_cast<shm_slot *>(header + 1);
+}
+
+inline uint8_t *shm_slot_data(shm_ring_header *header, uint32_t slot) {
+    return reinterpret_cast<uint8_t *>(header) + header->data_offset + header->slot_size * slot;
+}
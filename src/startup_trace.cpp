@@ -0,0 +1,63 @@
+#include <algorithm>
+#include <iostream>
+#include "startup_trace.h"
+
+startup_trace::startup_trace(clock::time_point start_) : start(start_) {
+}
+
+startup_trace::span::span(startup_trace& trace_, const char *name_) : trace(trace_), name(name_), begin(clock::now()) {
+}
+
+startup_trace::span::~span() {
+    trace.add(name, begin, clock::now());
+}
+
+void startup_trace::add(const char *name, clock::time_point begin, clock::time_point end) {
+    std::lock_guard<std::mutex> lock(entries_mutex);
+    entries.push_back({name, std::this_thread::get_id(), begin, end});
+}
+
+float startup_trace::offset_ms(clock::time_point t) const {
+    return std::chrono::duration<float, std::milli>(t - start).count();
+}
+
+void startup_trace::report(clock::time_point first_frame) {
+    std::lock_guard<std::mutex> lock(entries_mutex);
+    std::sort(entries.begin(), entries.end(), [](const entry& a, const entry& b) { return a.begin < b.begin; });
+
+    std::vector<std::thread::id> threads;
+    std::cout << "Startup:" << std::endl;
+    for (auto& e: entries) {
+        auto t = std::find(threads.begin(), threads.end(), e.thread);
+        if (t == threads.end()) {
+            t = threads.insert(t, e.thread);
+        }
+        std::cout << "\t[thread " << (t - threads.begin()) << "] " << e.name << ": "
+                  << offset_ms(e.begin) << " -> " << offset_ms(e.end) << " ms" << std::endl;
+    }
+
+    // Walk back from the first frame: whatever finished last before a point in time is what
+    // that point waited for, then continue from where that started.
+    std::vector<const entry *> path;
+    clock::time_point until = first_frame;
+    while (true) {
+        const entry *last = nullptr;
+        for (auto& e: entries) {
+            if (e.end <= until && (!last || e.end > last->end)) {
+                last = &e;
+            }
+        }
+        if (!last) {
+            break;
+        }
+        path.push_back(last);
+        until = last->begin;
+    }
+
+    std::cout << "\tcritical path: ";
+    for (auto e = path.rbegin(); e != path.rend(); ++e) {
+        std::cout << (*e)->name << " (" << std::chrono::duration<float, std::milli>((*e)->end - (*e)->begin).count() << " ms)"
+                  << (e + 1 != path.rend() ? " -> " : "");
+    }
+    std::cout << ", first frame at " << offset_ms(first_frame) << " ms" << std::endl;
+}
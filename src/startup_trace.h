@@ -0,0 +1,49 @@
+#pragma once
+
+#include <chrono>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Records what startup spent its time on, on which thread, so the critical path to the first
+// presented frame can be told apart from work that ran alongside it.
+class startup_trace {
+public:
+    using clock = std::chrono::steady_clock;
+
+    explicit startup_trace(clock::time_point start);
+
+    // measures from construction to destruction
+    class span {
+    public:
+        span(startup_trace& trace, const char *name);
+        ~span();
+
+    private:
+        startup_trace& trace;
+        const char *name;
+        clock::time_point begin;
+    };
+
+    span measure(const char *name) { return {*this, name}; }
+
+    void add(const char *name, clock::time_point begin, clock::time_point end);
+
+    // prints every span and the chain of spans that the first frame waited on
+    void report(clock::time_point first_frame);
+
+private:
+    struct entry {
+        std::string name;
+        std::thread::id thread;
+        clock::time_point begin;
+        clock::time_point end;
+    };
+
+    float offset_ms(clock::time_point t) const;
+
+    clock::time_point start;
+    std::mutex entries_mutex;
+    std::vector<entry> entries;
+};
@@ -1,4 +1,8 @@
 #include <iostream>
+#include <cstring>
+#include <ctime>
+#include <future>
+#include <sstream>
 #include <SDL.h>
 
 #include "glad/glad.h"
@@ -6,12 +10,229 @@
 #include "streamer.h"
 #include "pbo.h"
 #include "video_source.h"
+#include "synthetic_source.h"
+#include "rtp_source.h"
 #include "audio_source.h"
+#include "gpu_timer.h"
+#include "frame_pacer.h"
+#include "latency_probe.h"
+#include "frame_checker.h"
+#include "startup_trace.h"
+#include "cache_dir.h"
+#include "string_utils.h"
+#include "replay_buffer.h"
+#include "jpeg_decoder.h"
+#include "shm_publisher.h"
+#include "mjpeg_server.h"
+#include "pixel_convert.h"
 
 using namespace std;
 
-streamer::streamer(const std::string& device_path, const std::string& audio_device, int w, int h) : stream_width(w), stream_height(h) {
+// The upload benchmark result is remembered per GPU and driver, so capture can be started in
+// the matching pixel format before GL is even up.
+static const char *upload_format_cache = "upload-format";
 
+static const char *rtp_scheme = "rtp://";
+
+static bool is_rtp_device(const std::string& device) {
+    return device.compare(0, strlen(rtp_scheme), rtp_scheme) == 0;
+}
+
+static upload_format cached_upload_format(std::string *renderer = nullptr) {
+    const auto lines = split_string(read_cache_file(upload_format_cache), "\n");
+    if (renderer) {
+        *renderer = lines[0];
+    }
+    return lines.size() > 1 && lines[1] == "bgra" ? upload_format::bgra : upload_format::rgb;
+}
+
+static upload_format pick_upload_format(int width, int height) {
+    std::stringstream renderer;
+    renderer << glGetString(GL_VENDOR) << " " << glGetString(GL_RENDERER) << " " << glGetString(GL_VERSION);
+
+    std::string cached_renderer;
+    const auto cached = cached_upload_format(&cached_renderer);
+    if (cached_renderer == renderer.str()) {
+        return cached;
+    }
+
+    const auto picked = pbo::benchmark_upload_formats(width, height);
+    write_cache_file(upload_format_cache, renderer.str() + "\n" + (picked == upload_format::bgra ? "bgra" : "rgb") + "\n");
+    return picked;
+}
+
+streamer::streamer(const streamer_options& options)
+        : stream_width(options.stream_width), stream_height(options.stream_height),
+          geometries(options.geometries), present(options.present), start_time(options.start_time),
+          show_timings(options.show_timings), max_latency_ms(options.max_latency_ms) {
+
+    startup = new startup_trace(start_time);
+
+    // Opening the capture and audio devices blocks in driver calls for a good while. That runs
+    // on worker threads while this thread, which has to own the GL context, sets up GL.
+    const upload_format expected_upload = options.upload == upload_format::automatic ? cached_upload_format() : options.upload;
+    auto pending_video = std::async(std::launch::async, [this, options, expected_upload]() -> frame_source * {
+        auto span = startup->measure("video source");
+        if (options.video_device == "synthetic") {
+            return new synthetic_source(stream_width, stream_height, options.synthetic_fps, options.synthetic_buffers);
+        }
+        if (is_rtp_device(options.video_device)) {
+            // raw video has the size the sender's SDP says, -g has to match it
+            return new rtp_source(options.video_device.substr(strlen(rtp_scheme)), stream_width, stream_height,
+                                  std::chrono::milliseconds(options.rtp_min_delay_ms),
+                                  std::chrono::milliseconds(options.rtp_max_delay_ms));
+        }
+
+        // 4 byte frames straight from the device spare us the expand step
+        uint32_t pixel_format = expected_upload == upload_format::bgra ? V4L2_PIX_FMT_XBGR32 : V4L2_PIX_FMT_RGB24;
+        if (options.mjpeg) {
+            // what the camera compressed stays compressed, libv4l doesn't decode it behind our back
+            pixel_format = V4L2_PIX_FMT_MJPEG;
+        }
+        return new video_source(options.video_device, stream_width, stream_height, pixel_format, options.capture_buffers,
+                                options.memory);
+    });
+
+    if (options.replay_seconds > 0) {
+        auto span = startup->measure("replay arena");
+        replay = new replay_buffer(options.replay_seconds, options.replay_megabytes);
+    }
+
+    const bool record_audio = options.record == record_format::mkv && !options.record_path.empty();
+    if (!options.headless) {
+        pending_audio = std::async(std::launch::async, [this, device = options.audio_device, record_audio]() {
+            auto span = startup->measure("audio source");
+            audio_source::input_sink sink;
+            if (replay || record_audio) {
+                // the recording only starts once video is up, until then this skips it
+                sink = [this](const float *samples, size_t frames, uint32_t channels, uint32_t sample_rate,
+                              std::chrono::steady_clock::time_point timestamp) {
+                    if (replay) {
+                        replay->put_audio(samples, frames, channels, sample_rate, timestamp);
+                    }
+                    if (auto r = audio_recording.load()) {
+                        r->push_audio(samples, frames, channels, sample_rate, timestamp);
+                    }
+                };
+            }
+            return new audio_source(device, sink);
+        });
+    }
+
+    {
+        auto span = startup->measure("sdl/gl");
+        init_gl(options.headless);
+    }
+
+    upload_format upload;
+    {
+        auto span = startup->measure("upload format");
+        upload = options.upload == upload_format::automatic ? pick_upload_format(stream_width, stream_height) : options.upload;
+    }
+    std::cout << "Texture upload format: " << (upload == upload_format::bgra ? "BGRA" : "RGB") << std::endl;
+    if (upload != expected_upload && options.video_device != "synthetic" && !is_rtp_device(options.video_device)) {
+        std::cout << "Capture was started for the cached upload format, frames get converted until the next start" << std::endl;
+    }
+
+    {
+        auto span = startup->measure("gl resources");
+        pbo_ = new pbo(this, stream_width, stream_height, upload);
+
+        if (show_timings) {
+            gpu_timings = new gpu_timer();
+        }
+
+        if (options.measure_latency > 0) {
+            probe = new latency_probe(stream_width, stream_height, options.measure_latency);
+        }
+    }
+
+    display_format = upload == upload_format::bgra ? V4L2_PIX_FMT_XBGR32 : V4L2_PIX_FMT_RGB24;
+    if (options.mjpeg || is_rtp_device(options.video_device)) {
+        // RTP JPEG is decoded like MJPEG capture
+        decoder = new jpeg_decoder(display_format);
+        // nobody looks at a hidden window, so a headless relay never decodes at all
+        display_compressed = !options.headless;
+    }
+
+    try {
+        video = pending_video.get();
+    } catch (const std::runtime_error& e) {
+        std::cerr << "Cannot start video capture: " << e.what() << std::endl;
+        exit(1);
+    }
+    video_ready = startup_trace::clock::now();
+
+    // wake the render loop when a frame arrives; one pending event is enough to do that
+    frame_event_type = SDL_RegisterEvents(1);
+    video->set_frame_callback([this]() {
+        if (!frame_event_pending.exchange(true)) {
+            SDL_Event event;
+            SDL_zero(event);
+            event.type = frame_event_type;
+            SDL_PushEvent(&event);
+        }
+    });
+
+    if (options.check_frames) {
+        checker = new frame_checker();
+    }
+
+    if (!options.record_path.empty()) {
+        audio_track audio_format;
+        if (record_audio) {
+            audio_format = {audio_source::channels, audio_source::sample_rate};
+        }
+        recording = new recorder(options.record_path, options.record, video->frame_rate(), options.encoding, audio_format);
+        if (!recording->is_open()) {
+            exit(1);
+        }
+        audio_recording = recording;
+        recording_sink = video->add_frame_sink([this](const video_frame& frame) {
+            recording->push(frame);
+        });
+    }
+
+    if (replay) {
+        replay_sink = video->add_frame_sink([this](const video_frame& frame) {
+            replay->put_video(frame);
+        });
+    }
+
+    if (!options.shm_name.empty()) {
+        publisher = new shm_publisher(options.shm_name, options.shm_slots);
+        publisher_sink = video->add_frame_sink([this](const video_frame& frame) {
+            publisher->publish(frame);
+        });
+    }
+
+    if (options.http_port) {
+        http = new mjpeg_server(options.http_port, options.jpeg_quality);
+        if (!http->is_open()) {
+            exit(1);
+        }
+        http_sink = video->add_frame_sink([this](const video_frame& frame) {
+            http->push(frame);
+        });
+    }
+
+    if (!options.rtp.destination.empty()) {
+        rtp = new rtp_sender(options.rtp, video->frame_rate());
+        if (!rtp->is_open()) {
+            exit(1);
+        }
+        rtp_sink = video->add_frame_sink([this](const video_frame& frame) {
+            rtp->push(frame);
+        });
+    }
+
+    if (!options.export_socket.empty() && !video->export_buffers(options.export_socket)) {
+        std::cerr << "Cannot export capture buffers on " << options.export_socket << std::endl;
+        exit(1);
+    }
+}
+
+void streamer::init_gl(bool headless) {
     if (SDL_Init(SDL_INIT_VIDEO) < 0) {
         std::cerr << "Failed to init SDL" << std::endl;
         exit(1);
@@ -24,6 +245,9 @@ streamer::streamer(const std::string& device_path, const std::string& audio_devi
     SDL_GL_SetAttribute(SDL_GL_CONTEXT_PROFILE_MASK, SDL_GL_CONTEXT_PROFILE_CORE);
 
     uint32_t flags = SDL_WINDOW_OPENGL | SDL_WINDOW_RESIZABLE;
+    if (headless) {
+        flags |= SDL_WINDOW_HIDDEN;
+    }
     window = SDL_CreateWindow("streamer",
                               SDL_WINDOWPOS_UNDEFINED,
                               SDL_WINDOWPOS_UNDEFINED,
@@ -53,80 +277,241 @@ streamer::streamer(const std::string& device_path, const std::string& audio_devi
     std::cout << "GLSL version: " << glGetString(GL_SHADING_LANGUAGE_VERSION) << std::endl;
     std::cout << "Vendor: " << glGetString(GL_VENDOR) << std::endl;
     std::cout << "Renderer: " << glGetString(GL_RENDERER) << std::endl;
-
-    pbo_ = new pbo(this, stream_width, stream_height);
-    video = new video_source(device_path, stream_width, stream_height);
-    audio = new audio_source(audio_device);
 }
 
 
 streamer::~streamer() {
+    if (pending_audio.valid()) {
+        audio = pending_audio.get();
+    }
+    // audio stops first, its thread feeds the recording and the replay
     delete audio;
+    audio = nullptr;
+    if (recording) {
+        video->remove_frame_sink(recording_sink);
+        delete recording;
+    }
+    if (replay) {
+        video->remove_frame_sink(replay_sink);
+    }
+    if (publisher) {
+        video->remove_frame_sink(publisher_sink);
+        delete publisher;
+    }
+    if (http) {
+        video->remove_frame_sink(http_sink);
+        delete http;
+    }
+    if (rtp) {
+        video->remove_frame_sink(rtp_sink);
+        delete rtp;
+    }
+    delete startup;
+    delete decoder;
+    delete checker;
+    delete probe;
+    delete pacer;
+    delete gpu_timings;
+    delete replay;
     delete video;
     delete pbo_;
     SDL_GL_DeleteContext(gl_context);
     SDL_DestroyWindow(window);
 }
 
-void streamer::loop() {
-    bool do_continue = true;
-    while (do_continue) {
+int streamer::loop() {
+    timer stage_timer;
+    render_fps.start();
+
+    apply_present_policy();
+
+    if (present == present_policy::late_latch) {
+        SDL_DisplayMode mode;
+        float refresh_rate = 0;
+        if (SDL_GetWindowDisplayMode(window, &mode) == 0) {
+            refresh_rate = mode.refresh_rate;
+        }
+        pacer = new frame_pacer(refresh_rate);
+    }
+
+    update_viewport = true;
+
+    running = true;
+    while (running) {
         SDL_Event event;
-        while (SDL_PollEvent(&event)) {
-            switch (event.type) {
-                case SDL_WINDOWEVENT:
-                    if (event.window.event == SDL_WINDOWEVENT_RESIZED) {
-                        update_viewport = true;
-                    }
-                    break;
-                case SDL_QUIT:
-                    do_continue = false;
-                    break;
-                case SDL_KEYDOWN:
-                    if (event.key.keysym.sym == SDLK_f && event.key.type == SDL_KEYDOWN) {
-                        toggle_fullscreen();
-                    } else if (event.key.keysym.sym == SDLK_t && event.key.type == SDL_KEYDOWN) {
-                        pbo_->toggle_texture_filtering();
-                    }
-                    break;
-                default:
-                    break;
+        if (waits_for_frames()) {
+            // sleep until the capture thread wakes us or the user does something
+            if (SDL_WaitEvent(&event)) {
+                handle_event(event);
             }
         }
+        while (SDL_PollEvent(&event)) {
+            handle_event(event);
+        }
+
+        if (waits_for_frames() && video->frame_sequence() == presented_sequence && !redraw) {
+            continue;
+        }
+        redraw = false;
 
         if (update_viewport) {
-            int fb_width, fb_height;
-            SDL_GL_GetDrawableSize(window, &fb_width, &fb_height);
+            apply_viewport();
+        }
 
-            const float window_aspect_ratio = fb_width / static_cast<float>(fb_height);
-            const float wanted_aspect_ratio = stream_width / static_cast<float>(stream_height);
+        frame_pacer::clock::time_point target_vsync;
+        if (pacer) {
+            target_vsync = pacer->wait_for_latch();
+        }
 
-            int new_width, new_height;
+        // latch the newest frame; the texture still holds the last one, only upload when it changed
+        auto hold = video->hold_buffers();
+        const video_frame frame = video->latest_frame();
+        const bool new_frame = frame.sequence != presented_sequence;
+        presented_sequence = frame.sequence;
+
+        video_frame upload = frame;
+        if (!new_frame) {
+            upload.data = nullptr;
+        } else if (frame.data && (frame.width != (uint32_t) stream_width || frame.height != (uint32_t) stream_height)) {
+            resize_stream(frame.width, frame.height);
+        }
 
-            if (wanted_aspect_ratio < window_aspect_ratio) {
-                new_height = fb_height;
-                new_width = (int) (new_height * wanted_aspect_ratio);
+        if (upload.data && bytes_per_pixel(upload.pixel_format) == 0) {
+            // sinks got the compressed frame, only the one on screen is decoded
+            if (!decoder || !display_compressed) {
+                upload.data = nullptr;
             } else {
-                new_width = fb_width;
-                new_height = (int) (new_width / wanted_aspect_ratio);
+                timer decode_timer;
+                if (!decoder->decode(frame, upload)) {
+                    upload.data = nullptr;
+                }
+                cpu_decode_time.add(decode_timer.lap() * 1000.0f);
             }
+        } else if (upload.data && (upload.pixel_format == V4L2_PIX_FMT_UYVY || upload.pixel_format == V4L2_PIX_FMT_YUYV)) {
+            // packed 4:2:2, like raw RTP video, is converted the same way: only what is shown
+            if (!display_compressed) {
+                upload.data = nullptr;
+            } else {
+                timer convert_timer;
+                if (convert_yuv422_to_rgb(frame, display_format, converted_frame)) {
+                    upload.data = converted_frame.data();
+                    upload.size = converted_frame.size();
+                    upload.pixel_format = display_format;
+                    set_plane_layout(upload, upload.width * bytes_per_pixel(display_format));
+                } else {
+                    upload.data = nullptr;
+                }
+                cpu_decode_time.add(convert_timer.lap() * 1000.0f);
+            }
+        }
 
-            glClear(GL_COLOR_BUFFER_BIT);
-            int new_xpos = (fb_width - new_width) / 2;
-            int new_ypos = (fb_height - new_height) / 2;
-
-            glViewport(new_xpos, new_ypos, new_width, new_height);
-
-            update_viewport = false;
+        if (checker) {
+            // check a private copy so what we validate is exactly what gets uploaded
+            if (upload.data) {
+                checked_frame.resize(frame.size);
+                memcpy(checked_frame.data(), frame.data, frame.size);
+                upload.data = checked_frame.data();
+                checker->check(upload.data + upload.planes[0].offset, upload.width, upload.height, upload.planes[0].stride);
+            } else if (frame.data) {
+                checker->repeated();
+            }
         }
 
+        const auto latch_time = frame_pacer::clock::now();
+
         glClearColor(0, 0, 0, 0);
         glClear(GL_COLOR_BUFFER_BIT);
 
-        pbo_->fill(video->frame_buffer);
-        pbo_->draw();
+        if (gpu_timings) {
+            gpu_timings->begin_frame();
+            stage_timer.lap();
+
+            gpu_timings->begin(render_stage::upload);
+            pbo_->fill(upload);
+            gpu_timings->end(render_stage::upload);
+            cpu_upload_time.add(stage_timer.lap() * 1000.0f);
+
+            gpu_timings->begin(render_stage::draw);
+            pbo_->draw();
+            gpu_timings->end(render_stage::draw);
+            cpu_draw_time.add(stage_timer.lap() * 1000.0f);
+
+            gpu_timings->end_frame();
+        } else {
+            pbo_->fill(upload);
+            pbo_->draw();
+        }
+
+        if (probe) {
+            probe->read_back(viewport[0], viewport[1], viewport[2], viewport[3]);
+        }
+
+        hold.unlock();
+
+        if (pacer) {
+            // the margin has to cover the GPU side of upload and draw as well
+            glFinish();
+            pacer->frame_rendered(frame_pacer::clock::now() - latch_time);
+        }
 
         SDL_GL_SwapWindow(window);
+
+        if (!first_frame_presented && new_frame && frame.data) {
+            // wait for this one swap so the number covers the frame actually reaching the screen
+            glFinish();
+            first_frame_presented = true;
+            const auto now = std::chrono::steady_clock::now();
+            std::cout << "Cold start to first presented frame: "
+                      << std::chrono::duration<float, std::milli>(now - start_time).count() << " ms" << std::endl;
+
+            if (frame.timestamp > video_ready) {
+                startup->add("first capture", video_ready, frame.timestamp);
+            }
+            startup->add("first render", latch_time, now);
+            startup->report(now);
+        }
+
+        if (pacer) {
+            // with vsync on, the swap has completed once the pipeline drains
+            glFinish();
+            const auto presented = frame_pacer::clock::now();
+            pacer->frame_presented(target_vsync, presented);
+            if (new_frame && frame.data) {
+                capture_to_photon.add(std::chrono::duration<float, std::milli>(presented - frame.timestamp).count());
+            }
+        }
+
+        if (probe) {
+            glFinish();
+            probe->presented(std::chrono::steady_clock::now());
+            if (probe->done()) {
+                running = false;
+            }
+        }
+
+        render_fps.add_frame();
+        if (render_fps.updated()) {
+            // audio comes up on its own thread and runs by itself; only ownership is taken here
+            if (pending_audio.valid() && pending_audio.wait_for(std::chrono::seconds(0)) == std::future_status::ready) {
+                audio = pending_audio.get();
+            }
+            if (show_timings) {
+                report_timings();
+            }
+            if (pacer) {
+                report_latching();
+            }
+            if (checker) {
+                checker->report();
+            }
+            if (recording) {
+                recording->report();
+            }
+            if (rtp) {
+                rtp->report();
+            }
+            render_fps.reset();
+        }
     }
 //    while (!glfwWindowShouldClose(window)) {
 //        glfwPollEvents();
@@ -166,6 +551,199 @@ void streamer::loop() {
 //
 //        glfwSwapBuffers(window);
 //    }
+
+    int exit_code = 0;
+    if (probe && !probe->report(max_latency_ms)) {
+        exit_code = 1;
+    }
+    if (checker) {
+        checker->report();
+        if (checker->torn() > 0) {
+            exit_code = 1;
+        }
+    }
+    return exit_code;
+}
+
+void streamer::apply_viewport() {
+    int fb_width, fb_height;
+    SDL_GL_GetDrawableSize(window, &fb_width, &fb_height);
+
+    const float window_aspect_ratio = fb_width / static_cast<float>(fb_height);
+    const float wanted_aspect_ratio = stream_width / static_cast<float>(stream_height);
+
+    int new_width, new_height;
+
+    if (wanted_aspect_ratio < window_aspect_ratio) {
+        new_height = fb_height;
+        new_width = (int) (new_height * wanted_aspect_ratio);
+    } else {
+        new_width = fb_width;
+        new_height = (int) (new_width / wanted_aspect_ratio);
+    }
+
+    glClear(GL_COLOR_BUFFER_BIT);
+    int new_xpos = (fb_width - new_width) / 2;
+    int new_ypos = (fb_height - new_height) / 2;
+
+    viewport = {new_xpos, new_ypos, new_width, new_height};
+    glViewport(new_xpos, new_ypos, new_width, new_height);
+
+    update_viewport = false;
+}
+
+void streamer::resize_stream(int w, int h) {
+    std::cout << "Stream resolution changed to " << w << "x" << h << std::endl;
+    stream_width = w;
+    stream_height = h;
+
+    pbo_->resize(w, h);
+    if (probe) {
+        probe->resize(w, h);
+    }
+    apply_viewport();
+}
+
+void streamer::next_geometry() {
+    if (geometries.empty()) {
+        return;
+    }
+    if (recording && recording->fixed_resolution()) {
+        std::cerr << "Can't change resolution while recording in this format" << std::endl;
+        return;
+    }
+
+    geometry_index = (geometry_index + 1) % geometries.size();
+    const auto& g = geometries[geometry_index];
+    std::cout << "Switching capture to " << g[0] << "x" << g[1] << std::endl;
+
+    // the texture follows once frames of the new size arrive
+    if (!video->reconfigure(g[0], g[1])) {
+        std::cerr << "Video source can't change resolution at runtime" << std::endl;
+    }
+}
+
+void streamer::handle_event(const SDL_Event& event) {
+    if (event.type == frame_event_type) {
+        frame_event_pending = false;
+        return;
+    }
+
+    switch (event.type) {
+        case SDL_WINDOWEVENT:
+            if (event.window.event == SDL_WINDOWEVENT_RESIZED) {
+                update_viewport = true;
+                redraw = true;
+            } else if (event.window.event == SDL_WINDOWEVENT_EXPOSED) {
+                redraw = true;
+            }
+            break;
+        case SDL_QUIT:
+            running = false;
+            break;
+        case SDL_KEYDOWN:
+            if (event.key.keysym.sym == SDLK_f && event.key.type == SDL_KEYDOWN) {
+                toggle_fullscreen();
+            } else if (event.key.keysym.sym == SDLK_t && event.key.type == SDL_KEYDOWN) {
+                pbo_->toggle_texture_filtering();
+                redraw = true;
+            } else if (event.key.keysym.sym == SDLK_g && event.key.type == SDL_KEYDOWN) {
+                next_geometry();
+            } else if (event.key.keysym.sym == SDLK_d && event.key.type == SDL_KEYDOWN) {
+                dump_replay();
+            }
+            break;
+        default:
+            break;
+    }
+}
+
+void streamer::dump_replay() {
+    if (!replay) {
+        std::cout << "No replay to save, start with --replay-seconds" << std::endl;
+        return;
+    }
+
+    char name[64];
+    const time_t now = time(nullptr);
+    strftime(name, sizeof(name), "replay-%Y%m%d-%H%M%S", localtime(&now));
+    if (!replay->dump(name)) {
+        std::cout << "Still saving the previous replay" << std::endl;
+    }
+}
+
+bool streamer::waits_for_frames() const {
+    return present == present_policy::immediate || present == present_policy::on_frame;
+}
+
+void streamer::apply_present_policy() {
+    int interval = 1;
+    switch (present) {
+        case present_policy::vsync:
+        case present_policy::on_frame:
+        case present_policy::late_latch:
+            interval = 1;
+            break;
+        case present_policy::adaptive:
+            interval = -1;
+            break;
+        case present_policy::immediate:
+            interval = 0;
+            break;
+    }
+
+    if (SDL_GL_SetSwapInterval(interval) < 0) {
+        if (interval == -1) {
+            std::cerr << "Adaptive vsync not supported, falling back to vsync. Cause: " << SDL_GetError() << std::endl;
+            SDL_GL_SetSwapInterval(1);
+        } else {
+            std::cerr << "Failed to set swap interval " << interval << ". Cause: " << SDL_GetError() << std::endl;
+        }
+    }
+    std::cout << "Swap interval: " << SDL_GL_GetSwapInterval() << std::endl;
+}
+
+void streamer::report_latching() {
+    std::cout << "Late latch: refresh period " << pacer->period_ms() << " ms, margin " << pacer->margin_ms()
+              << " ms, capture->photon avg " << capture_to_photon.average() << " ms, max " << capture_to_photon.max()
+              << " ms, missed vsyncs " << pacer->missed() << std::endl;
+
+    capture_to_photon.reset();
+    pacer->reset_missed();
+}
+
+void streamer::report_timings() {
+    auto print = [](const char *name, const stage_stats& s) {
+        std::cout << "\t" << name << ": avg " << s.average() << " ms, max " << s.max() << " ms" << std::endl;
+    };
+
+    std::cout << "Render fps: " << render_fps.count() << std::endl;
+    print("cpu upload", cpu_upload_time);
+    print("cpu draw  ", cpu_draw_time);
+    if (decoder) {
+        print("cpu decode", cpu_decode_time);
+        if (decoder->failed()) {
+            std::cout << "\tcorrupt MJPEG frames: " << decoder->failed() << std::endl;
+        }
+    }
+    print("gpu upload", gpu_timings->elapsed(render_stage::upload));
+    print("gpu draw  ", gpu_timings->elapsed(render_stage::draw));
+    print("gpu lag   ", gpu_timings->queue_lag());
+    if (gpu_timings->missed()) {
+        std::cout << "\tgpu queries not ready in time: " << gpu_timings->missed() << std::endl;
+    }
+
+    const auto health = video->health();
+    if (health.stalls) {
+        std::cout << "\tcapture stalls: " << health.stalls << ", recovered: " << health.recoveries
+                  << ", last recovery " << health.last_recovery_ms << " ms, max " << health.max_recovery_ms << " ms"
+                  << (health.stalled ? " (stalled)" : "") << std::endl;
+    }
+
+    cpu_upload_time.reset();
+    cpu_draw_time.reset();
+    cpu_decode_time.reset();
+    gpu_timings->reset();
 }
 
 bool streamer::is_fullscreen() const {
@@ -198,6 +776,8 @@ void streamer::toggle_fullscreen() {
 //        glfwSetWindowMonitor(window, monitor, 0, 0, mode->width, mode->height, 0);
     }
     update_viewport = true;
+    // the waiting present modes would otherwise show the new size only with the next frame
+    redraw = true;
 }
 
 //void streamer::on_window_resize(GLFWwindow *wnd, int w, int h) {
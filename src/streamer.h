@@ -2,34 +2,152 @@
 
 #include <string>
 #include <array>
+#include <atomic>
+#include <chrono>
+#include <future>
+#include <vector>
 #include <SDL2/SDL_video.h>
+#include <SDL2/SDL_events.h>
+#include "buffer_provider.h"
+#include "fps_counter.h"
+#include "pbo.h"
+#include "recorder.h"
+#include "rtp_sender.h"
 
-class pbo;
-class video_source;
+class frame_source;
 class audio_source;
+class gpu_timer;
+class frame_pacer;
+class latency_probe;
+class frame_checker;
+class startup_trace;
+class replay_buffer;
+class jpeg_decoder;
+class shm_publisher;
+class mjpeg_server;
+
+enum class present_policy {
+    vsync,      // redraw every refresh, swap interval 1
+    adaptive,   // redraw every refresh, late swaps tear instead of waiting a whole refresh
+    immediate,  // sleep until a new frame arrives and present it right away, no vsync
+    on_frame,   // sleep until a new frame arrives and present it on the next vsync
+    late_latch, // wait until just before the predicted vsync, then upload and draw the newest frame
+};
+
+struct streamer_options {
+    std::string video_device;   // a V4L2 device path, "synthetic" for the generated test pattern or rtp://[host]:port
+    float synthetic_fps = 60;
+    size_t synthetic_buffers = 4;
+    std::string audio_device;
+    int stream_width = 0;
+    int stream_height = 0;
+    std::vector<std::array<int, 2>> geometries; // resolutions the g key cycles through
+    present_policy present = present_policy::vsync;
+    upload_format upload = upload_format::automatic;
+    bool show_timings = false;
+
+    bool headless = false;          // hidden window and no audio
+    size_t measure_latency = 0;     // frames to measure capture->display latency over, then exit
+    float max_latency_ms = 0;       // fail the measurement when p95 latency is above this
+    bool check_frames = false;      // validate the row tags of synthetic frames before upload
+    bool mjpeg = false;             // capture MJPEG, decoded only for display
+    std::string record_path;        // record the video stream here when set
+    record_format record = record_format::y4m;
+    encoder_options encoding;       // for H.264 recordings
+    float replay_seconds = 0;       // keep this much in memory for the d key to save, 0 for none
+    size_t replay_megabytes = 1024; // memory for replay video frames
+    std::string shm_name;           // publish frames in this POSIX shared memory ring when set
+    uint32_t shm_slots = 4;
+    std::string export_socket;      // pass the capture buffers to local processes over this socket when set
+    size_t capture_buffers = 4;     // V4L2 buffers; subscribers of exported ones may hold all but two
+    capture_memory memory = capture_memory::mmap; // where V4L2 captures into
+    uint16_t http_port = 0;         // serve MJPEG over HTTP on this port, 0 for none
+    int jpeg_quality = 80;          // for frames the HTTP server has to compress itself
+    rtp_options rtp;                // send uncompressed RTP when it has a destination
+    uint32_t rtp_min_delay_ms = 5;  // playout delay bounds of an rtp:// video device
+    uint32_t rtp_max_delay_ms = 200;
+
+    std::chrono::steady_clock::time_point start_time = std::chrono::steady_clock::now(); // for time to first frame
+};
 
 class streamer {
 public:
-    streamer(const std::string& video_device, const std::string& audio_device, int stream_width, int stream_height);
+    explicit streamer(const streamer_options& options);
     ~streamer();
 
-    void loop();
+    // returns the process exit code
+    int loop();
 
 private:
 
+    void init_gl(bool headless);
+    void handle_event(const SDL_Event& event);
+    bool waits_for_frames() const;
+    void apply_present_policy();
+
+    void apply_viewport();
+    void resize_stream(int w, int h);
+    void next_geometry();
+    void dump_replay();
+
     void toggle_fullscreen();
     bool is_fullscreen() const;
+    void report_timings();
+    void report_latching();
 
     int stream_width = 0;
     int stream_height = 0;
+    std::vector<std::array<int, 2>> geometries;
+    size_t geometry_index = 0;
 
     std::array<int, 2> drawable_size = {0};
     std::array<int, 2> window_size = {0};
     bool update_viewport = false;
+    std::array<int, 4> viewport = {0};
+
+    present_policy present = present_policy::vsync;
+    bool running = false;
+    bool redraw = true;
+    uint64_t presented_sequence = 0;
+    std::chrono::steady_clock::time_point start_time;
+    bool first_frame_presented = false;
+    startup_trace *startup = nullptr;
+    std::chrono::steady_clock::time_point video_ready;
+    uint32_t frame_event_type = 0;
+    std::atomic<bool> frame_event_pending{false};
+
+    bool show_timings = false;
+    fps_counter render_fps;
+    stage_stats cpu_upload_time;
+    stage_stats cpu_draw_time;
+    stage_stats cpu_decode_time;
 
     pbo *pbo_ = nullptr;
-    video_source *video = nullptr;
+    frame_source *video = nullptr;
     audio_source *audio = nullptr;
+    std::future<audio_source *> pending_audio;
+    gpu_timer *gpu_timings = nullptr;
+    frame_pacer *pacer = nullptr;
+    stage_stats capture_to_photon;
+    latency_probe *probe = nullptr;
+    float max_latency_ms = 0;
+    frame_checker *checker = nullptr;
+    recorder *recording = nullptr;
+    size_t recording_sink = 0;
+    std::atomic<recorder *> audio_recording{nullptr}; // the recording, once the audio thread may feed it
+    replay_buffer *replay = nullptr;
+    size_t replay_sink = 0;
+    shm_publisher *publisher = nullptr;
+    size_t publisher_sink = 0;
+    mjpeg_server *http = nullptr;
+    size_t http_sink = 0;
+    rtp_sender *rtp = nullptr;
+    size_t rtp_sink = 0;
+    jpeg_decoder *decoder = nullptr;
+    bool display_compressed = true; // decode compressed frames for the window
+    uint32_t display_format = V4L2_PIX_FMT_RGB24; // what frames the texture can't take are converted to
+    std::vector<uint8_t> converted_frame;
+    std::vector<uint8_t> checked_frame;
     SDL_Window* window = nullptr;
     SDL_GLContext* gl_context = nullptr;
 };
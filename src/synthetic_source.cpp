@@ -0,0 +1,104 @@
+#include <iostream>
+#include "synthetic_source.h"
+#include "frame_stamp.h"
+
+// line alignment of the generated frames, as capture drivers commonly use
+static constexpr int line_alignment = 32;
+
+static int line_stride(int width) {
+    return (width * 3 + line_alignment - 1) / line_alignment * line_alignment;
+}
+
+synthetic_source::synthetic_source(int w, int h, float fps_, size_t buffer_count_)
+        : width(w), height(h), stride(line_stride(w)), fps(fps_), buffer_count(buffer_count_),
+          buffers(buffer_count, std::vector<uint8_t>(stride * h)) {
+
+    std::cout << "Synthetic video source: " << width << "x" << height << " @ " << fps << " fps, "
+              << buffer_count << " buffers" << std::endl;
+
+    start_thread();
+}
+
+synthetic_source::~synthetic_source() {
+    stop_thread();
+}
+
+bool synthetic_source::reconfigure(int w, int h) {
+    stop_thread();
+    {
+        auto lock = lock_buffers();
+        width = w;
+        height = h;
+        stride = line_stride(w);
+        buffers.assign(buffer_count, std::vector<uint8_t>(stride * h));
+    }
+    start_thread();
+
+    std::cout << "Synthetic video source: " << width << "x" << height << std::endl;
+    return true;
+}
+
+void synthetic_source::start_thread() {
+    do_work = true;
+    std::thread th(&synthetic_source::generate_fun, this);
+    swap(th, generate_thread);
+}
+
+void synthetic_source::stop_thread() {
+    do_work = false;
+    if (generate_thread.joinable()) {
+        generate_thread.join();
+    }
+}
+
+void synthetic_source::generate_fun() {
+    using clock = std::chrono::steady_clock;
+
+    const auto interval = std::chrono::duration_cast<clock::duration>(std::chrono::duration<float>(1.0f / fps));
+    auto next_frame = clock::now();
+
+    uint32_t frame_id = 0;
+    size_t buffer_index = 0;
+
+    while (do_work) {
+        std::this_thread::sleep_until(next_frame);
+        next_frame += interval;
+
+        auto *dst = buffers[buffer_index].data();
+        buffer_index = (buffer_index + 1) % buffers.size();
+
+        video_frame frame;
+        frame.data = dst;
+        frame.size = buffers[0].size();
+        frame.width = width;
+        frame.height = height;
+        frame.pixel_format = V4L2_PIX_FMT_RGB24;
+        set_plane_layout(frame, stride);
+        frame.timestamp = clock::now();
+
+        render_pattern(dst, frame_id);
+
+        frame_stamp stamp;
+        stamp.frame_id = frame_id;
+        stamp.timestamp_us = std::chrono::duration_cast<std::chrono::microseconds>(frame.timestamp.time_since_epoch()).count();
+        write_frame_stamp(dst, width, stride, stamp);
+
+        publish(frame);
+        frame_id++;
+    }
+}
+
+void synthetic_source::render_pattern(uint8_t *dst, uint32_t frame_id) {
+    // diagonal gradient scrolling one pixel per frame, so motion and tearing are visible;
+    // each row is tagged as it is written, so a reader racing us sees rows of mixed frames
+    for (int y = 0; y < height; y++) {
+        uint8_t *row = dst + y * stride;
+        for (int x = 0; x < width; x++) {
+            const uint32_t v = x + y + frame_id;
+            row[x * 3 + 0] = v & 0xff;
+            row[x * 3 + 1] = (v >> 1) & 0xff;
+            row[x * 3 + 2] = 0xff - (v & 0xff);
+        }
+        write_row_tags(row, width, 1, stride, frame_id);
+    }
+}
@@ -0,0 +1,32 @@
+#pragma once
+
+#include <thread>
+#include <vector>
+#include "frame_source.h"
+
+// Generates a moving test pattern at a fixed rate, stamped with the frame id and capture time
+// (see frame_stamp.h). Like video_source it cycles through a small set of buffers, so a frame
+// gets overwritten a few frames after it was published, and pads its lines like capture drivers do.
+class synthetic_source : public frame_source {
+public:
+    synthetic_source(int w, int h, float fps, size_t buffer_count = 4);
+    ~synthetic_source() override;
+
+    bool reconfigure(int w, int h) override;
+
+    float frame_rate() const override { return fps; }
+
+private:
+    void start_thread();
+    void stop_thread();
+    void generate_fun();
+    void render_pattern(uint8_t *dst, uint32_t frame_id);
+
+    int width, height;
+    int stride;
+    float fps;
+    size_t buffer_count;
+    std::vector<std::vector<uint8_t>> buffers;
+    std::thread generate_thread;
+    volatile bool do_work;
+};
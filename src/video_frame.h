@@ -0,0 +1,82 @@
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+#include <chrono>
+#include <string>
+#include <linux/videodev2.h>
+
+struct video_plane {
+    uint32_t offset = 0; // bytes from video_frame::data
+    uint32_t stride = 0; // bytes per line, including any padding
+};
+
+// A captured frame as handed from a video source to its consumers.
+struct video_frame {
+    uint8_t *data = nullptr;
+    size_t size = 0;
+    uint64_t sequence = 0;
+
+    uint32_t width = 0;
+    uint32_t height = 0;
+    uint32_t pixel_format = V4L2_PIX_FMT_RGB24;
+
+    static constexpr size_t max_planes = 3;
+    video_plane planes[max_planes];
+    uint32_t plane_count = 1;
+
+    // capture time on the steady (CLOCK_MONOTONIC) clock
+    std::chrono::steady_clock::time_point timestamp;
+};
+
+// Lays out the planes of a frame from the first plane's bytes per line, the way V4L2's single
+// planar API packs them: each plane directly follows the previous one.
+inline void set_plane_layout(video_frame& frame, uint32_t bytes_per_line) {
+    frame.planes[0] = {0, bytes_per_line};
+    frame.plane_count = 1;
+
+    const uint32_t luma_size = bytes_per_line * frame.height;
+    switch (frame.pixel_format) {
+        case V4L2_PIX_FMT_NV12:
+        case V4L2_PIX_FMT_NV21:
+            frame.planes[1] = {luma_size, bytes_per_line};
+            frame.plane_count = 2;
+            break;
+        case V4L2_PIX_FMT_YUV420:
+        case V4L2_PIX_FMT_YVU420:
+            frame.planes[1] = {luma_size, bytes_per_line / 2};
+            frame.planes[2] = {luma_size + bytes_per_line / 2 * ((frame.height + 1) / 2), bytes_per_line / 2};
+            frame.plane_count = 3;
+            break;
+        default:
+            break;
+    }
+}
+
+// bytes per pixel of the first plane, 0 for compressed formats
+inline uint32_t bytes_per_pixel(uint32_t pixel_format) {
+    switch (pixel_format) {
+        case V4L2_PIX_FMT_RGB24:
+        case V4L2_PIX_FMT_BGR24:
+            return 3;
+        case V4L2_PIX_FMT_XBGR32:
+        case V4L2_PIX_FMT_ABGR32:
+        case V4L2_PIX_FMT_BGR32:
+            return 4;
+        case V4L2_PIX_FMT_YUYV:
+        case V4L2_PIX_FMT_UYVY:
+            return 2;
+        case V4L2_PIX_FMT_NV12:
+        case V4L2_PIX_FMT_NV21:
+        case V4L2_PIX_FMT_YUV420:
+        case V4L2_PIX_FMT_YVU420:
+            return 1;
+        default:
+            return 0;
+    }
+}
+
+inline std::string fourcc_to_string(uint32_t fourcc) {
+    return {static_cast<char>(fourcc & 0xff), static_cast<char>((fourcc >> 8) & 0xff),
+            static_cast<char>((fourcc >> 16) & 0xff), static_cast<char>((fourcc >> 24) & 0xff)};
+}
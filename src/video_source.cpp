@@ -1,19 +1,45 @@
+#include <algorithm>
 #include <cstring>
 #include <string>
 #include <sstream>
 #include <libv4l2.h>
 #include "video_source.h"
+#include "dmabuf_exporter.h"
 #include <fcntl.h>
 #include <sys/mman.h>
 #include <iostream>
 #include <map>
+#include <stdexcept>
 #include <sys/ioctl.h>
+#include <unistd.h>
 #include <vector>
 
 #define CLEAR(x) memset(&(x), 0, sizeof(x))
 
+// A device call that failed. Fatal during startup; the capture thread recovers from it instead.
+class video_device_error : public std::runtime_error {
+public:
+    explicit video_device_error(const std::string& what) : std::runtime_error(what) {}
+};
+
+// a stall is this many frame intervals without a frame, but never less than min_stall_timeout
+static constexpr int stall_frames = 8;
+static constexpr auto min_stall_timeout = std::chrono::milliseconds(250);
+static constexpr auto max_reopen_backoff = std::chrono::seconds(2);
+
+// subscribers of exported buffers may hold all but these, so capture never runs dry
+static constexpr size_t min_driver_buffers = 2;
+
+// Drivers that stamp buffers with CLOCK_MONOTONIC share the steady clock, others get the dequeue time.
+static std::chrono::steady_clock::time_point capture_time(const v4l2_buffer& buffer) {
+    if ((buffer.flags & V4L2_BUF_FLAG_TIMESTAMP_MASK) == V4L2_BUF_FLAG_TIMESTAMP_MONOTONIC) {
+        auto since_boot = std::chrono::seconds(buffer.timestamp.tv_sec) + std::chrono::microseconds(buffer.timestamp.tv_usec);
+        return std::chrono::steady_clock::time_point(std::chrono::duration_cast<std::chrono::steady_clock::duration>(since_boot));
+    }
+    return std::chrono::steady_clock::now();
+}
 
-static void xioctl(int fh, int request, void *arg) {
+static void checked_ioctl(int fh, unsigned long request, void *arg, const char *name) {
     int r;
 
     do {
@@ -21,55 +47,13 @@ static void xioctl(int fh, int request, void *arg) {
     } while (r == -1 && (errno == EINTR || errno == EAGAIN));
 
     if (r == -1) {
-        fprintf(stderr, "error %d, %s\\n", errno, strerror(errno));
-        exit(EXIT_FAILURE);
-    }
-}
-
-
-#define MAP_ENTRY(x) {x, #x}
-
-static std::string capabilities_to_string(uint32_t caps) {
-    static std::map<uint32_t, std::string> cap_names = {
-            MAP_ENTRY(V4L2_CAP_VIDEO_CAPTURE),
-            MAP_ENTRY(V4L2_CAP_VIDEO_CAPTURE_MPLANE),
-            MAP_ENTRY(V4L2_CAP_VIDEO_OUTPUT),
-            MAP_ENTRY(V4L2_CAP_VIDEO_OUTPUT_MPLANE),
-            MAP_ENTRY(V4L2_CAP_VIDEO_M2M),
-            MAP_ENTRY(V4L2_CAP_VIDEO_M2M_MPLANE),
-            MAP_ENTRY(V4L2_CAP_VIDEO_OVERLAY),
-            MAP_ENTRY(V4L2_CAP_VBI_CAPTURE),
-            MAP_ENTRY(V4L2_CAP_VBI_OUTPUT),
-            MAP_ENTRY(V4L2_CAP_SLICED_VBI_CAPTURE),
-            MAP_ENTRY(V4L2_CAP_SLICED_VBI_OUTPUT),
-            MAP_ENTRY(V4L2_CAP_RDS_CAPTURE),
-            MAP_ENTRY(V4L2_CAP_VIDEO_OUTPUT_OVERLAY),
-            MAP_ENTRY(V4L2_CAP_HW_FREQ_SEEK),
-            MAP_ENTRY(V4L2_CAP_RDS_OUTPUT),
-            MAP_ENTRY(V4L2_CAP_TUNER),
-            MAP_ENTRY(V4L2_CAP_AUDIO),
-            MAP_ENTRY(V4L2_CAP_RADIO),
-            MAP_ENTRY(V4L2_CAP_MODULATOR),
-            MAP_ENTRY(V4L2_CAP_SDR_CAPTURE),
-            MAP_ENTRY(V4L2_CAP_EXT_PIX_FORMAT),
-            MAP_ENTRY(V4L2_CAP_SDR_OUTPUT),
-            MAP_ENTRY(V4L2_CAP_READWRITE),
-            MAP_ENTRY(V4L2_CAP_ASYNCIO),
-            MAP_ENTRY(V4L2_CAP_STREAMING),
-            MAP_ENTRY(V4L2_CAP_TOUCH),
-            MAP_ENTRY(V4L2_CAP_DEVICE_CAPS),
-    };
-
-    std::stringstream ss;
-    for (auto& kv: cap_names) {
-        if (caps & kv.first) {
-            ss << kv.second << " | ";
-        }
+        throw video_device_error(std::string(name) + ": " + strerror(errno));
     }
-
-    return ss.str();
 }
 
+#define xioctl(fh, request, arg) checked_ioctl(fh, request, arg, #request)
+
+
 #include "list_devices.hpp"
 
 void video_source::enumerate_video_devices() {
@@ -84,235 +68,754 @@ void video_source::enumerate_video_devices() {
         std::cout << "\t" << device.device_description << std::endl;
         std::cout << "\t" << device.bus_info << std::endl;
         std::cout << std::endl;
+
+        // the details that used to be printed on every start
+        for (const auto& path: device.device_paths) {
+            const int fd = v4l2_open(path.c_str(), O_RDWR | O_NONBLOCK, 0);
+            if (fd < 0) {
+                continue;
+            }
+            v4l2_capability caps;
+            CLEAR(caps);
+            if (v4l2_ioctl(fd, VIDIOC_QUERYCAP, &caps) == 0) {
+                std::cout << path << std::endl;
+                device_profile::probe(fd, path, caps).print();
+                std::cout << std::endl;
+            }
+            v4l2_close(fd);
+        }
     }
 }
 
 
-video_source::video_source(const std::string& src, int w_, int h_, size_t buffer_count)
-        : width(w_), height(h_), n_buffers(buffer_count) {
+video_source::video_source(const std::string& src, int w_, int h_, uint32_t pixel_format, size_t buffer_count, capture_memory memory)
+        : device_path(src), width(w_), height(h_), wanted_format(pixel_format), n_buffers(buffer_count) {
+    driver_buffers = buffer_provider::create(capture_memory::mmap);
+    provider = memory == capture_memory::mmap ? driver_buffers : buffer_provider::create(memory);
+    active = driver_buffers;
 
     fd = v4l2_open(src.c_str(), O_RDWR | O_NONBLOCK, 0);
     if (fd < 0) {
-        perror("Cannot open device");
-        exit(EXIT_FAILURE);
+        // this runs on a startup thread, whoever waits for it reports the error
+        const std::string error = "Cannot open " + src + ": " + strerror(errno);
+        if (provider != driver_buffers) {
+            delete provider;
+        }
+        delete driver_buffers;
+        throw video_device_error(error);
     }
 
+    // the full enumeration is cached, list-video prints it
     v4l2_capability caps;
     CLEAR(caps);
     xioctl(fd, VIDIOC_QUERYCAP, &caps);
-    std::cout << "Video capabilities:" << std::endl;
-    std::cout << "\tDriver: " << caps.driver << std::endl;
-    std::cout << "\tCard: " << caps.card << std::endl;
-    std::cout << "\tBus info: " << caps.bus_info << std::endl;
-    std::cout << "\tVersion: " << caps.version << std::endl;
-    std::cout << "\tCaps: " << capabilities_to_string(caps.capabilities) << std::endl;
-    std::cout << "\tDevice caps: " << capabilities_to_string(caps.device_caps) << std::endl;
-
-    v4l2_streamparm sparams;
-    CLEAR(sparams);
-    sparams.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
-    xioctl(fd, VIDIOC_G_PARM, &sparams);
-    std::cout << "Stream params:" << std::endl;
-    std::cout << "\tFPS: " << sparams.parm.capture.timeperframe.denominator << std::endl;
-
-
-    // enumerate image formats
-    v4l2_fmtdesc fmtdesc;
-    CLEAR(fmtdesc);
-    fmtdesc.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
-
-    std::vector<v4l2_fmtdesc> image_formats;
-
-    std::cout << "Image formats" << std::endl;
-    while (v4l2_ioctl(fd, VIDIOC_ENUM_FMT, &fmtdesc) == 0) {
-        image_formats.push_back(fmtdesc);
-
-        std::cout << "\tindex: " << fmtdesc.index << std::endl;
-        std::cout << "\tdesc: " << fmtdesc.description << std::endl;
-        std::cout << "\tpixel format: " << fmtdesc.pixelformat << std::endl;
-        std::cout << std::endl;
-        fmtdesc.index++;
+    std::cout << "Video device: " << caps.card << " (" << caps.driver << ", " << caps.bus_info << ")" << std::endl;
+    profile = device_profile::load(fd, src, caps);
+
+    subscribe_events();
+    negotiate_format(width, height);
+    start_streaming();
+
+    v4l2_priority priority = V4L2_PRIORITY_RECORD;
+    xioctl(fd, VIDIOC_S_PRIORITY, &priority);
+
+    monitor = new device_monitor(src, reinterpret_cast<const char *>(caps.bus_info),
+                                 [this](const std::string&) {
+                                     std::lock_guard<std::mutex> lock(hotplug_mutex);
+                                     device_present = false;
+                                 },
+                                 [this](const std::string& node) {
+                                     std::lock_guard<std::mutex> lock(hotplug_mutex);
+                                     device_present = true;
+                                     arrived_path = node;
+                                 });
+
+    start_thread();
+}
+
+video_source::~video_source() {
+    delete monitor;
+    stop_thread();
+    {
+        auto lock = lock_buffers();
+        stop_streaming();
+    }
+    if (fd >= 0) {
+        v4l2_close(fd);
     }
+    delete exporter.load();
+    if (provider != driver_buffers) {
+        delete provider;
+    }
+    delete driver_buffers;
+}
 
+bool video_source::reconfigure(int w, int h) {
+    timer t;
+    stop_thread();
+    {
+        // nobody may read the old buffers past this point
+        auto lock = lock_buffers();
+        stop_streaming();
+    }
 
-    // enumerate resolutions
-    for (auto& image_fmt: image_formats) {
-        v4l2_frmsizeenum frame_size;
-        CLEAR(frame_size);
-        frame_size.pixel_format = image_fmt.pixelformat;
+    // a device reopen by the watchdog asks for the new size too
+    width = w;
+    height = h;
+
+    bool ok = true;
+    try {
+        negotiate_format(w, h);
+        start_streaming();
+    } catch (const video_device_error& e) {
+        // the watchdog takes it from here
+        std::cerr << "Reconfiguring capture failed: " << e.what() << std::endl;
+        ok = false;
+    }
+    start_thread();
 
-        std::cout << "Resolution for pixel format " << image_fmt.description << std::endl;
+    if (ok) {
+        std::cout << "Reconfigured capture to " << width << "x" << height << " in " << t.lap() * 1000.0f << " ms" << std::endl;
+    }
+    return ok;
+}
 
-        while (v4l2_ioctl(fd, VIDIOC_ENUM_FRAMESIZES, &frame_size) == 0) {
-            std::cout << "\t" << frame_size.discrete.width << "x" << frame_size.discrete.height << std::endl;
-            frame_size.index++;
-        }
+float video_source::frame_rate() const {
+    return 1.0f / std::chrono::duration<float>(frame_interval).count();
+}
 
+bool video_source::export_buffers(const std::string& socket_path) {
+    auto e = new dmabuf_exporter(socket_path);
+    if (!e->is_open()) {
+        delete e;
+        return false;
     }
+    delete exporter.exchange(e);
+    return true;
+}
 
-    // enumerate video inputs
-    int input;
-    xioctl(fd, VIDIOC_G_INPUT, &input);
-    std::cout << "Current input: " << input << std::endl;
+capture_health video_source::health() const {
+    std::lock_guard<std::mutex> lock(health_mutex);
+    return stats;
+}
 
-    v4l2_input video_input;
-    CLEAR(video_input);
+void video_source::start_thread() {
+    last_frame = std::chrono::steady_clock::now();
+    do_work = true;
+    std::thread th(&video_source::read_fun, this);
+    swap(th, read_thread);
+}
 
-    std::cout << "Video inputs" << std::endl;
-    int r;
-    while (true) {
-        do {
-            r = v4l2_ioctl(fd, VIDIOC_ENUMINPUT, &video_input);
-        } while (r == -1 && (errno == EBUSY || errno == EAGAIN));
+void video_source::stop_thread() {
+    do_work = false;
+    if (read_thread.joinable()) {
+        read_thread.join();
+    }
+}
+
+void video_source::subscribe_events() {
+    // HDMI/SDI receivers report signal changes; webcams usually don't support this, which is fine
+    v4l2_event_subscription subscription;
+    CLEAR(subscription);
+    subscription.type = V4L2_EVENT_SOURCE_CHANGE;
+    if (v4l2_ioctl(fd, VIDIOC_SUBSCRIBE_EVENT, &subscription) == 0) {
+        std::cout << "Subscribed to source change events" << std::endl;
+    }
+
+    CLEAR(subscription);
+    subscription.type = V4L2_EVENT_EOS;
+    v4l2_ioctl(fd, VIDIOC_SUBSCRIBE_EVENT, &subscription);
+}
 
-        if (r == -1 && EINVAL) break;
+// returns true when the stream was restarted
+bool video_source::handle_events() {
+    bool source_changed = false;
+
+    v4l2_event event;
+    CLEAR(event);
+    while (v4l2_ioctl(fd, VIDIOC_DQEVENT, &event) == 0) {
+        if (event.type == V4L2_EVENT_SOURCE_CHANGE && (event.u.src_change.changes & V4L2_EVENT_SRC_CH_RESOLUTION)) {
+            source_changed = true;
+        } else if (event.type == V4L2_EVENT_EOS) {
+            std::cout << "Video source signalled end of stream" << std::endl;
+        }
 
-        std::cout << "\tindex: " << video_input.index << std::endl;
-        std::cout << "\tname: " << video_input.name << std::endl;
-        std::cout << "\ttype: " << video_input.type << std::endl;
-        video_input.index++;
+        if (event.pending == 0) {
+            break;
+        }
     }
 
+    return source_changed && renegotiate();
+}
+
+// Called on the capture thread when the upstream signal changed: the buffers have to go before
+// new DV timings can be applied, then the capture format follows the detected timings.
+bool video_source::renegotiate() {
+    recovery_start = std::chrono::steady_clock::now();
+    recovering = true;
+    std::cout << "Video source changed, renegotiating" << std::endl;
+
+    uint32_t w = width, h = height;
+
+    v4l2_dv_timings timings;
+    CLEAR(timings);
+    const bool have_timings = v4l2_ioctl(fd, VIDIOC_QUERY_DV_TIMINGS, &timings) == 0;
+    if (!have_timings && (errno == ENOLINK || errno == ENOLCK || errno == ERANGE)) {
+        // no or unstable signal; another event follows once it settles
+        std::cout << "No stable input signal: " << strerror(errno) << std::endl;
+        return false;
+    }
 
-    // -----------------------------------------------------------------------------------------------------------------
-    // setting things
-    // -----------------------------------------------------------------------------------------------------------------
+    {
+        auto lock = lock_buffers();
+        stop_streaming();
+    }
 
+    if (have_timings) {
+        if (v4l2_ioctl(fd, VIDIOC_S_DV_TIMINGS, &timings) == 0) {
+            w = timings.bt.width;
+            h = timings.bt.height;
+
+            const auto frame_size = static_cast<double>(V4L2_DV_BT_FRAME_WIDTH(&timings.bt)) * V4L2_DV_BT_FRAME_HEIGHT(&timings.bt);
+            std::cout << "Detected timings: " << w << "x" << h << (timings.bt.interlaced ? "i" : "p")
+                      << " @ " << (frame_size > 0 ? timings.bt.pixelclock / frame_size : 0) << " Hz" << std::endl;
+        } else {
+            perror("VIDIOC_S_DV_TIMINGS");
+        }
+    }
+
+    negotiate_format(w, h);
+    start_streaming();
+    return true;
+}
+
+void video_source::negotiate_format(uint32_t w, uint32_t h) {
     CLEAR(video_format);
     video_format.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
     xioctl(fd, VIDIOC_G_FMT, &video_format);
 
 
-    video_format.fmt.pix.width = width;
-    video_format.fmt.pix.height = height;
-    video_format.fmt.pix.pixelformat = V4L2_PIX_FMT_RGB24;
+    video_format.fmt.pix.width = w;
+    video_format.fmt.pix.height = h;
+    video_format.fmt.pix.pixelformat = wanted_format;
     video_format.fmt.pix.field = V4L2_FIELD_ANY;
-    xioctl(fd, VIDIOC_TRY_FMT, &video_format);
+
+    // a format the device profile doesn't list isn't worth the round trip
+    bool accepted = false;
+    if (profile.supports(wanted_format)) {
+        xioctl(fd, VIDIOC_TRY_FMT, &video_format);
+        accepted = video_format.fmt.pix.pixelformat == wanted_format;
+    }
+
+    if (!accepted && wanted_format != V4L2_PIX_FMT_RGB24) {
+        std::cout << "Device can't deliver " << fourcc_to_string(wanted_format) << ", falling back to RGB24" << std::endl;
+        video_format.fmt.pix.width = w;
+        video_format.fmt.pix.height = h;
+        video_format.fmt.pix.pixelformat = V4L2_PIX_FMT_RGB24;
+        xioctl(fd, VIDIOC_TRY_FMT, &video_format);
+    }
 
     xioctl(fd, VIDIOC_S_FMT, &video_format);
 
-    if (video_format.fmt.pix.pixelformat != V4L2_PIX_FMT_RGB24) {
-        std::cerr << "libv4l didn't accept RGB24 format. Can't proceed." << std::endl;
-        exit(EXIT_FAILURE);
+    if (video_format.fmt.pix.pixelformat != V4L2_PIX_FMT_RGB24 && video_format.fmt.pix.pixelformat != wanted_format) {
+        throw video_device_error("libv4l didn't accept RGB24 format. Can't proceed.");
     }
+    std::cout << "Pixel format: " << fourcc_to_string(video_format.fmt.pix.pixelformat) << std::endl;
 
-    if ((video_format.fmt.pix.width != width) || (video_format.fmt.pix.height != height)) {
+    if ((video_format.fmt.pix.width != w) || (video_format.fmt.pix.height != h)) {
         std::cout << "Warning: driver is sending image at "
                   << video_format.fmt.pix.width << "x" << video_format.fmt.pix.height
                   << std::endl;
     }
+    width = video_format.fmt.pix.width;
+    height = video_format.fmt.pix.height;
 
-    // ask for buffers
+    // some drivers leave bytesperline to us when there is no padding
+    if (video_format.fmt.pix.bytesperline == 0) {
+        video_format.fmt.pix.bytesperline = width * bytes_per_pixel(video_format.fmt.pix.pixelformat);
+    }
+    std::cout << "Stride: " << video_format.fmt.pix.bytesperline << " bytes, image size: "
+              << video_format.fmt.pix.sizeimage << " bytes" << std::endl;
+
+    v4l2_streamparm params;
+    CLEAR(params);
+    params.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+    const auto& per_frame = params.parm.capture.timeperframe;
+    if (v4l2_ioctl(fd, VIDIOC_G_PARM, &params) == 0 && per_frame.numerator && per_frame.denominator) {
+        frame_interval = std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+                std::chrono::microseconds(1000000ull * per_frame.numerator / per_frame.denominator));
+    }
+}
+
+void video_source::start_streaming() {
+    // libv4l can only convert into buffers of its own
+    active = provider;
+    if (active != driver_buffers && !profile.supports(video_format.fmt.pix.pixelformat)) {
+        std::cout << "Capturing into driver buffers, libv4l converts to " << fourcc_to_string(video_format.fmt.pix.pixelformat) << std::endl;
+        active = driver_buffers;
+    }
+
+    if (active != driver_buffers) {
+        if (allocate_buffers()) {
+            std::cout << "Capturing into " << n_buffers << " " << active->name() << " buffers" << std::endl;
+        } else {
+            std::cout << "Cannot capture into " << active->name() << " buffers, using driver buffers" << std::endl;
+            free_buffers();
+            active = driver_buffers;
+        }
+    }
+    if (active == driver_buffers && !allocate_buffers()) {
+        throw video_device_error("Cannot allocate capture buffers");
+    }
+
+    for (size_t i = 0; i < n_buffers; ++i) {
+        queue_buffer(i);
+    }
+
+    buffer_type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+    xioctl(fd, VIDIOC_STREAMON, &buffer_type);
+    streaming = true;
+}
+
+bool video_source::allocate_buffers() {
     CLEAR(buffer_request);
     buffer_request.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
-    buffer_request.memory = V4L2_MEMORY_MMAP;
+    buffer_request.memory = active->memory();
     buffer_request.count = n_buffers;
-    xioctl(fd, VIDIOC_REQBUFS, &buffer_request);
+    if (v4l2_ioctl(fd, VIDIOC_REQBUFS, &buffer_request) != 0) {
+        perror("VIDIOC_REQBUFS");
+        return false;
+    }
 
-    // query buffer info
     buffers_info = new video_buffer_info[n_buffers];
-
     for (size_t i = 0; i < n_buffers; ++i) {
-        CLEAR(video_buffer);
+        buffers_info[i] = {MAP_FAILED, 0, 0, -1};
+    }
+    return active->allocate(fd, video_format.fmt.pix.sizeimage, buffers_info, n_buffers);
+}
 
-        video_buffer.index = i;
-        video_buffer.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
-        video_buffer.memory = V4L2_MEMORY_MMAP;
+void video_source::free_buffers() {
+    if (buffers_info) {
+        active->release(buffers_info, n_buffers);
+        delete[] buffers_info;
+        buffers_info = nullptr;
+    }
+
+    // release the driver's buffers too, S_FMT refuses to change the size while they exist
+    CLEAR(buffer_request);
+    buffer_request.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+    buffer_request.memory = active->memory();
+    buffer_request.count = 0;
+    v4l2_ioctl(fd, VIDIOC_REQBUFS, &buffer_request);
+}
 
-        xioctl(fd, VIDIOC_QUERYBUF, &video_buffer);
+// Best effort, this also runs on a half started stream or after the device went away.
+void video_source::stop_streaming() {
+    streaming = false;
+    buffer_type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+    v4l2_ioctl(fd, VIDIOC_STREAMOFF, &buffer_type);
 
-        buffers_info[i].offset = video_buffer.m.offset;
-        buffers_info[i].length = video_buffer.length;
+    if (buffers_exported) {
+        // Subscribers close theirs when told; drivers with orphaned buffer support free the
+        // memory once they did, others refuse the REQBUFS below while it is still in use.
+        exporter.load()->set_buffers({}, {});
+        buffers_exported = false;
     }
+    export_refused = false;
 
-    // memory map
-    for (size_t i = 0; i < n_buffers; ++i) {
-        buffers_info[i].start = v4l2_mmap(nullptr, buffers_info[i].length,
-                                          PROT_READ | PROT_WRITE, MAP_SHARED,
-                                          fd, buffers_info[i].offset);
+    free_buffers();
+}
+
+// imported buffers are named again with every QBUF
+void video_source::queue_buffer(uint32_t index) {
+    v4l2_buffer buffer;
+    CLEAR(buffer);
+    buffer.index = index;
+    buffer.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+    buffer.memory = active->memory();
+    if (buffer.memory == V4L2_MEMORY_DMABUF) {
+        buffer.m.fd = buffers_info[index].fd;
+        buffer.length = buffers_info[index].length;
+    } else if (buffer.memory == V4L2_MEMORY_USERPTR) {
+        buffer.m.userptr = reinterpret_cast<unsigned long>(buffers_info[index].start);
+        buffer.length = buffers_info[index].length;
+    }
+    xioctl(fd, VIDIOC_QBUF, &buffer);
+}
 
-        if (MAP_FAILED == buffers_info[i].start) {
-            perror("mmap");
-            exit(EXIT_FAILURE);
+void video_source::read_fun() {
+    fps.start();
+    while (do_work) {
+        try {
+            bool present;
+            std::string new_path;
+            {
+                std::lock_guard<std::mutex> lock(hotplug_mutex);
+                present = device_present;
+                swap(new_path, arrived_path);
+            }
+
+            if (!present && fd >= 0) {
+                release_device();
+            }
+            if (!new_path.empty()) {
+                // reattach right away, no matter where the escalation stood
+                device_path = new_path;
+                step = recovery_step::reopen;
+                reopen_attempts = 0;
+                next_attempt = {};
+            }
+
+            if (!present || fd < 0) {
+                recover(present ? "device closed" : "device unplugged");
+            } else if (wait_for_buffer()) {
+                dequeue_frame();
+            }
+        } catch (const video_device_error& e) {
+            std::cerr << "Capture error: " << e.what() << std::endl;
+            recover("device error");
         }
     }
+}
 
+// true when a buffer is ready to dequeue, false after handling events, a timeout or an error
+bool video_source::wait_for_buffer() {
+    // buffers coming back from subscribers are requeued as soon as they are released
+    const int release_fd = buffers_exported ? exporter.load()->release_fd() : -1;
+    do {
+        FD_ZERO(&fds);
+        FD_SET(fd, &fds);
+        if (release_fd >= 0) {
+            FD_SET(release_fd, &fds);
+        }
 
-    for (size_t i = 0; i < n_buffers; ++i) {
-        video_buffer.index = i;
-        video_buffer.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
-        video_buffer.memory = V4L2_MEMORY_MMAP;
-        video_buffer.m.offset = buffers_info[i].offset;
-        video_buffer.length = buffers_info[i].length;
-        xioctl(fd, VIDIOC_QBUF, &video_buffer);
-    }
+        // V4L2 events show up as exceptional conditions
+        FD_ZERO(&efds);
+        FD_SET(fd, &efds);
 
-    frame_buffer = new uint8_t[width * height * 3];
+        const auto timeout = std::chrono::duration_cast<std::chrono::microseconds>(stall_timeout());
+        tv.tv_sec = timeout.count() / 1000000;
+        tv.tv_usec = timeout.count() % 1000000;
 
+        r = select(std::max(fd, release_fd) + 1, &fds, nullptr, &efds, &tv);
+    } while (r == -1 && errno == EINTR);
 
-    buffer_type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
-    xioctl(fd, VIDIOC_STREAMON, &buffer_type);
+    if (r == -1) {
+        perror("select");
+        recover("select failed");
+        return false;
+    }
 
-    v4l2_priority priority = V4L2_PRIORITY_RECORD;
-    xioctl(fd, VIDIOC_S_PRIORITY, &priority);
+    if (r == 0) {
+        recover("timeout");
+        return false;
+    }
 
-    do_work = true;
-    std::thread th(&video_source::read_fun, this);
-    swap(th, read_thread);
+    if (release_fd >= 0 && FD_ISSET(release_fd, &fds)) {
+        requeue_released();
+    }
+
+    if (FD_ISSET(fd, &efds)) {
+        // after a restart the readable flag belongs to the old buffers
+        if (handle_events() || !FD_ISSET(fd, &fds)) {
+            return false;
+        }
+    }
+
+    return FD_ISSET(fd, &fds);
 }
 
-video_source::~video_source() {
-    do_work = false;
-    read_thread.join();
+void video_source::dequeue_frame() {
+    if (!buffers_exported && !export_refused && exporter.load() && std::chrono::steady_clock::now() >= next_export) {
+        export_to_subscribers();
+    }
 
-    buffer_type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
-    xioctl(fd, VIDIOC_STREAMOFF, &buffer_type);
+    CLEAR(video_buffer);
+    video_buffer.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+    video_buffer.memory = active->memory();
 
-    for (size_t i = 0; i < n_buffers; ++i) {
-        v4l2_munmap(buffers_info[i].start, buffers_info[i].length);
+    do {
+        r = v4l2_ioctl(fd, VIDIOC_DQBUF, &video_buffer);
+    } while (r == -1 && errno == EINTR);
+
+    if (r == -1) {
+        if (errno == EAGAIN) {
+            // woken up without a buffer; a real stall times out in select
+            return;
+        }
+        throw video_device_error(std::string("VIDIOC_DQBUF: ") + strerror(errno));
+    }
+
+    bool held = false;
+    if (!(video_buffer.flags & V4L2_BUF_FLAG_ERROR)) {
+        video_frame frame;
+        frame.data = static_cast<uint8_t *>(buffers_info[video_buffer.index].start);
+        frame.size = video_buffer.bytesused ? video_buffer.bytesused : video_format.fmt.pix.sizeimage;
+        frame.width = width;
+        frame.height = height;
+        frame.pixel_format = video_format.fmt.pix.pixelformat;
+        set_plane_layout(frame, video_format.fmt.pix.bytesperline);
+        frame.timestamp = capture_time(video_buffer);
+        if (buffers_exported) {
+            // subscribers get it before the sinks run
+            const size_t shareable = n_buffers > min_driver_buffers ? n_buffers - min_driver_buffers : 0;
+            publish(frame, [&](const video_frame& numbered) {
+                held = exporter.load()->offer(video_buffer.index, numbered, shareable);
+            });
+        } else {
+            publish(frame);
+        }
+
+        if (recovering) {
+            recovering = false;
+            const auto elapsed = std::chrono::duration<float, std::milli>(std::chrono::steady_clock::now() - recovery_start);
+            std::cout << "Recovered from source change in " << elapsed.count() << " ms" << std::endl;
+        }
+        frame_arrived(std::chrono::steady_clock::now());
+    }
+    if (!held) {
+        queue_buffer(video_buffer.index);
+    }
+
+
+    fps.add_frame();
+    if (fps.updated()) {
+        std::cout << "Video source fps: " << fps.count() << std::endl;
+        fps.reset();
     }
-    v4l2_close(fd);
 }
 
-void video_source::read_fun() {
-    fps.start();
-    while (do_work) {
-        do {
-            FD_ZERO(&fds);
-            FD_SET(fd, &fds);
+std::chrono::steady_clock::duration video_source::stall_timeout() const {
+    return std::max<std::chrono::steady_clock::duration>(frame_interval * stall_frames, min_stall_timeout);
+}
+
+void video_source::frame_arrived(std::chrono::steady_clock::time_point now) {
+    bool was_stalled;
+    float outage_ms = std::chrono::duration<float, std::milli>(now - last_frame).count();
+    {
+        std::lock_guard<std::mutex> lock(health_mutex);
+        was_stalled = stats.stalled;
+        if (was_stalled) {
+            stats.stalled = false;
+            stats.recoveries++;
+            stats.last_recovery_ms = outage_ms;
+            stats.max_recovery_ms = std::max(stats.max_recovery_ms, outage_ms);
+        }
+    }
+    last_frame = now;
+
+    if (was_stalled) {
+        std::cout << "Capture recovered after " << outage_ms << " ms without frames" << std::endl;
+        step = recovery_step::requeue;
+        reopen_attempts = 0;
+    }
+}
 
-            // timeout
-            tv.tv_sec = 2;
-            tv.tv_usec = 0;
+// Called whenever frames stopped coming or the device failed. Each call takes the next step of
+// the escalation; a step gets a stall timeout worth of time to bring frames back.
+void video_source::recover(const char *reason) {
+    const auto now = std::chrono::steady_clock::now();
+    if (now < next_attempt) {
+        // errors can repeat faster than a step can take effect
+        std::this_thread::sleep_for(std::min<std::chrono::steady_clock::duration>(next_attempt - now, std::chrono::milliseconds(100)));
+        return;
+    }
 
-            r = select(fd + 1, &fds, nullptr, nullptr, &tv);
-        } while ((r == -1 && (errno = EINTR)));
+    bool new_stall;
+    {
+        std::lock_guard<std::mutex> lock(health_mutex);
+        new_stall = !stats.stalled;
+        if (new_stall) {
+            stats.stalled = true;
+            stats.stalls++;
+        }
+    }
+    if (new_stall) {
+        std::cout << "Capture stalled (" << reason << "), no frame for "
+                  << std::chrono::duration<float, std::milli>(now - last_frame).count() << " ms" << std::endl;
+    }
 
-        if (r == -1) {
-            perror("select");
+    {
+        std::lock_guard<std::mutex> lock(hotplug_mutex);
+        if (!device_present) {
+            // unplugged, the device monitor tells us when it is back
+            next_attempt = now + std::chrono::milliseconds(100);
             return;
         }
+    }
 
-        CLEAR(video_buffer);
-        video_buffer.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
-        video_buffer.memory = V4L2_MEMORY_MMAP;
+    if (!streaming) {
+        // nothing left to requeue or restart
+        step = recovery_step::reopen;
+    }
 
-        do {
-            r = v4l2_ioctl(fd, VIDIOC_DQBUF, &video_buffer);
-        } while (r == -1 && (errno == EBUSY || errno == EAGAIN));
-        if (r == 0) {
-            frame_buffer = static_cast<uint8_t *>(buffers_info[video_buffer.index].start);
+    auto wait = stall_timeout();
+    try {
+        switch (step) {
+            case recovery_step::requeue:
+                std::cout << "Requeueing capture buffers" << std::endl;
+                step = recovery_step::restart;
+                requeue_buffers();
+                break;
+            case recovery_step::restart:
+                std::cout << "Restarting capture stream" << std::endl;
+                step = recovery_step::reopen;
+                restart_stream();
+                break;
+            case recovery_step::reopen:
+                // back off while the device stays away
+                wait = std::min<std::chrono::steady_clock::duration>(wait * (1 << std::min(reopen_attempts, 4)), max_reopen_backoff);
+                reopen_attempts++;
+                std::cout << "Reopening " << device_path << " (attempt " << reopen_attempts << ")" << std::endl;
+                reopen_device();
+                break;
         }
-        xioctl(fd, VIDIOC_QBUF, &video_buffer);
+    } catch (const video_device_error& e) {
+        std::cerr << "Capture recovery failed: " << e.what() << std::endl;
+    }
 
+    next_attempt = std::chrono::steady_clock::now() + wait;
+}
 
-        fps.add_frame();
-        if (fps.updated()) {
-            std::cout << "Video source fps: " << fps.count() << std::endl;
-            fps.reset();
+// hands back every buffer the driver doesn't hold, in case one got lost on the way
+void video_source::requeue_buffers() {
+    const auto held = buffers_exported ? exporter.load()->reclaim() : std::vector<bool>();
+    for (size_t i = 0; i < n_buffers; ++i) {
+        if (i < held.size() && held[i]) {
+            // comes back through requeue_released()
+            continue;
+        }
+
+        v4l2_buffer buffer;
+        CLEAR(buffer);
+        buffer.index = i;
+        buffer.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+        buffer.memory = active->memory();
+        xioctl(fd, VIDIOC_QUERYBUF, &buffer);
+
+        if (!(buffer.flags & (V4L2_BUF_FLAG_QUEUED | V4L2_BUF_FLAG_DONE))) {
+            queue_buffer(i);
         }
     }
 }
 
+// STREAMOFF returns all buffers to us; the mappings stay, so published frames remain readable
+void video_source::restart_stream() {
+    buffer_type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+    xioctl(fd, VIDIOC_STREAMOFF, &buffer_type);
 
+    const auto held = buffers_exported ? exporter.load()->reclaim() : std::vector<bool>();
+    for (size_t i = 0; i < n_buffers; ++i) {
+        if (i < held.size() && held[i]) {
+            continue;
+        }
+        queue_buffer(i);
+    }
+
+    xioctl(fd, VIDIOC_STREAMON, &buffer_type);
+}
+
+// Exports the buffers of the stream just started. A subscriber reading them gets what the driver
+// wrote, so this is only done when libv4l doesn't convert the frames in between.
+void video_source::export_to_subscribers() {
+    // what can't change while the stream runs isn't asked again until it restarts
+    export_refused = true;
+    const uint32_t pixel_format = video_format.fmt.pix.pixelformat;
+    if (!profile.supports(pixel_format)) {
+        std::cout << "Not exporting capture buffers, " << fourcc_to_string(pixel_format)
+                  << " frames are converted by libv4l" << std::endl;
+        return;
+    }
+    if (n_buffers > dmabuf_max_buffers) {
+        std::cout << "Not exporting capture buffers, " << n_buffers << " are too many to pass" << std::endl;
+        return;
+    }
+    if (active->memory() == V4L2_MEMORY_USERPTR) {
+        std::cout << "Not exporting capture buffers, " << active->name() << " buffers have no dmabuf" << std::endl;
+        return;
+    }
+
+    // subscribers name buffers by index, so one that can't be passed fails them all
+    std::vector<int> exported;
+    std::vector<size_t> lengths;
+    auto fail = [&](const char *what) {
+        perror(what);
+        for (int e: exported) {
+            close(e);
+        }
+        export_refused = false;
+        next_export = std::chrono::steady_clock::now() + std::chrono::seconds(1);
+    };
+    for (size_t i = 0; i < n_buffers; ++i) {
+        if (buffers_info[i].fd >= 0) {
+            // imported dmabufs are passed on as they are
+            const int dup_fd = fcntl(buffers_info[i].fd, F_DUPFD_CLOEXEC, 0);
+            if (dup_fd < 0) {
+                fail("Cannot duplicate capture buffer fd");
+                return;
+            }
+            exported.push_back(dup_fd);
+            lengths.push_back(buffers_info[i].length);
+            continue;
+        }
 
+        v4l2_exportbuffer request;
+        CLEAR(request);
+        request.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+        request.index = i;
+        request.flags = O_RDONLY | O_CLOEXEC;
+        if (v4l2_ioctl(fd, VIDIOC_EXPBUF, &request) != 0) {
+            fail("VIDIOC_EXPBUF");
+            return;
+        }
+        exported.push_back(request.fd);
+        lengths.push_back(buffers_info[i].length);
+    }
+    exporter.load()->set_buffers(std::move(exported), lengths);
+    export_refused = false;
+    buffers_exported = true;
+    std::cout << "Exported " << n_buffers << " capture buffers, subscribers may hold "
+              << (n_buffers > min_driver_buffers ? n_buffers - min_driver_buffers : 0) << std::endl;
+}
+
+void video_source::requeue_released() {
+    for (uint32_t index: exporter.load()->take_released()) {
+        if (streaming) {
+            queue_buffer(index);
+        }
+    }
+}
+
+void video_source::reopen_device() {
+    release_device();
+
+    fd = v4l2_open(device_path.c_str(), O_RDWR | O_NONBLOCK, 0);
+    if (fd < 0) {
+        throw video_device_error("Cannot open " + device_path + ": " + strerror(errno));
+    }
+
+    // a replugged device may come back with other firmware
+    v4l2_capability caps;
+    CLEAR(caps);
+    xioctl(fd, VIDIOC_QUERYCAP, &caps);
+    profile = device_profile::load(fd, device_path, caps);
+
+    subscribe_events();
+    negotiate_format(width, height);
+    start_streaming();
+
+    v4l2_priority priority = V4L2_PRIORITY_RECORD;
+    v4l2_ioctl(fd, VIDIOC_S_PRIORITY, &priority);
+}
+
+// Unmaps and closes; the renderer keeps showing its last texture until frames come back.
+void video_source::release_device() {
+    {
+        auto lock = lock_buffers();
+        stop_streaming();
+    }
+    if (fd >= 0) {
+        v4l2_close(fd);
+        fd = -1;
+    }
+}
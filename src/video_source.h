@@ -1,37 +1,119 @@
 #pragma once
 
+#include <atomic>
+#include <mutex>
+#include <string>
 #include <thread>
 #include <linux/videodev2.h>
+#include "buffer_provider.h"
 #include "fps_counter.h"
+#include "frame_source.h"
+#include "device_monitor.h"
+#include "device_profile.h"
 
-struct video_buffer_info {
-    void *start;
-    size_t length;
-    uint32_t offset;
-};
+class dmabuf_exporter;
 
-class video_source {
+class video_source : public frame_source {
 public:
-    video_source(const std::string& src, int w, int h, size_t buffer_count = 4);
-    ~video_source();
+    // pixel_format: what to ask the device for; RGB24 is used when it can't deliver that
+    // memory: where to capture into; driver buffers are used for formats libv4l converts
+    video_source(const std::string& src, int w, int h, uint32_t pixel_format = V4L2_PIX_FMT_RGB24, size_t buffer_count = 4,
+                 capture_memory memory = capture_memory::mmap);
+    ~video_source() override;
 
-    uint8_t *frame_buffer = nullptr;
+    // STREAMOFF, release the buffers, S_FMT, map new ones and STREAMON on the open device
+    bool reconfigure(int w, int h) override;
+
+    capture_health health() const override;
+
+    float frame_rate() const override;
+
+    // Shares the capture buffers with other processes through a dmabuf_exporter on this socket.
+    // Only formats the device delivers itself can be exported, not what libv4l converts.
+    bool export_buffers(const std::string& socket_path) override;
 
     static void enumerate_video_devices();
 
 private:
+    void negotiate_format(uint32_t w, uint32_t h);
+    void start_streaming();
+    void stop_streaming();
+    bool allocate_buffers();
+    void free_buffers();
+    void queue_buffer(uint32_t index);
+    void start_thread();
+    void stop_thread();
+
+    void subscribe_events();
+    bool handle_events();
+    bool renegotiate();
+
+    // stall watchdog, runs on the capture thread
+    enum class recovery_step {
+        requeue,
+        restart,
+        reopen
+    };
+    bool wait_for_buffer();
+    void dequeue_frame();
+    void recover(const char *reason);
+    void frame_arrived(std::chrono::steady_clock::time_point now);
+    void requeue_buffers();
+    void restart_stream();
+    void reopen_device();
+    void release_device();
+
+    // dmabuf export, runs on the capture thread
+    void export_to_subscribers();
+    void requeue_released();
+    std::chrono::steady_clock::duration stall_timeout() const;
+
+    std::string device_path;
+    device_profile profile;
     uint32_t width, height;
+    uint32_t wanted_format;
     std::thread read_thread;
     volatile bool do_work;
     void read_fun();
     fd_set fds;
+    fd_set efds;
     timeval tv;
     int r, fd = -1;
     v4l2_buffer video_buffer;
     v4l2_format video_format;
     v4l2_requestbuffers buffer_request;
-    video_buffer_info *buffers_info;
+    video_buffer_info *buffers_info = nullptr;
+    buffer_provider *provider = nullptr;       // the kind of buffers asked for
+    buffer_provider *driver_buffers = nullptr; // mmap, for when that doesn't work
+    buffer_provider *active = nullptr;         // what the current stream captures into
     size_t n_buffers;
+    bool streaming = false;
     v4l2_buf_type buffer_type;
     fps_counter fps;
+
+    // source change recovery, measured from the event to the first frame in the new format
+    bool recovering = false;
+    std::chrono::steady_clock::time_point recovery_start;
+
+    // stalls are judged against the negotiated frame interval
+    std::chrono::steady_clock::duration frame_interval = std::chrono::milliseconds(33);
+    std::chrono::steady_clock::time_point last_frame;
+    std::chrono::steady_clock::time_point next_attempt;
+    recovery_step step = recovery_step::requeue;
+    int reopen_attempts = 0;
+
+    // hot-plug, set from the device monitor thread
+    device_monitor *monitor = nullptr;
+    std::mutex hotplug_mutex;
+    bool device_present = true;
+    std::string arrived_path;
+
+    // set once from the main thread, the capture thread exports when it sees it
+    std::atomic<dmabuf_exporter *> exporter{nullptr};
+    bool buffers_exported = false;
+    bool export_refused = false; // the stream's buffers can't be shared, until it is restarted
+    std::chrono::steady_clock::time_point next_export; // after an export that failed
+
+    mutable std::mutex health_mutex;
+    capture_health stats;
 };
\ No newline at end of file